@@ -26,7 +26,8 @@
  * - When low power and gpsfix, send once                                                   [test_gps_power_and_send_after_low_power_successful_join]
  * - When low power and gpsfix, store location once                                         TODO LowPowerFix terminates when BOTH send & store complete
  * - When low power and joined and sent once, sleep                                         [test_gps_power_and_send_after_low_power_successful_join]
- * - When low power and joined and waketime > 5m, sleep (still awake because no gpsfix)     [test_5m_limit_on_low_power_gps_search]
+ * - When low power and joined and waketime > 10m, sleep (still awake because no gpsfix)    [test_max_limit_on_low_power_gps_search]
+ * - When low power and joined, search again 10m after the last cycle, or hourly if parked    [test_simulate_parked_on_battery]
  * - When low powered and Δack-received-count and (frame counter > 14,000), attempt rejoin
  *
  *******************************************************************************/
@@ -51,14 +52,23 @@
 #include "gps.h"
 #include "storage.h"
 #include "ui.h"
+#include "sleep.h"
+#include "pins.h"
+#include "deferred_executor.h"
+#include "journal.h"
 
 // #define LOGLEVEL LOG_LEVEL_DEBUG //  _NOOUTPUT, _ERRORS, _WARNINGS, _INFOS, _DEBUG, _VERBOSE
 
 RTC_PCF8523 gRTC;
-Clock gClock;
-Executor<AppState> gExecutor;
+SleepClock gClock;
+// Actions run from loop(), not inside updates. An update queues at most a few
+// of each kind, and loop() drains them all most iterations, so 6 per ring
+// leaves room for a slow loop. AppState copies are lean now, so the 26 it
+// holds take about the RAM 18 took before.
+DeferredExecutor<6> gExecutor(&gClock);
 AppState gState;
-RespireContext<AppState> gRespire(gState, ModeMain, &gClock, &gExecutor);
+JournalingContext gRespire(gState, ModeMain, &gClock, &gExecutor);
+Journal gJournal(&gClock, appendJournalToSD);
 
 Timer gTimer;
 
@@ -69,10 +79,11 @@ const char *appKey = "4681950BEFE343C33BD9BB81CA68A89E";
 
 #define PACKET_FORMAT_ID 0x05
 
-// Pin mapping
-#define VBATPIN A7
-#define VUSBPIN A1
+#define SLEEP_MIN_MS 2000                   // Standby has 1s resolution; shorter waits stay awake
+#define SLEEP_MAX_MS MINUTES_IN_MILLIS(60)  // Re-check battery and schedule at least hourly
+#define ACTION_BUDGET_MS 20                 // Time per loop() for queued actions
 
+// Radio pin mapping; the rest are in pins.h
 #define LORA_CS 8
 const Arduino_LoRaWAN::lmic_pinmap define_lmic_pins = {
 // Feather LoRa wiring (with IO1 <--> GPIO#6)
@@ -88,6 +99,11 @@ ParameterStore gParameters(byteStore);
 LoraStack_LoRaWAN lorawan(define_lmic_pins, gParameters);
 LoraStack node(lorawan, gParameters, TTN_FP_US915);
 
+// Set when a send completes, so loop() snapshots the state and GPS assist
+// data and writes the store to SD once the radio is idle rather than inside
+// LMIC's callback.
+static bool gStoreDue = false;
+
 void onEvent(void *ctx, uint32_t event) {
   if (event==EV_TXCOMPLETE) {
     Log.Debug(F("EV_TXCOMPLETE (includes waiting for RX windows)" CR));
@@ -103,7 +119,7 @@ void onEvent(void *ctx, uint32_t event) {
         state.transmittedFrame(LMIC.seqnoUp);
       });
     }
-    writeParametersToSD(gParameters);
+    gStoreDue = true;
     digitalWrite(LED_BUILTIN, LOW);
   }
   else {
@@ -128,6 +144,7 @@ void onEvent(void *ctx, uint32_t event) {
             Log.Debug(F("Writing parameters to SD card\n"));
             writeParametersToSD(gParameters);
             gRespire.complete(ModeAttemptJoin, [](AppState &state){
+              AppState::Batch batch(state);
               state.setJoined(true);
               state.transmittedFrame(LMIC.seqnoUp);
             });
@@ -214,6 +231,47 @@ static void readUSBVolts() {
   gState.setUsbPower(volts>4.4);
 }
 
+static uint32_t rtcSeconds() {
+  return gRTC.now().unixtime();
+}
+
+// Real time in seconds for AppState snapshots, 0 if the RTC has not been set.
+static uint32_t snapshotSeconds() {
+  return gRTC.initialized() ? gRTC.now().secondstime() : 0;
+}
+
+// Stores the AppState snapshot in the parameter store. Callers write the store
+// to SD, which is what makes it survive a reset.
+static void saveAppState() {
+  AppStateSnapshot snapshot;
+  gState.snapshot(snapshot, snapshotSeconds());
+  if (gParameters.set("APPSTAT", (const uint8_t *)&snapshot, sizeof(snapshot))!=PS_SUCCESS) {
+    Log.Error(F("Failed to store AppState snapshot" CR));
+  }
+}
+
+// UTC seconds for GPS assist data, 0 if the RTC has not been set.
+static uint32_t gpsSeconds() {
+  return gRTC.initialized() ? gRTC.now().unixtime() : 0;
+}
+
+// Stores GPS assist data and TTFF history in the parameter store, like the
+// AppState snapshot.
+static void saveGpsAssist() {
+  const GpsAssist &assist = gpsAssist();
+  if (gParameters.set("GPSASST", (const uint8_t *)&assist, sizeof(assist))!=PS_SUCCESS) {
+    Log.Error(F("Failed to store GPS assist data" CR));
+  }
+}
+
+static void onWake() {
+  // Nothing to do; loop() reads inputs again after standby.
+}
+
+static bool radioBusy() {
+  return (LMIC.opmode & (OP_TXRXPEND | OP_JOINING | OP_POLL)) != 0;
+}
+
 bool do_send(const AppState &state, const bool withAck) {
     // Check if there is not a current TX/RX job running
     // if (LMIC.opmode & OP_TXRXPEND) {
@@ -312,7 +370,7 @@ void setup() {
     Log.Debug(F("Starting" CR));
 
     Log.Debug(F("Setup GPS" CR));
-    gpsSetup();
+    gpsSetup(gpsSeconds);
 
     Log.Debug(F("Setup UI" CR));
     uiSetup();
@@ -348,12 +406,30 @@ void setup() {
     }
 
     Log.Debug(F("Setup Respire" CR));
-    RespireParameterStore store(gParameters);
+    RespireParameterStore parameterStore(gParameters);
+    JournalingStore store(parameterStore, gJournal); // Replays restore what Respire loads here
 
+    gState.setClock(&gClock);
     Log.Debug(F("Init Respire (at %d)" CR), realTimeNow);
+    gJournal.respireInit(realTimeNow);
     gRespire.init(realTimeNow, &store); // No actions are performed until begin() call below.
+    gJournal.flush();
     gState.setUsbPower(true);
 
+    // Warm boot: pick up where we were before the reset. The snapshot is
+    // authoritative for the page and the last GPS sample only: joined and the
+    // frame counter are replaced below from the session keys and FCNTUP, which
+    // are what LMIC itself restores and transmits with.
+    AppStateSnapshot snapshot;
+    if (gParameters.get("APPSTAT", (uint8_t *)&snapshot, sizeof(snapshot))==PS_SUCCESS) {
+      const bool restored = gState.restore(snapshot, realTimeNow);
+      Log.Debug(F("Restored AppState snapshot: %T" CR), restored);
+    }
+    GpsAssist assist;
+    if (gParameters.get("GPSASST", (uint8_t *)&assist, sizeof(assist))==PS_SUCCESS && assist.valid()) {
+      gpsSetAssist(assist);
+    }
+
     Log.Debug(F("Setting lorawan debug mask." CR));
     lorawan.SetDebugMask(Arduino_LoRaWAN::LOG_BASIC | Arduino_LoRaWAN::LOG_ERRORS | Arduino_LoRaWAN::LOG_VERBOSE);
     Log.Debug(F("Registering lorawan event listener." CR));
@@ -384,6 +460,7 @@ void setup() {
     LMIC_setLinkCheckMode(0);
 
     // Are we already joined? (Do we have session vars APPSKEY, NWKSKEY, and DEVADDR?)
+    // Overrides the snapshot's joined and frame counter, see above.
     uint8_t buffer[16];
     bool joined = gParameters.get("APPSKEY", buffer, 16)==PS_SUCCESS;
     joined |= gParameters.get("NWKSKEY", buffer, 16)==PS_SUCCESS;
@@ -398,10 +475,6 @@ void setup() {
       }
     }
 
-    gTimer.every(10 * 1000, [](){
-      // gpsDump(Serial);
-      gState.dump();
-    });
     gTimer.every(1000, []() {
       readBatteryVolts();
     });
@@ -411,6 +484,13 @@ void setup() {
       });
     });
 
+    sleepSetup(onWake);
+
+    // Journal from here on: the state as begin() sees it, then every input and completion
+    gJournal.boot(gState);
+    gState.setInputObserver(Journal::observeInputs, &gJournal);
+    gRespire.setJournal(&gJournal);
+
     gRespire.begin();
     gState.dump();
 
@@ -420,16 +500,51 @@ void setup() {
 void loop() {
   // Log.Debug(F("loop" CR)); delay(1000);
   lorawan.loop();
-  uiLoop();
 
-  if (!ModeSend.isActive(gState) && !ModeAttemptJoin.isActive(gState)) {
-    // Do parsing and timer optional things that could throw off LoRa timing only while NOT sending.
-    gpsLoop(Serial);
-    gTimer.update();
-    gState.setGpsFix(gpsHasFix()); // Quick if value didn't change
+  // Do parsing and timer optional things that could throw off LoRa timing only while NOT sending.
+  // GPS bytes are still captured meanwhile and parsed once the radio is idle.
+  gpsCapture();
+  const bool radioIdle = !ModeSend.isActive(gState) && !ModeAttemptJoin.isActive(gState);
+  if (radioIdle) {
+    gpsLoop(Serial); // May complete ModeReadGps, so keep it outside the batch below
+  }
+
+  {
+    // Inputs sampled this iteration are evaluated in one update cycle.
+    AppState::Batch batch(gState);
+    uiLoop();
+    if (radioIdle) {
+      gTimer.update();
+      gState.setGpsFix(gpsHasFix()); // Quick if value didn't change
+      gState.setStationary(gpsStationary());
+      gState.setGpsSearchOver(gpsSearchOver());
+    }
   }
 
   gRespire.loop();
+  gExecutor.drain(ACTION_BUDGET_MS);
+  gpsSetPhase(gpsPhase(gState)); // Sentences and rate for what the GPS is needed for now
+  gJournal.activeModes(activeModes(gState));
+  if (gJournal.flushDue() && !radioBusy()) {
+    gJournal.flush(); // SD writes wait for the radio, as in the standby path below
+  }
+  if (gStoreDue && !radioBusy()) {
+    gStoreDue = false;
+    saveAppState();
+    saveGpsAssist();
+    writeParametersToSD(gParameters);
+  }
+
+  // Stand by until Respire next needs to act. The 1s battery/USB timers are
+  // not a reason to stay awake: USB changes wake us and we re-read both after.
+  const uint32_t sleepMs = gState.sleepInterval(ModeMain, SLEEP_MAX_MS);
+  if (sleepMs >= SLEEP_MIN_MS && !radioBusy() && gExecutor.pending()==0) {
+    gJournal.flush();
+    gpsSleeping(sleepMs);
+    sleepFor(sleepMs, gClock, rtcSeconds);
+    readUSBVolts();
+    readBatteryVolts();
+  }
 }
 
 void LMIC_DEBUG_PRINTF(const char *fmt, ...) {
@@ -449,17 +564,22 @@ void changeGpsPower(const AppState &state, const AppState &oldState, Mode<AppSta
   gpsEnable(state.getGpsPower());
 }
 
+static void gpsReadSuccess(const GpsSample &gpsSample, void *context) {
+  Log.Debug("Successfully read GPS\n");
+  // Capture is a single reference, small enough to avoid a heap allocation
+  gRespire.complete((Mode<AppState> *)context, [&gpsSample](AppState &state){
+    state.setGpsLocation(gpsSample);
+  });
+}
+
+static void gpsReadFailure(void *context) {
+  Log.Error("Failed to read GPS\n");
+  gRespire.complete((Mode<AppState> *)context);
+}
+
 void readGpsLocation(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
   Log.Debug("Reading GPS location with gps power: %T\n", state.getGpsPower());
-  gpsRead([triggeringMode](const GpsSample &gpsSample) {
-    Log.Debug("Successfully read GPS\n");
-    gRespire.complete(triggeringMode, [&gpsSample](AppState &state){
-      state.setGpsLocation(gpsSample);
-    });
-  }, [triggeringMode]() {
-    Log.Error("Failed to read GPS\n");
-    gRespire.complete(triggeringMode);
-  });
+  gpsRead(gpsReadSuccess, gpsReadFailure, triggeringMode);
 }
 
 void attemptJoin(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
@@ -469,8 +589,11 @@ void attemptJoin(const AppState &state, const AppState &oldState, Mode<AppState>
 }
 
 void changeSleep(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
-  // Enter or exit Sleep state
+  // Enter or exit Sleep state. The MCU itself stands by from loop() while Sleep is active.
   Log.Debug("Entering sleep mode...\n");
+  saveAppState();
+  saveGpsAssist();
+  writeParametersToSD(gParameters);
 }
 
 void sendLocation(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
@@ -0,0 +1,80 @@
+/*
+  ByteRing - Single-producer, single-consumer byte FIFO that an interrupt
+  handler can fill while loop() drains it.
+
+  The producer only writes _head and the consumer only writes _tail, so no
+  locking is needed as long as there is one of each. Size must be a power of
+  two; one slot is kept free to tell full from empty. Bytes that arrive while
+  the ring is full are dropped and counted.
+ */
+
+#ifndef BYTE_RING_H
+#define BYTE_RING_H
+
+#include <stdint.h>
+
+template <uint16_t Size>
+class ByteRing {
+  static_assert(Size >= 2 && (Size & (Size - 1))==0, "ByteRing size must be a power of two");
+
+  uint8_t _bytes[Size];
+  volatile uint16_t _head = 0;      // Next slot to write; producer only
+  volatile uint16_t _tail = 0;      // Next slot to read; consumer only
+  volatile uint32_t _received = 0;  // Bytes offered to push()
+  volatile uint32_t _dropped = 0;   // Bytes lost because the ring was full
+  volatile uint16_t _highWater = 0; // Most bytes ever waiting
+
+  public:
+  // Producer side, e.g. from an ISR. Returns false if the byte was dropped.
+  bool push(uint8_t byte) {
+    ++_received;
+    const uint16_t head = _head;
+    const uint16_t next = (head + 1) & (Size - 1);
+    if (next==_tail) {
+      ++_dropped;
+      return false;
+    }
+    _bytes[head] = byte;
+    _head = next;
+    const uint16_t used = (next - _tail) & (Size - 1);
+    if (used > _highWater) {
+      _highWater = used;
+    }
+    return true;
+  }
+
+  // Consumer side. Copies up to size bytes into buffer and returns how many.
+  uint16_t pop(uint8_t *buffer, uint16_t size) {
+    uint16_t tail = _tail;
+    const uint16_t head = _head;
+    uint16_t n = 0;
+    while (tail!=head && n<size) {
+      buffer[n++] = _bytes[tail];
+      tail = (tail + 1) & (Size - 1);
+    }
+    _tail = tail;
+    return n;
+  }
+
+  uint16_t available() const {
+    return (_head - _tail) & (Size - 1);
+  }
+
+  static uint16_t capacity() {
+    return Size - 1;
+  }
+
+  uint32_t received() const {
+    return _received;
+  }
+
+  uint32_t dropped() const {
+    return _dropped;
+  }
+
+  uint16_t highWater() const {
+    return _highWater;
+  }
+};
+
+#endif
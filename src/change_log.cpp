@@ -0,0 +1,116 @@
+#include "change_log.h"
+#include <Logging.h>
+#include <stdarg.h>
+
+#define ELEMENTS(_array) (sizeof(_array) / sizeof(_array[0]))
+
+ChangeLog gChangeLog;
+static bool gChangeLogging = true;
+
+// Boolean fields whose values are kept in ChangeRecord::_flags
+static const FieldMask kFlagFields = FieldUsbPower | FieldGpsFix | FieldGpsSample | FieldJoined | kButtonFields | FieldRedisplay | FieldStationary | FieldGpsSearchOver;
+
+static const char *const kFieldNames[] = {
+  "usb", "bat", "fix", "loc", "fcnt", "join", "page", "field", "btnP", "btnF", "btnC", "redisp", "still", "gaveup",
+};
+
+static FieldMask flagsOf(const AppState &state) {
+  FieldMask flags = 0;
+  if (state.getUsbPower()) flags |= FieldUsbPower;
+  if (state.hasGpsFix()) flags |= FieldGpsFix;
+  if (state.hasRecentGpsLocation()) flags |= FieldGpsSample;
+  if (state.getJoined()) flags |= FieldJoined;
+  if (state.buttonPage()) flags |= FieldButtonPage;
+  if (state.buttonField()) flags |= FieldButtonField;
+  if (state.buttonChange()) flags |= FieldButtonChange;
+  if (state.redisplayRequested()) flags |= FieldRedisplay;
+  if (state.isStationary()) flags |= FieldStationary;
+  if (state.gpsSearchOver()) flags |= FieldGpsSearchOver;
+  return flags;
+}
+
+ChangeRecord makeChangeRecord(const AppState &state, const AppState &oldState) {
+  ChangeRecord record;
+  record._millis = state.now(); // Respire's clock, which keeps counting through standby
+  record._counter = (uint16_t)state.changeCounter();
+  record._fields = state.changes(oldState);
+  record._flags = flagsOf(state);
+  record._batteryMillivolts = (uint16_t)(state.batteryVolts() * 1000);
+  record._frameCounter = state.ttnFrameCounter();
+  record._page = state.page();
+  record._field = state.field();
+  const uint32_t active = activeModes(state);
+  const uint32_t wasActive = activeModes(oldState);
+  record._activated = active & ~wasActive;
+  record._deactivated = wasActive & ~active;
+  return record;
+}
+
+static size_t append(char *buffer, size_t size, size_t len, const char *format, ...) {
+  if (len >= size) {
+    return len;
+  }
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(buffer + len, size - len, format, args);
+  va_end(args);
+  return n < 0 ? len : len + n;
+}
+
+size_t formatChangeRecord(char *buffer, size_t size, const ChangeRecord &record) {
+  size_t len = append(buffer, size, 0, "#%u @%lu", (unsigned)record._counter, (unsigned long)record._millis);
+  for (uint8_t i=0; i<ELEMENTS(kFieldNames); ++i) {
+    const FieldMask bit = 1 << i;
+    if (!(record._fields & bit)) {
+      continue;
+    }
+    if (bit & kFlagFields) {
+      len = append(buffer, size, len, " %s=%d", kFieldNames[i], (record._flags & bit) ? 1 : 0);
+    }
+    else if (bit==FieldBatteryVolts) {
+      len = append(buffer, size, len, " %s=%umV", kFieldNames[i], (unsigned)record._batteryMillivolts);
+    }
+    else if (bit==FieldTtnFrame) {
+      len = append(buffer, size, len, " %s=%lu", kFieldNames[i], (unsigned long)record._frameCounter);
+    }
+    else if (bit==FieldPage) {
+      len = append(buffer, size, len, " %s=%u", kFieldNames[i], (unsigned)record._page);
+    }
+    else if (bit==FieldField) {
+      len = append(buffer, size, len, " %s=%u", kFieldNames[i], (unsigned)record._field);
+    }
+  }
+  for (uint8_t i=0; i<modeCount(); ++i) {
+    if (record._activated & (1UL << i)) {
+      len = append(buffer, size, len, " +%s", modeAt(i)->name());
+    }
+    if (record._deactivated & (1UL << i)) {
+      len = append(buffer, size, len, " -%s", modeAt(i)->name());
+    }
+  }
+  return len < size ? len : size - 1;
+}
+
+void ChangeLog::dump() const {
+  char line[160];
+  for (uint8_t i=0; i<_count; ++i) {
+    formatChangeRecord(line, sizeof(line), at(i));
+    Log.Debug("%s\n", line);
+  }
+}
+
+void setChangeLogging(bool enabled) {
+  gChangeLogging = enabled;
+}
+
+void logStateChange(const AppState &state, const AppState &oldState) {
+  // Records are only ever printed at Debug, so below it none is built
+  if (!gChangeLogging || LOGLEVEL < LOG_LEVEL_DEBUG) {
+    return;
+  }
+  const ChangeRecord record = makeChangeRecord(state, oldState);
+  gChangeLog.add(record);
+  char line[160];
+  formatChangeRecord(line, sizeof(line), record);
+  Log.Debug("State %s\n", line);
+}
@@ -0,0 +1,62 @@
+#ifndef CHANGE_LOG_H
+#define CHANGE_LOG_H
+
+#include "mm_state.h"
+
+// Fixed-size record of one state update. Only the fields and Modes that
+// changed are flagged; values are captured compactly so the record can be
+// kept in RAM or written out as-is and pretty-printed later.
+typedef struct ChangeRecord {
+  uint32_t _millis = 0;
+  uint32_t _frameCounter = 0;
+  uint32_t _activated = 0;        // Bit per Mode index that became active
+  uint32_t _deactivated = 0;      // Bit per Mode index that became inactive
+  uint16_t _counter = 0;          // Low bits of changeCounter()
+  FieldMask _fields = 0;          // Fields that changed
+  FieldMask _flags = 0;           // Values of boolean fields, same bits as _fields
+  uint16_t _batteryMillivolts = 0;
+  uint8_t _page = 0;
+  uint8_t _field = 0;
+} ChangeRecord;
+
+ChangeRecord makeChangeRecord(const AppState &state, const AppState &oldState);
+
+// Formats the changed fields and Modes of record as one line. Returns the length written.
+size_t formatChangeRecord(char *buffer, size_t size, const ChangeRecord &record);
+
+// Keeps the most recent records so they can be printed after the fact.
+class ChangeLog {
+  static const uint8_t kCapacity = 16;
+  ChangeRecord _records[kCapacity];
+  uint8_t _next = 0;
+  uint8_t _count = 0;
+
+  public:
+  void add(const ChangeRecord &record) {
+    _records[_next] = record;
+    _next = (_next + 1) % kCapacity;
+    if (_count < kCapacity) {
+      ++_count;
+    }
+  }
+
+  uint8_t count() const {
+    return _count;
+  }
+
+  // Records from oldest (0) to newest (count()-1).
+  const ChangeRecord &at(uint8_t index) const {
+    return _records[(_next + kCapacity - _count + index) % kCapacity];
+  }
+
+  void dump() const;
+};
+
+extern ChangeLog gChangeLog;
+
+// Turns recording and logging of state changes on or off (on by default).
+// Native tools that run devices on several threads turn it off, since
+// gChangeLog is shared.
+void setChangeLogging(bool enabled);
+
+#endif
@@ -0,0 +1,117 @@
+/*
+  DeferredExecutor - Runs Mode actions from loop() instead of from inside the
+  Respire update cycle.
+
+  exec() copies the action, its trigger and both states into a bounded ring
+  and returns, so a slow action (SD write, join, OLED redraw) neither stalls
+  state evaluation nor nests complete()/onUpdate calls. drain() runs queued
+  actions until a per-call time budget is spent. Radio and GPS actions go in
+  an urgent ring that is always drained before display, logging and Sleep
+  actions. Order is preserved within each ring.
+
+  If a ring is full the action is dropped and counted rather than run inside
+  the update after all. Its Mode then waits on a completion that never comes,
+  so rings are sized for that never to happen (see ManhattanMapper.ino).
+ */
+
+#ifndef DEFERRED_EXECUTOR_H
+#define DEFERRED_EXECUTOR_H
+
+#include "mm_state.h"
+
+// Actions whose timing matters to the radio or GPS, run ahead of the rest.
+// changeSleep is not one: it writes the parameter store and SD.
+inline bool urgentAction(Mode<AppState>::ActionFn fn) {
+  return fn==attemptJoin || fn==sendLocation || fn==sendLocationAck
+      || fn==changeGpsPower || fn==readGpsLocation;
+}
+
+// Each slot holds two AppState copies, as does the running action, so the
+// executor costs (4 * Capacity + 2) AppStates of RAM.
+template <uint8_t Capacity>
+class DeferredExecutor : public Executor<AppState> {
+  typedef struct Action {
+    Mode<AppState>::ActionFn fn;
+    Mode<AppState> *trigger;
+    AppState state;
+    AppState oldState;
+  } Action;
+
+  class Ring {
+    Action _actions[Capacity];
+    uint8_t _head = 0;
+    uint8_t _count = 0;
+
+    public:
+    bool full() const {
+      return _count==Capacity;
+    }
+
+    uint8_t count() const {
+      return _count;
+    }
+
+    void push(Mode<AppState>::ActionFn fn, const AppState &state, const AppState &oldState, Mode<AppState> *trigger) {
+      Action &action = _actions[(_head + _count) % Capacity];
+      action.fn = fn;
+      action.trigger = trigger;
+      action.state = state;
+      action.oldState = oldState;
+      ++_count;
+    }
+
+    // Runs the oldest action. The slot is released first so that the action
+    // may queue more work.
+    void runOne(Action &scratch) {
+      scratch = _actions[_head];
+      _head = (_head + 1) % Capacity;
+      --_count;
+      scratch.fn(scratch.state, scratch.oldState, scratch.trigger);
+    }
+  };
+
+  Clock *_clock;
+  Ring _urgent;
+  Ring _background;
+  Action _running;
+  uint16_t _dropped = 0;
+
+  public:
+  DeferredExecutor(Clock *clock)
+  : _clock(clock) {
+  }
+
+  virtual void exec(Mode<AppState>::ActionFn fn, const AppState &state, const AppState &oldState, Mode<AppState> *trigger) {
+    Ring &ring = urgentAction(fn) ? _urgent : _background;
+    if (ring.full()) {
+      ++_dropped;
+      Log.Error("Action queue full, dropping %s\n", trigger!=NULL ? trigger->name() : "action");
+      return;
+    }
+    ring.push(fn, state, oldState, trigger);
+  }
+
+  // Runs queued actions, urgent ones first, until none are left or budgetMs
+  // has elapsed. At least one action runs per call so that work always
+  // progresses. Returns the number run.
+  uint8_t drain(const uint32_t budgetMs) {
+    const uint32_t start = _clock->millis();
+    uint8_t run = 0;
+    while (pending()>0 && (run==0 || _clock->millis() - start < budgetMs)) {
+      (_urgent.count()>0 ? _urgent : _background).runOne(_running);
+      ++run;
+    }
+    return run;
+  }
+
+  uint8_t pending() const {
+    return _urgent.count() + _background.count();
+  }
+
+  // Actions dropped because their ring was full.
+  uint16_t dropped() const {
+    return _dropped;
+  }
+};
+
+#endif
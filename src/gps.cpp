@@ -5,89 +5,172 @@
 #include <Adafruit_GPS.h>
 #include <Arduino.h>
 #include <Logging.h>
-#include <Adafruit_ZeroTimer.h>
-#include <ParameterStore.h> // For htonl htons
 #include <Timer.h>
 
 #include "gps.h"
-
-#define ELEMENTS(_array) (sizeof(_array) / sizeof(_array[0]))
-
-#define GPS_FIX_PIN 18
-#define GPS_ENABLE_PIN 19
+#include "byte_ring.h"
+#include "gps_fix.h"
+#include "gps_reader.h"
+#include "pins.h"
 
 #define GPS_WAKE_UP_TIME 500 // Milliseconds. NOTE: This is not empirical. Could be optimized after observation.
+// Switching the GPS off puts it in standby (PMTK161) rather than cutting its
+// power, so it keeps its ephemeris and time and comes back with a hot start.
+// Standby still draws current, so once the MCU has slept this long the GPS
+// is powered down; by then the cold start it saves costs less than waiting.
+#define GPS_STANDBY_MAX_MS (30 * 60 * 1000UL)
 Timer gInitTimer;
 
 HardwareSerial &gpsSerial = Serial1;
 Adafruit_GPS GPS(&gpsSerial);
-std::function< void(const GpsSample &gpsSample) > gReadSuccess;
-std::function< void(void) > gReadFailure;
+
+// GPS bytes are moved from Serial1 into gpsRing by gpsCapture() on every
+// loop(), so they survive loop() skipping gpsLoop while the radio is busy.
+// Between loops they wait in Serial1's own buffer, filled by its SERCOM
+// receive interrupt. The phases' output is a few sentences a second at most
+// (see gps_phase.h), so 1KB holds several seconds of it; at 9600 baud even
+// continuous output takes a second to fill it.
+#define GPS_RING_SIZE 1024
+static ByteRing<GPS_RING_SIZE> gpsRing;
+static bool gpsCapturing = false;            // Serial1 is ours while the GPS is enabled
+#ifdef GPS_BINARY
+// Binary position packets from DIYDrones MTK firmware: 37 bytes per fix
+// instead of ~150 of RMC+GGA, at a baud rate that keeps each one short.
+#define GPS_BAUD 38400
+#else
+#define GPS_BAUD 9600
+#endif
+
+// The capture ring as the reader's byte source.
+class GpsRingSource : public GpsByteSource {
+  public:
+  virtual uint16_t read(uint8_t *buffer, uint16_t size) {
+    return gpsRing.pop(buffer, size);
+  }
+
+  virtual uint32_t available() const {
+    return gpsRing.available();
+  }
+};
+
+static GpsRingSource gpsSource;
+static GpsReader gpsReader(gpsSource);
+static bool gpsConfigured = false;           // Set while the GPS is awake and configured
+static GpsPhase gpsWantedPhase = GpsPhaseIdle;
+static GpsPhase gpsAppliedPhase = GpsPhaseOff;
+static bool gpsStandby = false;              // Powered but in standby
+static uint32_t gpsStandbyMs = 0;            // Time the MCU has slept since standby began
+static GpsTtff gpsTtff;
+static bool gpsSearchGivenUp = false;        // Until the GPS is next turned off; see gpsSearchOver()
+static uint32_t gpsSearchWindowMs = 0;       // Set when the GPS is turned on; see gpsSearchOver()
+static uint32_t (*gpsSecondsNow)(void) = NULL; // UTC seconds from the RTC, 0 if unknown
 
 // Set GPSECHO to 'false' to turn off echoing the GPS data to the Serial console
 // Set to 'true' if you want to debug and listen to the raw GPS sentences.
 #define GPSECHO false
 
-static volatile bool gpsHasFixStatus = false;
-static uint8_t gpsFixIndex = 0;
-static bool gpsFixHistory[5];
-static Adafruit_ZeroTimer gpsFixTimer = Adafruit_ZeroTimer(4);
-
-void gpsFixISR(struct tc_module *const module_inst) {
-  // Used to distinguish between 2 signals
-  // No GPS Fix: ____----____----____----____----____----____----         (1s low, 1s high)
-  // Yes GPS Fix: __________-____________________________-________________ (15s low, 200ms high)
-  // Called every 350ms, fill a buffer of 5 samples. If two of them are high, it's the first signal.
-  // Period must be:
-  //   p < 500 so that a high signal for 1 second will always yield two high samples
-  //   p > 333 so that if we start sampling at low start, the 4th & 5th samples will be in the high phase.
-  //   Prefer a shorter period so that 5 cycles happen more quickly and we recognize our state.
-  //   I choose 350ms to give a little wiggle room. The GPS clock is ns accurate, but our mcu timer is not.
-  //   Worst case, it'll take 5 * 350ms (1.75s) to figure out we lost fix. 1s to figure out we acheived fix.
-
-  // static bool ledFlash = false;
-  // digitalWrite(LED_BUILTIN, (ledFlash = !ledFlash));
-
-  bool sample = digitalRead(GPS_FIX_PIN);
-  gpsFixHistory[gpsFixIndex] = sample;
-  gpsFixIndex = ++gpsFixIndex % ELEMENTS(gpsFixHistory);
-
-  uint8_t countHigh = 0;
-  for (uint8_t i=0; i<ELEMENTS(gpsFixHistory); ++i) {
-    if (gpsFixHistory[i]) {
-      ++countHigh;
-    }
+static GpsFixDetector gpsFixDetector;
+
+void gpsFixISR() {
+  gpsFixDetector.edge(digitalRead(GPS_FIX_PIN), millis());
+}
+
+void gpsCapture() {
+  if (!gpsCapturing) {
+    return;
+  }
+  while (gpsSerial.available()) {
+    gpsRing.push(gpsSerial.read());
   }
-  gpsHasFixStatus = (countHigh <= 1);
 }
 
 bool gpsHasFix() {
-  return gpsHasFixStatus;
+  noInterrupts();
+  const bool fix = gpsFixDetector.fix(millis());
+  interrupts();
+  uint32_t ttffMs;
+  if (fix && gpsTtff.fix(millis(), ttffMs)) {
+    Log.Debug("GPS fix after %d ms\n", ttffMs);
+    gpsReader.assist().recordFix(ttffMs, gpsSecondsNow ? gpsSecondsNow() : 0);
+  }
+  return fix;
 }
 
-static void gpsFixHistoryReset() {
-  gpsHasFixStatus = false;
-  gpsFixIndex = 0;
-  for (uint8_t i=0; i<ELEMENTS(gpsFixHistory); ++i) {
-    gpsFixHistory[i] = true;
+// Sends body, e.g. "PMTK220,1000", with its checksum.
+static void gpsCommand(const char *body) {
+  char sentence[48];
+  if (nmeaSentence(sentence, sizeof(sentence), body)) {
+    gpsSerial.print(sentence);
+  }
+}
+
+// Configures output for gpsWantedPhase, if the GPS is ready and it has changed.
+static void gpsApplyPhase() {
+  if (!gpsConfigured || gpsWantedPhase==gpsAppliedPhase || gpsWantedPhase==GpsPhaseOff) {
+    return;
+  }
+  Log.Debug("GPS phase %d\n", gpsWantedPhase);
+  const GpsOutput &output = gpsOutput(gpsWantedPhase);
+  const bool periodic = output.sleepMs!=0;
+  const bool wasPeriodic = gpsOutput(gpsAppliedPhase).sleepMs!=0;
+  char sentence[64];
+  if (wasPeriodic && !periodic) {
+    // Back to continuous first, so the rest isn't sent to a sleeping GPS
+    if (gpsPeriodicSentence(sentence, sizeof(sentence), output)) {
+      gpsSerial.print(sentence);
+    }
+  }
+#ifndef GPS_BINARY
+  if (gpsOutputSentence(sentence, sizeof(sentence), output)) {
+    gpsSerial.print(sentence);
+  }
+#endif
+  if (gpsRateSentence(sentence, sizeof(sentence), output)) {
+    gpsSerial.print(sentence);
+  }
+  if (periodic && !wasPeriodic) {
+    if (gpsPeriodicSentence(sentence, sizeof(sentence), output)) {
+      gpsSerial.print(sentence);
+    }
   }
+  gpsAppliedPhase = gpsWantedPhase;
+}
+
+static void gpsPower(bool on) {
+  digitalWrite(GPS_ENABLE_PIN, !on);
+}
+
+static void gpsWatchFix() {
+  Log.Debug("GPS watch fix pin\n");
+  gpsFixDetector.start(digitalRead(GPS_FIX_PIN), millis());
+  attachInterrupt(digitalPinToInterrupt(GPS_FIX_PIN), gpsFixISR, CHANGE);
 }
 
 static void gpsInit() {
   // 9600 NMEA is the default baud rate for Adafruit MTK GPS's- some use 4800
   GPS.begin(9600);
+#if GPS_BAUD!=9600
+  // The module comes up at 9600 after each power cut
+  char command[20];
+  sprintf(command, "PMTK251,%d", GPS_BAUD);
+  gpsCommand(command);
+  gpsSerial.flush();
+  GPS.begin(GPS_BAUD);
+#endif
+  gpsCapturing = true;
+
+  // Start hot: tell the module where it was and what time it is
+  char assist[80];
+  if (gpsAssistSentence(assist, sizeof(assist), gpsReader.assist(), gpsSecondsNow ? gpsSecondsNow() : 0)) {
+    gpsSerial.print(assist);
+  }
 
-  // uncomment this line to turn on RMC (recommended minimum) and GGA (fix data) including altitude
-  GPS.sendCommand(PMTK_SET_NMEA_OUTPUT_RMCGGA);
-  // uncomment this line to turn on only the "minimum recommended" data
-  //GPS.sendCommand(PMTK_SET_NMEA_OUTPUT_RMCONLY);
-  // For parsing data, we don't suggest using anything but either RMC only or RMC+GGA since
-  // the parser doesn't care about other sentences at this time
-
-  // Set the update rate
-  GPS.sendCommand(PMTK_SET_NMEA_UPDATE_1HZ);   // 1 Hz update rate
-  // For the parsing code to work nicely and have time to sort thru the data, and
-  // print it out we don't suggest using anything higher than 1 Hz
+#ifdef GPS_BINARY
+  gpsCommand(MTK_SET_BINARY);
+#endif
+  // Sentences and update rate follow the phase
+  gpsConfigured = true;
+  gpsApplyPhase();
 
   // Request updates on antenna status or explicitly not
   // GPS.sendCommand(PGCMD_ANTENNA);
@@ -97,137 +180,183 @@ static void gpsInit() {
   // Ask for firmware version
   GPS.sendCommand(PMTK_Q_RELEASE);
 
-  Log.Debug("gpsInit enable fix timer\n");
-  gpsFixHistoryReset();
+  gpsWatchFix();
+}
 
-  gpsFixTimer.enable(true);
+// Brings the GPS out of standby. It kept its configuration, so only the
+// phase may need updating.
+static void gpsWake() {
+  gpsCommand("PMTK000"); // Any byte wakes it; this is the test command
+  gpsStandby = false;
+  gpsCapturing = true;
+  gpsConfigured = true;
+  gpsApplyPhase();
+  gpsWatchFix();
 }
 
 void gpsEnable(bool enable) {
   Log.Debug("Setting GPS enable: %T\n", enable);
-  digitalWrite(GPS_ENABLE_PIN, !enable);
   if (enable) {
+    gpsTtff.start(millis());
+    gpsReader.motion().start(millis());
+    // Once per search, as reading the RTC costs I2C transactions
+    gpsSearchWindowMs = gpsSearchWindow(gpsReader.assist(), gpsSecondsNow ? gpsSecondsNow() : 0);
+    if (gpsStandby) {
+      gpsWake();
+      return;
+    }
+    gpsPower(true);
     gInitTimer.after(GPS_WAKE_UP_TIME, [](){
       gpsInit();
     });
   }
   else {
-    gpsFixHistoryReset();
-    gpsFixTimer.enable(false);
+    detachInterrupt(digitalPinToInterrupt(GPS_FIX_PIN));
+    gpsFixDetector.stop();
+    gpsReader.motion().stop(millis());
+    GpsAssist &assist = gpsReader.assist();
+    assist._parked = gpsReader.motion().parked(assist._parkedLatitude, assist._parkedLongitude);
+    if (!gpsTtff.stop()) {
+      assist.recordMiss();
+    }
+    gpsSearchGivenUp = false; // The search is over either way, so the next may run
+    if (gpsConfigured) {
+      // Nothing more is sent until gpsWake(), as any byte would wake it
+      gpsCommand("PMTK161,0");
+      gpsSerial.flush();
+      gpsStandby = true;
+      gpsStandbyMs = 0;
+    }
+    else {
+      gpsPower(false);
+      gpsAppliedPhase = GpsPhaseOff;
+    }
+    gpsCapturing = false;
+    gpsConfigured = false;
+  }
+}
+
+void gpsSleeping(uint32_t ms) {
+  if (!gpsStandby) {
+    return;
+  }
+  gpsStandbyMs += ms;
+  if (gpsStandbyMs > GPS_STANDBY_MAX_MS) {
+    Log.Debug("GPS standby over, powering down\n");
+    gpsPower(false);
+    gpsStandby = false;
+    gpsAppliedPhase = GpsPhaseOff;
+  }
+}
+
+bool gpsSearchOver() {
+  if (!gpsSearchGivenUp) {
+    const uint32_t searchedMs = gpsTtff.searchingMs(millis());
+    if (searchedMs>0 && searchedMs>=gpsSearchWindowMs) {
+      Log.Debug("GPS search given up after %d ms\n", searchedMs);
+      gpsSearchGivenUp = true;
+    }
+  }
+  return gpsSearchGivenUp;
+}
+
+bool gpsStationary() {
+  return gpsReader.motion().stationary(millis());
+}
+
+const GpsAssist &gpsAssist() {
+  return gpsReader.assist();
+}
+
+void gpsSetAssist(const GpsAssist &assist) {
+  gpsReader.assist() = assist;
+  if (assist._parked) {
+    gpsReader.motion().park(assist._parkedLatitude, assist._parkedLongitude);
   }
 }
 
-void gpsSetup()
+void gpsSetPhase(GpsPhase phase) {
+  gpsWantedPhase = phase;
+  gpsApplyPhase();
+}
+
+void gpsSetup(uint32_t (*secondsNow)(void))
 {
   Log.Debug("gpsSetup begin\n");
+  gpsSecondsNow = secondsNow;
 
   pinMode(GPS_FIX_PIN, INPUT);
   pinMode(GPS_ENABLE_PIN, OUTPUT);
   digitalWrite(GPS_ENABLE_PIN, LOW); // Disabled initially
 
-  Log.Debug("gpsSetup setup fix timer\n");
-  gpsFixTimer.configure(TC_CLOCK_PRESCALER_DIV1024, // prescaler: 48000(m0 clock freq) / 1024(prescaler) = 46.875kHz
-                TC_COUNTER_SIZE_16BIT,            // bit width of timer/counter (avoid 32 bit because that uses two timers!)
-                TC_WAVE_GENERATION_MATCH_FREQ     // match style
-                );
-
-  gpsFixTimer.setPeriodMatch(16406, 1, 0); // 350ms period = 2.857Hz = 46.875k / 16406, 1 match, 0 channel
-  gpsFixTimer.setCallback(true, TC_CALLBACK_CC_CHANNEL0, gpsFixISR);
-  gpsFixTimer.enable(false);
-
-  gpsFixHistoryReset();
-
   Log.Debug("gpsSetup done\n");
 }
 
 void gpsLoop(Print &printer)
 {
   gInitTimer.update();
+  gpsReader.loop(millis(), GPSECHO ? &printer : NULL);
+}
 
-  char c = GPS.read();
-  // if you want to debug, this is a good time to do it!
-  if (GPSECHO)
-    if (c) printer.print(c);
-
-  // if a sentence is received, we can check the checksum, parse it...
-  if (GPS.newNMEAreceived()) {
-    char *gpsInput = GPS.lastNMEA(); // Resets the newNMEAreceived() flag to false
-    // Log.Debug("GPS NMEA string: %s\n", gpsInput);
-    if (gReadSuccess && strstr(gpsInput, "$GPGGA")!=NULL && GPS.year!=0) {
-      // We are interested in a new location
-      if (GPS.parse(gpsInput)) {
-        GpsSample sample(GPS.latitudeDegrees, GPS.longitudeDegrees, GPS.altitude, GPS.HDOP, 2000 + GPS.year, GPS.month, GPS.day, GPS.hour, GPS.minute, GPS.seconds, GPS.milliseconds);
-        gReadSuccess(sample);
-      }
-      else if (gReadFailure) {
-        gReadFailure();
-      }
-      gReadSuccess = NULL;
-      gReadFailure = NULL;
-    }
-    else {
-      if (!GPS.parse(gpsInput)) {
-        Log.Warn("Failed to parse GPS string \"%s\"\n", gpsInput);
-      }
-    }
-  }
+void gpsStats(GpsStats &stats) {
+  stats.received = gpsRing.received();
+  stats.dropped = gpsRing.dropped();
+  stats.highWater = gpsRing.highWater();
+  stats.capacity = gpsRing.capacity();
+  stats.sentences = gpsReader.parser().sentences();
+  stats.invalidSentences = gpsReader.parser().invalid();
+}
+
+void gpsRead(GpsReadSuccessFn success, GpsReadFailureFn failure, void *context) {
+  gpsReader.read(success, failure, context, millis());
 }
 
-void gpsRead(std::function< void(const GpsSample &gpsSample) > success, std::function< void() > failure) {
-  gReadSuccess = success;
-  gReadFailure = failure;
-  GPS.lastNMEA(); // Reset last reading
+// Prints degrees * 1e7 without going through float.
+static void printDegrees(Print &printer, int32_t degrees) {
+  char text[16];
+  formatFixedPoint(text, degrees, 7);
+  printer.print(text);
 }
 
 void gpsDump(Print &printer) {
-  printer.print(F("Date: 20"));
-  printer.print(GPS.year, DEC); printer.print('-');
-  printer.print(GPS.month, DEC); printer.print('-');
-  printer.println(GPS.day, DEC);
-
-  printer.print("Time: ");
-  printer.print(GPS.hour, DEC); printer.print(':');
-  printer.print(GPS.minute, DEC); printer.print(':');
-  printer.print(GPS.seconds, DEC); printer.print('.');
-  printer.println(GPS.milliseconds);
-
-  printer.print("Fix: "); printer.print((int)GPS.fix);
-  printer.print(" quality: "); printer.println((int)GPS.fixquality);
-  if (GPS.fix) {
-    printer.print("Location: (dddmm.ss)");
-    printer.print(GPS.latitude, 4); printer.print(GPS.lat);
-    printer.print(", ");
-    printer.print(GPS.longitude, 4); printer.println(GPS.lon);
+  const NmeaFix &fix = gpsReader.parser().fix();
+  char line[48];
+  sprintf(line, "Date: %04d-%02d-%02d", fix._year, fix._month, fix._day);
+  printer.println(line);
+  sprintf(line, "Time: %02d:%02d:%02d.%03d", fix._hour, fix._minute, fix._seconds, fix._millis);
+  printer.println(line);
+
+  printer.print("Fix: "); printer.print((int)fix._valid);
+  printer.print(" quality: "); printer.println((int)fix._quality);
+  if (fix._quality) {
     printer.print("Location (degrees): ");
-    printer.print(GPS.latitudeDegrees, 4);
+    printDegrees(printer, fix._latitude);
     printer.print(", ");
-    printer.println(GPS.longitudeDegrees, 4);
+    printDegrees(printer, fix._longitude);
+    printer.println();
 
-    printer.print("Speed (knots): "); printer.println(GPS.speed);
-    printer.print("Angle: "); printer.println(GPS.angle);
-    printer.print("Altitude: "); printer.println(GPS.altitude);
-    printer.print("Satellites: "); printer.println((int)GPS.satellites);
+    printer.print("Speed (knots/100): "); printer.println(fix._speed);
+    printer.print("Angle (degrees/100): "); printer.println(fix._course);
+    printer.print("Altitude (cm): "); printer.println(fix._altitude);
+    printer.print("Satellites: "); printer.println((int)fix._satellites);
   }
-}
-
-uint8_t GpsSample::writePacket(uint8_t *packet, uint8_t packetSize) const {
-  int32_t lat = _latitude * 93206;  // Expand +/-90 coordinate to fill 24bits
-  uint32_t ulat = lat < 0 ? (UINT32_MAX-(uint32_t)(-lat)+1) : (uint32_t)(lat);
-  ulat = htonl(ulat);
-  int32_t lon = _longitude * 46603;  // Expand +/-180 coordinate to fill 24bits
-  uint32_t ulon = lon < 0 ? (UINT32_MAX-(uint32_t)(-lon)+1) : (uint32_t)(lon);
-  ulon = htonl(ulon);
-  int16_t alt = _altitude;
-  alt = htons(alt);
-  int16_t hdop = _HDOP * 1000;
-  hdop = htons(hdop);
-
-  memcpy(packet + 0, ((uint8_t *)&ulat)+1, 3); // bottom 24 bits
-  memcpy(packet + 3, ((uint8_t *)&ulon)+1, 3); // bottom 24 bits
-  memcpy(packet + 6,  &alt, 2);
-  memcpy(packet + 8, &hdop, 2);
 
-  return 10;
+  GpsStats stats;
+  gpsStats(stats);
+  printer.print("Bytes: "); printer.print(stats.received);
+  printer.print(" dropped: "); printer.print(stats.dropped);
+  printer.print(" high water: "); printer.print(stats.highWater);
+  printer.print('/'); printer.println(stats.capacity);
+  printer.print("Sentences: "); printer.print(stats.sentences);
+  printer.print(" invalid: "); printer.println(stats.invalidSentences);
+  const GpsAssist &assist = gpsReader.assist();
+  printer.print("TTFF (ms): "); printer.print(assist._lastTtffMs);
+  printer.print(" mean: "); printer.print(assist._meanTtffMs);
+  printer.print(" fixes: "); printer.print(assist._fixes);
+  printer.print(" misses: "); printer.print(assist._misses);
+  printer.print(" window (ms): "); printer.println(gpsSearchWindow(assist, gpsSecondsNow ? gpsSecondsNow() : 0));
+  printer.print("Standby: "); printer.print((int)gpsStandby);
+  printer.print(" stationary: "); printer.println((int)gpsStationary());
 }
 
 #endif
\ No newline at end of file
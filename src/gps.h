@@ -1,12 +1,46 @@
 #include <Arduino.h>
 #include "mm_state.h"
-#include <functional>
+#include "gps_phase.h"
+#include "gps_reader.h"
 
 class Adafruit_GPS;
 
-void gpsSetup();
+// secondsNow gives UTC seconds from the RTC, 0 if it isn't set, for assist data.
+void gpsSetup(uint32_t (*secondsNow)(void));
+// Moves bytes waiting in Serial1 into the capture ring. Cheap; call on every
+// loop(), radio busy or not.
+void gpsCapture();
 void gpsLoop(Print &printer);
 bool gpsHasFix();
+// Off puts the GPS in standby, from which on wakes it with a hot start.
 void gpsEnable(bool enable);
+// Called before the MCU stands by for ms. Powers the GPS down once it has been
+// in standby too long.
+void gpsSleeping(uint32_t ms);
+// Whether the GPS has been searching for a fix longer than its TTFF history
+// says is worthwhile (see gpsSearchWindow()). Stays set until the GPS is turned off.
+bool gpsSearchOver();
+// Whether the GPS shows the device parked (see gps_motion.h). Kept while it's
+// off and, through gpsAssist(), across resets.
+bool gpsStationary();
+// Last position and TTFF history, to be kept across resets.
+const GpsAssist &gpsAssist();
+void gpsSetAssist(const GpsAssist &assist);
 void gpsDump(Print &printer);
-void gpsRead(std::function< void(const GpsSample &gpsSample) > success,  std::function< void(void) >failure);
+// Reconfigures GPS output when phase changes. Cheap when it hasn't.
+void gpsSetPhase(GpsPhase phase);
+// success or failure is called from gpsLoop with context (see GpsReader::read).
+void gpsRead(GpsReadSuccessFn success, GpsReadFailureFn failure, void *context);
+
+// Counters for GPS byte capture. Any dropped bytes or invalid sentences mean
+// NMEA was lost between the GPS and the parser.
+typedef struct GpsStats {
+  uint32_t received;      // Bytes read from Serial1 by gpsCapture()
+  uint32_t dropped;       // Bytes lost because the ring was full
+  uint16_t highWater;     // Most bytes ever waiting in the ring
+  uint16_t capacity;
+  uint32_t sentences;     // Sentences with a good checksum
+  uint32_t invalidSentences; // Sentences with a bad or missing checksum, or cut short
+} GpsStats;
+
+void gpsStats(GpsStats &stats);
@@ -0,0 +1,74 @@
+#include "gps_assist.h"
+
+void GpsAssist::setPosition(const NmeaFix &fix) {
+  if (fix._quality==0) {
+    return;
+  }
+  _hasPosition = true;
+  _latitude = fix._latitude;
+  _longitude = fix._longitude;
+  _altitude = fix._altitude;
+}
+
+void GpsAssist::recordFix(uint32_t ttffMs, uint32_t unixSeconds) {
+  _lastTtffMs = ttffMs;
+  _meanTtffMs = _fixes==0 ? ttffMs : (_meanTtffMs * 3 + ttffMs) / 4;
+  _missPercent = _missPercent * 3 / 4;
+  _fixSeconds = unixSeconds;
+  if (_fixes<UINT16_MAX) {
+    ++_fixes;
+  }
+}
+
+void GpsAssist::recordMiss() {
+  _lastTtffMs = 0;
+  _missPercent = (_missPercent * 3 + 100) / 4;
+  if (_misses<UINT16_MAX) {
+    ++_misses;
+  }
+}
+
+uint32_t gpsSearchWindow(const GpsAssist &assist, uint32_t unixSeconds, const GpsSearchLimits &limits) {
+  if (assist._fixes==0 || assist._fixSeconds==0 || unixSeconds<assist._fixSeconds
+      || unixSeconds - assist._fixSeconds > kGpsEphemerisSeconds) {
+    return limits.maxMs;
+  }
+  // Room for a slow start among fast ones, and more where starts often fail
+  uint32_t window = assist._meanTtffMs < limits.maxMs / 3 ? assist._meanTtffMs * 3 : limits.maxMs;
+  window += (limits.maxMs - window) * assist._missPercent / 100;
+  return window<limits.minMs ? limits.minMs : window;
+}
+
+size_t gpsAssistSentence(char *buffer, size_t size, const GpsAssist &assist, uint32_t unixSeconds) {
+  if (unixSeconds==0) {
+    return 0; // Without the time a position doesn't say which satellites are up
+  }
+  // Civil date from days since 1970 (Howard Hinnant's days_from_civil, inverted)
+  const uint32_t days = unixSeconds / 86400;
+  const uint32_t seconds = unixSeconds % 86400;
+  const uint32_t z = days + 719468;
+  const uint32_t era = z / 146097;
+  const uint32_t doe = z - era * 146097;
+  const uint32_t yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+  const uint32_t doy = doe - (365*yoe + yoe/4 - yoe/100);
+  const uint32_t mp = (5*doy + 2) / 153;
+  const uint32_t day = doy - (153*mp + 2)/5 + 1;
+  const uint32_t month = mp<10 ? mp + 3 : mp - 9;
+  const uint32_t year = yoe + era * 400 + (month<=2 ? 1 : 0);
+
+  char time[24];
+  snprintf(time, sizeof(time), "%04lu,%02lu,%02lu,%02lu,%02lu,%02lu", (unsigned long)year, (unsigned long)month, (unsigned long)day,
+    (unsigned long)(seconds / 3600), (unsigned long)(seconds / 60 % 60), (unsigned long)(seconds % 60));
+
+  char body[80];
+  if (assist._hasPosition) {
+    char latitude[16], longitude[16];
+    formatFixedPoint(latitude, assist._latitude / 10, 6);   // ~0.1m
+    formatFixedPoint(longitude, assist._longitude / 10, 6);
+    snprintf(body, sizeof(body), "PMTK741,%s,%s,%ld,%s", latitude, longitude, (long)(assist._altitude / 100), time);
+  }
+  else {
+    snprintf(body, sizeof(body), "PMTK740,%s", time);
+  }
+  return nmeaSentence(buffer, size, body);
+}
@@ -0,0 +1,127 @@
+/*
+  GpsAssist - What the GPS knew before it was powered down, so that the next
+  start can be a hot one.
+
+  An MTK module that loses power forgets where it is and what time it is, and
+  has to search for every satellite. Given its last position and the time
+  (PMTK741), it only looks for the satellites that should be overhead. The
+  data is kept in the parameter store as GPSASST and restored in setup(); bump
+  kGpsAssistVersion whenever the layout changes.
+
+  It also keeps the time to first fix of recent power cycles, which is most of
+  the GPS energy spent on each mapped point, and how often cycles end without
+  a fix. gpsSearchWindow() sizes low power searches from them.
+
+  And whether the device was parked when the GPS went off (see gps_motion.h),
+  so that a reset doesn't make it prove it again.
+ */
+
+#ifndef GPS_ASSIST_H
+#define GPS_ASSIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "nmea.h"
+
+static const uint8_t kGpsAssistVersion = 3;
+
+// Bounds on a low power search for a fix (ModeLowPowerGpsSearch). Searches
+// run for the maximum until there is TTFF history to go on, so the maximum
+// allows for slow fixes in urban canyons.
+#ifndef GPS_SEARCH_MIN_MS
+#define GPS_SEARCH_MIN_MS (60 * 1000UL)
+#endif
+#ifndef GPS_SEARCH_MAX_MS
+#define GPS_SEARCH_MAX_MS (10 * 60 * 1000UL)
+#endif
+
+// Beyond this since the last fix the GPS's ephemeris has expired, so it starts
+// warm or cold however quickly recent hot starts went.
+static const uint32_t kGpsEphemerisSeconds = 4 * 3600;
+
+typedef struct GpsAssist {
+  uint8_t _version = kGpsAssistVersion;
+  uint8_t _size = sizeof(GpsAssist);
+  bool _hasPosition = false;
+  int32_t _latitude = 0;      // Degrees * 1e7
+  int32_t _longitude = 0;     // Degrees * 1e7
+  int32_t _altitude = 0;      // Centimeters
+  // Time to first fix
+  uint32_t _lastTtffMs = 0;   // Of the last power cycle, 0 if it got no fix
+  uint32_t _meanTtffMs = 0;   // Running mean over cycles with a fix, the latest weighted 1/4
+  uint16_t _fixes = 0;        // Power cycles that got a fix
+  uint16_t _misses = 0;       // Power cycles that ended without one
+  uint8_t _missPercent = 0;   // Running share of cycles without a fix, the latest weighted 1/4
+  uint32_t _fixSeconds = 0;   // UTC of the last first fix, 0 if unknown
+  // Motion
+  bool _parked = false;       // Stationary when the GPS was last turned off
+  int32_t _parkedLatitude = 0;  // Where it settled, degrees * 1e7
+  int32_t _parkedLongitude = 0;
+
+  // Whether this was restored intact from a store written by this layout.
+  bool valid() const {
+    return _version==kGpsAssistVersion && _size==sizeof(GpsAssist);
+  }
+
+  // Remembers the position of a fix, if it has one.
+  void setPosition(const NmeaFix &fix);
+
+  // unixSeconds is UTC from the RTC, 0 if unknown.
+  void recordFix(uint32_t ttffMs, uint32_t unixSeconds);
+  void recordMiss();
+} GpsAssist;
+
+typedef struct GpsSearchLimits {
+  uint32_t minMs = GPS_SEARCH_MIN_MS;
+  uint32_t maxMs = GPS_SEARCH_MAX_MS;
+} GpsSearchLimits;
+
+// How long a low power search for a fix should last, within limits: three
+// times the mean TTFF, stretched toward the maximum as the share of missed
+// cycles grows. The maximum if there is no recent fix to go on. unixSeconds
+// is UTC from the RTC, 0 if unknown.
+uint32_t gpsSearchWindow(const GpsAssist &assist, uint32_t unixSeconds, const GpsSearchLimits &limits = GpsSearchLimits());
+
+// Formats the assist sentence for the GPS to start with: PMTK741 with the
+// position and time, or PMTK740 with just the time if no position is known.
+// unixSeconds is UTC from the RTC, 0 if unknown. Returns the length, or 0 if
+// there is nothing to send or it doesn't fit in size.
+size_t gpsAssistSentence(char *buffer, size_t size, const GpsAssist &assist, uint32_t unixSeconds);
+
+// Times one power cycle from power up (or wake from standby) to first fix.
+class GpsTtff {
+  uint32_t _startMillis = 0;
+  bool _running = false;
+  bool _fixed = false;
+
+  public:
+  void start(uint32_t now) {
+    _startMillis = now;
+    _running = true;
+    _fixed = false;
+  }
+
+  // Call on each fix. True only for the first fix of the cycle, with its time.
+  bool fix(uint32_t now, uint32_t &ttffMs) {
+    if (!_running || _fixed) {
+      return false;
+    }
+    _fixed = true;
+    ttffMs = now - _startMillis;
+    return true;
+  }
+
+  // How long it has been searching: since start without a fix, else 0.
+  uint32_t searchingMs(uint32_t now) const {
+    return _running && !_fixed ? now - _startMillis : 0;
+  }
+
+  // Ends the cycle. False if it was running and never got a fix.
+  bool stop() {
+    const bool missed = _running && !_fixed;
+    _running = false;
+    return !missed;
+  }
+};
+
+#endif
@@ -0,0 +1,76 @@
+/*
+  GpsFixDetector - Tells fix from no fix by timing the MTK FIX pin's edges.
+
+  No fix: ____----____----____----   1s low, 1s high
+  Fix:    ______________-_________   15s low, 200ms high
+
+  Each edge classifies the phase it ends: a high pulse longer than
+  kMaxFixPulse, or a low gap shorter than kMaxNoFixGap, means no fix. Between
+  edges, fix() also times the current phase, so a pulse that stays high too
+  long reports the loss of fix before it ends (0.5s instead of up to 1.75s
+  with polling), and a gap that stays low reports a fix without waiting for
+  the next 200ms pulse.
+
+  edge() is meant to be called from the pin's interrupt, so nothing runs
+  while the pin is quiet.
+ */
+
+#ifndef GPS_FIX_H
+#define GPS_FIX_H
+
+#include <stdint.h>
+
+class GpsFixDetector {
+  public:
+  enum {
+    kMaxFixPulse = 500,     // Fix pulses are 200ms, no-fix pulses 1s
+    kMaxNoFixGap = 1500,    // No-fix gaps are 1s, fix gaps ~15s
+  };
+
+  private:
+  volatile uint32_t _edgeMillis = 0;
+  volatile bool _level = false;
+  volatile bool _fix = false;
+  volatile bool _running = false;
+
+  public:
+  // Starts watching, with the pin at level and no fix.
+  void start(bool level, uint32_t now) {
+    _level = level;
+    _edgeMillis = now;
+    _fix = false;
+    _running = true;
+  }
+
+  // Stops watching, e.g. when the GPS is powered off. There is no fix until start().
+  void stop() {
+    _running = false;
+  }
+
+  // The pin changed to level at now.
+  void edge(bool level, uint32_t now) {
+    if (!_running || level==_level) {
+      return; // Bounce, or an edge we already saw
+    }
+    const uint32_t duration = now - _edgeMillis;
+    _fix = _level ? duration <= kMaxFixPulse : duration > kMaxNoFixGap;
+    _level = level;
+    _edgeMillis = now;
+  }
+
+  bool fix(uint32_t now) const {
+    if (!_running) {
+      return false;
+    }
+    const uint32_t duration = now - _edgeMillis;
+    if (_level && duration > kMaxFixPulse) {
+      return false;
+    }
+    if (!_level && duration > kMaxNoFixGap) {
+      return true;
+    }
+    return _fix;
+  }
+};
+
+#endif
@@ -0,0 +1,38 @@
+#include "gps_motion.h"
+
+// cos(latitude) * 32768 by Bhaskara's approximation, within 0.002, with
+// latitude in degrees * 1e7. Taken at hundredths of a degree, 180 of which
+// square to just under 2^32.
+static uint16_t cosQ15(int32_t latitude) {
+  const uint32_t centi = (latitude < 0 ? -(int64_t)latitude : latitude) / 100000;
+  const uint32_t halfTurn2 = 18000UL * 18000UL;
+  const uint32_t centi2 = centi * centi;
+  if (4 * centi2 >= halfTurn2) {
+    return 0; // A pole
+  }
+  return ((uint64_t)(halfTurn2 - 4 * centi2) << 15) / (halfTurn2 + centi2);
+}
+
+void MotionEstimator::anchor(int32_t latitude, int32_t longitude) {
+  _hasAnchor = true;
+  _anchorLatitude = latitude;
+  _anchorLongitude = longitude;
+  _anchorCos = cosQ15(latitude);
+}
+
+void MotionEstimator::position(int32_t latitude, int32_t longitude, uint32_t now) {
+  if (_hasAnchor) {
+    // Equirectangular distance, plenty for tens of metres, in 1e-7 degrees
+    // of latitude (~1.1cm)
+    const uint32_t radius = (uint32_t)_config.radiusMeters * 8983 / 100;
+    const int64_t north = (int64_t)latitude - _anchorLatitude;
+    const int64_t east = (((int64_t)longitude - _anchorLongitude) * _anchorCos) >> 15;
+    if (north >= -(int64_t)radius && north <= radius && east >= -(int64_t)radius && east <= radius
+        && (uint64_t)(north * north + east * east) <= (uint64_t)radius * radius) {
+      return;
+    }
+    moved(now);
+  }
+  // Movement is measured from here on
+  anchor(latitude, longitude);
+}
@@ -0,0 +1,97 @@
+/*
+  MotionEstimator - Tells a parked device from a moving one using what the
+  GPS reports.
+
+  Either sign of movement restarts the clock: an RMC speed at or above
+  movingSpeed, or a fix more than radiusMeters from where the device was last
+  seen to settle. Once neither has happened for stillMs, the device is
+  stationary. GPS jitter while parked is a few knots/100 and a few metres,
+  well inside both thresholds.
+
+  Until it has seen a stillMs without movement, the device counts as moving,
+  so tracking starts out continuous after a power up. The exception is a
+  device that was stationary when the GPS was turned off: it stays parked
+  while off and after the next power up, until speed or a fix away from where
+  it settled shows otherwise. Battery windows are shorter than stillMs, so
+  without this a parked device on battery would never be seen as parked.
+ */
+
+#ifndef GPS_MOTION_H
+#define GPS_MOTION_H
+
+#include <stdint.h>
+
+typedef struct MotionConfig {
+  uint16_t movingSpeed = 150;       // Knots * 100, ~2.8km/h
+  uint16_t radiusMeters = 50;
+  uint32_t stillMs = 5 * 60 * 1000UL;
+} MotionConfig;
+
+class MotionEstimator {
+  MotionConfig _config;
+  uint32_t _movedMillis = 0;        // Last movement, or start
+  bool _hasAnchor = false;
+  int32_t _anchorLatitude = 0;      // Degrees * 1e7
+  int32_t _anchorLongitude = 0;
+  uint16_t _anchorCos = 0;          // cos(_anchorLatitude) * 32768, to scale longitude to distance
+  bool _running = false;
+  bool _parked = false;             // Stationary when last stopped
+
+  void moved(uint32_t now) {
+    _movedMillis = now;
+    _hasAnchor = false;
+  }
+
+  void anchor(int32_t latitude, int32_t longitude);
+
+  public:
+  MotionEstimator(const MotionConfig &config = MotionConfig())
+  : _config(config)
+  {}
+
+  // Starts over when the GPS is powered up: still parked if it was when
+  // stopped, otherwise assuming movement.
+  void start(uint32_t now) {
+    if (_parked) {
+      _movedMillis = now - _config.stillMs;
+    }
+    else {
+      moved(now);
+    }
+    _running = true;
+  }
+
+  void stop(uint32_t now) {
+    _parked = stationary(now) && _hasAnchor; // Without a fix it isn't known where
+    _running = false;
+  }
+
+  // Parked where the device settled, e.g. restored after a reset.
+  void park(int32_t latitude, int32_t longitude) {
+    anchor(latitude, longitude);
+    _parked = true;
+  }
+
+  // Whether it was parked when stopped, and where, to be kept across resets.
+  bool parked(int32_t &latitude, int32_t &longitude) const {
+    latitude = _anchorLatitude;
+    longitude = _anchorLongitude;
+    return _parked;
+  }
+
+  // Speed over ground from a valid RMC.
+  void speed(uint16_t knots100, uint32_t now) {
+    if (knots100 >= _config.movingSpeed) {
+      moved(now);
+    }
+  }
+
+  // Position of a fix.
+  void position(int32_t latitude, int32_t longitude, uint32_t now);
+
+  bool stationary(uint32_t now) const {
+    return _running ? now - _movedMillis >= _config.stillMs : _parked;
+  }
+};
+
+#endif
@@ -0,0 +1,55 @@
+#include "gps_phase.h"
+#include "nmea.h"
+
+// Indexed by GpsPhase. At 9600 baud RMC+GGA takes ~150 of the 960 bytes/s
+// available, so 5Hz is the fastest rate that still fits.
+static const GpsOutput kOutputs[] = {
+  {1000, 0, 0, 0, 0},         // Off
+  {1000, 5, 0, 0, 0},         // Idle: ~14 bytes/s
+  {1000, 5, 1, 0, 0},         // Read: a GGA every second
+  {200, 1, 1, 0, 0},          // Track: RMC+GGA at 5Hz, ~730 bytes/s
+  {1000, 1, 1, 6000, 54000},  // Park: RMC+GGA for 6s of every minute
+};
+
+GpsPhase gpsPhase(const AppState &state) {
+  if (!state.getGpsPower()) {
+    return GpsPhaseOff;
+  }
+  const bool parked = state.hasGpsFix() && state.isStationary();
+  if (state.getUsbPower() && ModeLogGps.isActive(state) && !parked) {
+    return GpsPhaseTrack;
+  }
+  if (ModeReadGps.isActive(state)) {
+    return GpsPhaseRead;
+  }
+  return parked ? GpsPhasePark : GpsPhaseIdle;
+}
+
+const GpsOutput &gpsOutput(GpsPhase phase) {
+  return kOutputs[phase];
+}
+
+size_t gpsOutputSentence(char *buffer, size_t size, const GpsOutput &output) {
+  // GLL, RMC, VTG, GGA, GSA, GSV, then reserved fields and MCHN
+  char body[64];
+  snprintf(body, sizeof(body), "PMTK314,0,%u,0,%u,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0", output.rmcEvery, output.ggaEvery);
+  return nmeaSentence(buffer, size, body);
+}
+
+size_t gpsRateSentence(char *buffer, size_t size, const GpsOutput &output) {
+  char body[16];
+  snprintf(body, sizeof(body), "PMTK220,%u", output.fixIntervalMs);
+  return nmeaSentence(buffer, size, body);
+}
+
+size_t gpsPeriodicSentence(char *buffer, size_t size, const GpsOutput &output) {
+  if (output.sleepMs==0) {
+    return nmeaSentence(buffer, size, "PMTK225,0");
+  }
+  // Type 2 is periodic standby, which any byte from us ends. Without a fix
+  // it stays awake three times longer.
+  char body[48];
+  snprintf(body, sizeof(body), "PMTK225,2,%lu,%lu,%lu,%lu", (unsigned long)output.runMs, (unsigned long)output.sleepMs,
+    (unsigned long)(output.runMs * 3), (unsigned long)output.sleepMs);
+  return nmeaSentence(buffer, size, body);
+}
@@ -0,0 +1,47 @@
+/*
+  GpsPhase - What the GPS is needed for right now, and the NMEA output that
+  serves it.
+
+  The phase is a pure function of AppState, so it can be checked natively;
+  gps.cpp reconfigures the module whenever it changes. Every phase outputs an
+  occasional RMC, so the date is known by the time a GGA is wanted; fix
+  detection itself uses the FIX pin and needs no sentences at all.
+
+  While the device is parked with a fix, the GPS runs in periodic standby
+  (PMTK225): it wakes for a few seconds each minute, long enough for a hot
+  fix that would show movement, and stands by the rest of the time.
+ */
+
+#ifndef GPS_PHASE_H
+#define GPS_PHASE_H
+
+#include "mm_state.h"
+
+enum GpsPhase : uint8_t {
+  GpsPhaseOff,        // GPS unpowered
+  GpsPhaseIdle,       // Powered, searching for a fix or waiting to be read
+  GpsPhaseRead,       // ModeReadGps waiting for a GGA
+  GpsPhaseTrack,      // ModeLogGps on USB power
+  GpsPhasePark,       // Stationary with a fix and not being read
+};
+
+typedef struct GpsOutput {
+  uint16_t fixIntervalMs;   // PMTK220
+  uint8_t rmcEvery;         // PMTK314: an RMC every this many fixes, 0 for none
+  uint8_t ggaEvery;         // Likewise for GGA
+  uint32_t runMs;           // PMTK225 periodic standby: awake this long...
+  uint32_t sleepMs;         // ...then in standby this long; 0 for continuous
+} GpsOutput;
+
+GpsPhase gpsPhase(const AppState &state);
+
+const GpsOutput &gpsOutput(GpsPhase phase);
+
+// PMTK314 and PMTK220 sentences, with checksums, configuring output. Each
+// returns the length, or 0 if it doesn't fit in size.
+size_t gpsOutputSentence(char *buffer, size_t size, const GpsOutput &output);
+size_t gpsRateSentence(char *buffer, size_t size, const GpsOutput &output);
+// PMTK225 entering periodic standby, or returning to continuous operation.
+size_t gpsPeriodicSentence(char *buffer, size_t size, const GpsOutput &output);
+
+#endif
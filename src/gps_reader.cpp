@@ -0,0 +1,80 @@
+#include <Logging.h>
+#include "gps_reader.h"
+
+void GpsReader::answer() {
+  // We are interested in a new location. None comes if every fix in the
+  // window lacked a position or was too poor.
+  const GpsReadSuccessFn success = _success;
+  const GpsReadFailureFn failure = _failure;
+  void *context = _context;
+  _success = NULL;
+  _failure = NULL;
+  _context = NULL;
+
+  NmeaFix fix;
+  if (_sampler.finish(fix)) {
+    Log.Debug("GPS sampled %d fixes, rejected %d\n", _sampler.accepted(), _sampler.rejected());
+    success(toGpsSample(fix), context);
+  }
+  else if (failure) {
+    failure(context);
+  }
+}
+
+void GpsReader::loop(uint32_t now, Print *echo) {
+  // Drain everything captured since the last call straight into the parser.
+  uint8_t chunk[kChunk];
+  uint16_t n;
+  while ((n = _source.read(chunk, sizeof(chunk)))>0) {
+    for (uint16_t i = 0; i<n; ++i) {
+      const char c = chunk[i];
+      ++_bytesParsed;
+      if (echo!=NULL) {
+        echo->print(c);
+      }
+
+      switch (_parser.feed(c)) {
+        case NmeaGga: {
+          const NmeaFix &fix = _parser.fix();
+          _assist.setPosition(fix);
+          if (fix._quality!=0) {
+            _motion.position(fix._latitude, fix._longitude, now);
+#ifdef GPS_BINARY
+            _motion.speed(fix._speed, now); // Binary packets carry speed too
+#endif
+          }
+          // Dates come from RMC, so wait for one before sampling
+          if (_sampler.active() && _bytesParsed > _readAfter && fix._year!=0) {
+            _sampler.add(fix);
+          }
+          break;
+        }
+        case NmeaRmc:
+          if (_parser.fix()._valid) {
+            _motion.speed(_parser.fix()._speed, now);
+          }
+          break;
+        case NmeaInvalid:
+          // Counted by the parser and reported with gpsStats(); a noisy line
+          // would flood a warning.
+          Log.Debug("Invalid GPS sentence (%u so far)\n", _parser.invalid());
+          break;
+        default:
+          break;
+      }
+    }
+  }
+
+  if (_sampler.done(now)) {
+    answer();
+  }
+}
+
+void GpsReader::read(GpsReadSuccessFn success, GpsReadFailureFn failure, void *context, uint32_t now) {
+  _success = success;
+  _failure = failure;
+  _context = context;
+  // Skip sentences already captured; only those that arrive after this call answer it
+  _readAfter = _bytesParsed + _source.available();
+  _sampler.start(now);
+}
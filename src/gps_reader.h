@@ -0,0 +1,97 @@
+/*
+  GpsReader - The GPS read path, from captured bytes to a GpsSample.
+
+  Bytes come from a GpsByteSource: on the device the ring gps.cpp fills from
+  Serial1 on every loop(), natively an NMEA file replayed at its recorded pace
+  (src_native/nmea_replay.h). Each loop() parses what has arrived, feeds the
+  motion estimator and assist data, and offers fixes that arrived after a
+  read() to its sampler; when the sampler is done the read is answered.
+
+  Nothing here touches hardware or ::millis(), so the same code runs in
+  native tests and tools with time supplied by the caller.
+ */
+
+#ifndef GPS_READER_H
+#define GPS_READER_H
+
+#include <stdint.h>
+#include "mm_state.h"
+#include "nmea.h"
+#include "mtk_binary.h"
+#include "gps_sampler.h"
+#include "gps_motion.h"
+#include "gps_assist.h"
+
+#ifdef GPS_BINARY
+typedef MtkBinaryParser GpsParser;
+#else
+typedef NmeaParser GpsParser;
+#endif
+
+// Called from loop() with the context passed to read(). Plain function pointers
+// rather than std::function so a read never touches the heap.
+typedef void (*GpsReadSuccessFn)(const GpsSample &gpsSample, void *context);
+typedef void (*GpsReadFailureFn)(void *context);
+
+class GpsByteSource {
+  public:
+  // Moves up to size bytes that have arrived into buffer. Returns the count.
+  virtual uint16_t read(uint8_t *buffer, uint16_t size) = 0;
+  // Bytes that have arrived and not yet been read.
+  virtual uint32_t available() const = 0;
+};
+
+class GpsReader {
+  enum {
+    kChunk = 64,              // Bytes taken from the source at a time
+  };
+
+  GpsByteSource &_source;
+  GpsParser _parser;
+  GpsSampler _sampler;
+  MotionEstimator _motion;
+  GpsAssist _assist;
+  uint32_t _bytesParsed = 0;
+  uint32_t _readAfter = 0;    // Only sentences ending after this many parsed bytes answer a read
+  GpsReadSuccessFn _success = NULL;
+  GpsReadFailureFn _failure = NULL;
+  void *_context = NULL;
+
+  void answer();
+
+  public:
+  GpsReader(GpsByteSource &source, const GpsSamplerConfig &config = GpsSamplerConfig())
+  : _source(source),
+    _sampler(config)
+  {}
+
+  // Parses everything that has arrived, echoing it if echo isn't NULL, and
+  // answers a pending read once its sampling is done.
+  void loop(uint32_t now, Print *echo = NULL);
+
+  // Samples fixes that arrive from now on; success or failure is called from
+  // a later loop().
+  void read(GpsReadSuccessFn success, GpsReadFailureFn failure, void *context, uint32_t now);
+
+  bool reading() const {
+    return _success!=NULL;
+  }
+
+  const GpsParser &parser() const {
+    return _parser;
+  }
+
+  uint32_t bytesParsed() const {
+    return _bytesParsed;
+  }
+
+  MotionEstimator &motion() {
+    return _motion;
+  }
+
+  GpsAssist &assist() {
+    return _assist;
+  }
+};
+
+#endif
@@ -0,0 +1,75 @@
+#include "gps_sampler.h"
+
+GpsSampler::GpsSampler(const GpsSamplerConfig &config)
+: _config(config) {
+  if (_config.count<1) {
+    _config.count = 1;
+  }
+  if (_config.count>kMaxFixes) {
+    _config.count = kMaxFixes;
+  }
+}
+
+void GpsSampler::start(uint32_t now) {
+  _count = 0;
+  _rejected = 0;
+  _startMillis = now;
+  _active = true;
+}
+
+void GpsSampler::add(const NmeaFix &fix) {
+  if (!_active || _count>=_config.count) {
+    return;
+  }
+  if (fix._quality==0 || fix._HDOP > _config.maxHDOP || fix._satellites < _config.minSatellites) {
+    ++_rejected;
+    return;
+  }
+  _fixes[_count++] = fix;
+}
+
+bool GpsSampler::finish(NmeaFix &result) {
+  _active = false;
+  if (_count==0) {
+    return false;
+  }
+  uint8_t best = 0;
+  for (uint8_t i = 1; i<_count; ++i) {
+    // Latest of the lowest HDOP
+    if (_fixes[i]._HDOP <= _fixes[best]._HDOP) {
+      best = i;
+    }
+  }
+  if (_config.mode==GpsSamplerBest) {
+    result = _fixes[best];
+    return true;
+  }
+
+  // Average the fixes close in quality to the best. Positions in one window
+  // are metres apart, so plain means are fine (short of the antimeridian).
+  const uint32_t limit = (uint32_t)_fixes[best]._HDOP * 3 / 2;
+  int64_t latitude = 0, longitude = 0, altitude = 0;
+  uint32_t hdop = 0;
+  uint8_t satellites = UINT8_MAX, used = 0, last = best;
+  for (uint8_t i = 0; i<_count; ++i) {
+    const NmeaFix &fix = _fixes[i];
+    if (fix._HDOP > limit) {
+      ++_rejected;
+      continue;
+    }
+    latitude += fix._latitude;
+    longitude += fix._longitude;
+    altitude += fix._altitude;
+    hdop += fix._HDOP;
+    satellites = fix._satellites < satellites ? fix._satellites : satellites;
+    last = i;
+    ++used;
+  }
+  result = _fixes[last]; // Time and date of the newest fix used
+  result._latitude = latitude / used;
+  result._longitude = longitude / used;
+  result._altitude = altitude / used;
+  result._HDOP = hdop / used;
+  result._satellites = satellites;
+  return true;
+}
@@ -0,0 +1,72 @@
+/*
+  GpsSampler - Turns a burst of GPS fixes into one better position.
+
+  A read starts the sampler, then each fix is offered to it until it has
+  `count` acceptable fixes or `windowMs` has passed. Fixes without a position,
+  with HDOP above maxHDOP or with fewer than minSatellites are rejected, and
+  so are any with HDOP more than 1.5x the best one seen. What's left is
+  averaged, or the single best fix is taken.
+ */
+
+#ifndef GPS_SAMPLER_H
+#define GPS_SAMPLER_H
+
+#include "nmea.h"
+
+enum GpsSamplerMode : uint8_t {
+  GpsSamplerAverage,
+  GpsSamplerBest,
+};
+
+typedef struct GpsSamplerConfig {
+  uint8_t count = 5;            // Acceptable fixes wanted, at most GpsSampler::kMaxFixes
+  uint16_t windowMs = 10000;    // Longest to wait for them
+  uint16_t maxHDOP = 500;       // HDOP * 100
+  uint8_t minSatellites = 4;
+  GpsSamplerMode mode = GpsSamplerAverage;
+} GpsSamplerConfig;
+
+class GpsSampler {
+  public:
+  enum {
+    kMaxFixes = 8,
+  };
+
+  private:
+  GpsSamplerConfig _config;
+  NmeaFix _fixes[kMaxFixes];
+  uint8_t _count = 0;
+  uint8_t _rejected = 0;
+  uint32_t _startMillis = 0;
+  bool _active = false;
+
+  public:
+  GpsSampler(const GpsSamplerConfig &config);
+
+  void start(uint32_t now);
+
+  bool active() const {
+    return _active;
+  }
+
+  // Offers a fix; rejected ones are counted and dropped.
+  void add(const NmeaFix &fix);
+
+  // Whether sampling should finish: enough fixes, or the window is over.
+  bool done(uint32_t now) const {
+    return _active && (_count>=_config.count || now - _startMillis >= _config.windowMs);
+  }
+
+  // Ends sampling. Returns false if no fix was acceptable.
+  bool finish(NmeaFix &result);
+
+  uint8_t accepted() const {
+    return _count;
+  }
+
+  uint8_t rejected() const {
+    return _rejected;
+  }
+};
+
+#endif
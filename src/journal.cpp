@@ -0,0 +1,137 @@
+#include "journal.h"
+#include <Logging.h>
+#include <string.h>
+
+// Boolean input fields, kept in the low half of packed inputs under their own bits
+static const FieldMask kInputFlagFields = FieldUsbPower | FieldGpsFix | FieldStationary | FieldGpsSearchOver | kButtonFields;
+
+uint16_t journalPayloadSize(const JournalRecord &record) {
+  switch (record._kind) {
+    case JournalBoot:
+      return sizeof(AppStateSnapshot);
+    case JournalComplete:
+      return (record._value & FieldGpsSample) ? sizeof(GpsSample) : 0;
+    case JournalStoreLoad:
+      return record._value;
+    default:
+      return 0;
+  }
+}
+
+uint32_t packInputs(const AppState &state) {
+  uint32_t packed = 0;
+  if (state.getUsbPower()) packed |= FieldUsbPower;
+  if (state.hasGpsFix()) packed |= FieldGpsFix;
+  if (state.isStationary()) packed |= FieldStationary;
+  if (state.gpsSearchOver()) packed |= FieldGpsSearchOver;
+  if (state.buttonPage()) packed |= FieldButtonPage;
+  if (state.buttonField()) packed |= FieldButtonField;
+  if (state.buttonChange()) packed |= FieldButtonChange;
+  const uint32_t millivolts = (uint32_t)(state.batteryVolts() * 1000 + 0.5);
+  return packed | (millivolts << 16);
+}
+
+void applyInputs(AppState &state, FieldMask mask, uint32_t packed) {
+  AppState::Batch batch(state);
+  if (mask & FieldUsbPower) state.setUsbPower(packed & FieldUsbPower);
+  if (mask & FieldBatteryVolts) state.batteryVolts((packed >> 16) / 1000.0);
+  if (mask & FieldGpsFix) state.setGpsFix(packed & FieldGpsFix);
+  if (mask & FieldStationary) state.setStationary(packed & FieldStationary);
+  if (mask & FieldGpsSearchOver) state.setGpsSearchOver(packed & FieldGpsSearchOver);
+  if (mask & FieldButtonPage) state.buttonPage(packed & FieldButtonPage);
+  if (mask & FieldButtonField) state.buttonField(packed & FieldButtonField);
+  if (mask & FieldButtonChange) state.buttonChange(packed & FieldButtonChange);
+}
+
+void Journal::append(const void *bytes, uint16_t size) {
+  memcpy(_buffer + _used, bytes, size);
+  _used += size;
+}
+
+void Journal::record(uint8_t kind, uint8_t mode, uint16_t value, uint32_t value32, const void *payload, uint16_t payloadSize) {
+  if (_used + sizeof(JournalRecord) + payloadSize > kBufferSize) {
+    ++_dropped; // Never flushed from here; see flush()
+    return;
+  }
+  JournalRecord record;
+  record._millis = _clock->millis();
+  record._kind = kind;
+  record._mode = mode;
+  record._value = value;
+  record._value32 = value32;
+  append(&record, sizeof(record));
+  if (payloadSize>0) {
+    append(payload, payloadSize);
+  }
+}
+
+void Journal::boot(const AppState &state) {
+  AppStateSnapshot snapshot;
+  state.snapshot(snapshot, 0);
+  record(JournalBoot, 0, 0, packInputs(state), &snapshot, sizeof(snapshot));
+  _activeModes = 0;
+}
+
+void Journal::respireInit(uint32_t realTime) {
+  record(JournalRespireInit, 0, 0, realTime);
+}
+
+void Journal::loaded(const char *name, const void *bytes, uint16_t size) {
+  const uint16_t nameSize = strlen(name) + 1;
+  if (_used + sizeof(JournalRecord) + nameSize + size > kBufferSize) {
+    ++_dropped;
+    return;
+  }
+  record(JournalStoreLoad, 0, nameSize + size, 0, name, nameSize);
+  append(bytes, size);
+}
+
+void Journal::activeModes(uint32_t modes) {
+  if (modes!=_activeModes) {
+    _activeModes = modes;
+    record(JournalActiveModes, 0, 0, modes);
+  }
+}
+
+void Journal::flush() {
+  if (_used>0 && _sink!=NULL) {
+    _sink(_buffer, _used);
+  }
+  _used = 0;
+  if (_dropped>0) {
+    const uint32_t dropped = _dropped;
+    _dropped = 0;
+    record(JournalGap, 0, 0, dropped);
+  }
+}
+
+void Journal::observeInputs(const AppState &state, FieldMask changed, void *context) {
+  Journal *journal = (Journal *)context;
+  journal->record(JournalInputs, 0, changed, packInputs(state));
+}
+
+void applyJournalComplete(RespireContext<AppState> &respire, const JournalRecord &record, const uint8_t *payload) {
+  Mode<AppState> *mode = modeAt(record._mode);
+  if (mode==NULL) {
+    Log.Error("Journal completes unknown Mode %d\n", record._mode);
+    return;
+  }
+  if ((record._value & kCompletionFields)==0) {
+    respire.complete(mode);
+    return;
+  }
+  respire.complete(mode, [&record, payload](AppState &state) {
+    AppState::Batch batch(state);
+    if (record._value & FieldJoined) {
+      state.setJoined(record._value & kJournalJoined);
+    }
+    if (record._value & FieldTtnFrame) {
+      state.transmittedFrame(record._value32);
+    }
+    if (record._value & FieldGpsSample) {
+      GpsSample sample;
+      memcpy((void *)&sample, payload, sizeof(sample));
+      state.setGpsLocation(sample);
+    }
+  });
+}
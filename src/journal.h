@@ -0,0 +1,233 @@
+/*
+  Journal - Compact binary record of everything that drives AppState, so a
+  device's behaviour in the field can be replayed natively.
+
+  Three kinds of event are recorded, each as a 12 byte JournalRecord stamped
+  with Respire clock time:
+  - Inputs: hardware readings and button edges, one record per update, via
+    AppState's input observer.
+  - Completions: every RespireContext::complete() made through a
+    JournalingContext, with the completion fields (joined, frame counter, GPS
+    sample) the completion changed. A new GPS sample follows its record as
+    payload.
+  - Checkpoints: the set of active Modes after each loop() in which it
+    changed. The replayer compares its own active Modes against these.
+
+  A boot record, carrying the inputs and an AppStateSnapshot, starts each run.
+  Ahead of it go the real time RespireContext::init() was given and each value
+  Respire loaded from its store there (see JournalingStore), so a replay can
+  start from the per-Mode state a warm boot restored.
+  Records are buffered in RAM and handed to a sink (the SD card on the device)
+  only on flush(), which the sketch calls from loop(): records are also made
+  from radio callbacks, where writing to SD would hold up LMIC. A record that
+  doesn't fit in the buffer is dropped, and the next flush() leaves a gap
+  record saying how many were lost.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "mm_state.h"
+
+enum JournalKind {
+  JournalBoot = 1,        // _value32: packed inputs, payload: AppStateSnapshot
+  JournalInputs,          // _value: changed input fields, _value32: packed inputs
+  JournalComplete,        // _mode: Mode index, _value: changed completion fields (plus kJournalJoined), _value32: frame counter, payload: GpsSample if changed
+  JournalActiveModes,     // _value32: activeModes()
+  JournalGap,             // _value32: records dropped because the buffer was full
+  JournalRespireInit,     // _value32: real time passed to RespireContext::init()
+  JournalStoreLoad,       // _value: payload size, payload: NUL terminated name, then the value Respire loaded
+};
+
+// Fields a completion may set; see JournalingContext.
+static const FieldMask kCompletionFields = FieldJoined | FieldTtnFrame | FieldGpsSample;
+// Set in a JournalComplete _value when the completion left the device joined.
+static const uint16_t kJournalJoined = 1 << 15;
+static_assert(kAllFields < kJournalJoined, "kJournalJoined must stay clear of the field bits");
+
+typedef struct JournalRecord {
+  uint32_t _millis;
+  uint8_t _kind;
+  uint8_t _mode;
+  uint16_t _value;
+  uint32_t _value32;
+} JournalRecord;
+
+static_assert(sizeof(JournalRecord)==12, "JournalRecord must stay 12 bytes");
+
+// Bytes of payload that follow record.
+uint16_t journalPayloadSize(const JournalRecord &record);
+
+// Input fields packed as bit flags in the low half and battery millivolts in
+// the high half.
+uint32_t packInputs(const AppState &state);
+// Sets the input fields in mask from packed, in a single update.
+void applyInputs(AppState &state, FieldMask mask, uint32_t packed);
+
+typedef void (*JournalSinkFn)(const uint8_t *bytes, uint16_t size);
+
+class Journal {
+  static const uint16_t kBufferSize = 480;
+  uint8_t _buffer[kBufferSize];
+  uint16_t _used = 0;
+  Clock *_clock;
+  JournalSinkFn _sink;
+  uint32_t _activeModes = 0;
+  uint32_t _dropped = 0;            // Records lost since the last flush()
+
+  void append(const void *bytes, uint16_t size);
+
+  public:
+  Journal(Clock *clock, JournalSinkFn sink)
+  : _clock(clock), _sink(sink) {
+  }
+
+  void record(uint8_t kind, uint8_t mode, uint16_t value, uint32_t value32, const void *payload = NULL, uint16_t payloadSize = 0);
+
+  void boot(const AppState &state);
+
+  // Records the real time about to be passed to RespireContext::init().
+  void respireInit(uint32_t realTime);
+
+  // Records a value RespireContext::init() loaded from its store.
+  void loaded(const char *name, const void *bytes, uint16_t size);
+
+  // Records a checkpoint if modes differs from the last one.
+  void activeModes(uint32_t modes);
+
+  // Whether the buffer is half full, so loop() should flush() before it fills.
+  bool flushDue() const {
+    return _used >= kBufferSize / 2;
+  }
+
+  // Hands buffered records to the sink.
+  void flush();
+
+  // InputObserverFn for AppState::setInputObserver, with the Journal as context.
+  static void observeInputs(const AppState &state, FieldMask changed, void *context);
+};
+
+// RespireStore that journals every value Respire loads through it. Stores
+// pass straight through.
+class JournalingStore : public RespireStore {
+  RespireStore &_store;
+  Journal &_journal;
+
+  public:
+  JournalingStore(RespireStore &store, Journal &journal)
+  : _store(store), _journal(journal) {
+  }
+
+  virtual void beginTransaction() {
+    _store.beginTransaction();
+  }
+
+  virtual void endTransaction() {
+    _store.endTransaction();
+  }
+
+  virtual bool load(const char *name, uint8_t *bytes, const uint16_t size) {
+    const bool loaded = _store.load(name, bytes, size);
+    if (loaded) {
+      _journal.loaded(name, bytes, size);
+    }
+    return loaded;
+  }
+
+  virtual bool load(const char *name, uint32_t *value) {
+    const bool loaded = _store.load(name, value);
+    if (loaded) {
+      _journal.loaded(name, value, sizeof(*value));
+    }
+    return loaded;
+  }
+
+  virtual bool store(const char *name, const uint8_t *bytes, const uint16_t size) {
+    return _store.store(name, bytes, size);
+  }
+
+  virtual bool store(const char *name, const uint32_t value) {
+    return _store.store(name, value);
+  }
+};
+
+// RespireContext that journals each completion. It wraps the context rather
+// than deriving from it, so no call through a base reference can complete a
+// Mode without journaling it.
+class JournalingContext {
+  RespireContext<AppState> _respire;
+  AppState &_state;
+  Journal *_journal = NULL;
+
+  void journal(Mode<AppState> &mode, const AppState &before) {
+    uint16_t changed = _state.changes(before, kCompletionFields);
+    if (_state.getJoined()) {
+      changed |= kJournalJoined;
+    }
+    const bool sample = changed & FieldGpsSample;
+    _journal->record(JournalComplete, modeIndex(mode), changed, _state.ttnFrameCounter(),
+      sample ? &_state.gpsSample() : NULL, sample ? sizeof(GpsSample) : 0);
+  }
+
+  public:
+  JournalingContext(AppState &state, Mode<AppState> &root, Clock *clock, Executor<AppState> *executor)
+  : _respire(state, root, clock, executor),
+    _state(state) {
+  }
+
+  void setJournal(Journal *journal) {
+    _journal = journal;
+  }
+
+  void init(uint32_t realTime = 0, RespireStore *store = NULL) {
+    _respire.init(realTime, store);
+  }
+
+  void begin() {
+    _respire.begin();
+  }
+
+  void loop() {
+    _respire.loop();
+  }
+
+  void setExecutor(Executor<AppState> *executor) {
+    _respire.setExecutor(executor);
+  }
+
+  void complete(Mode<AppState> &mode) {
+    if (_journal==NULL) {
+      _respire.complete(mode);
+      return;
+    }
+    const AppState before(_state);
+    _respire.complete(mode);
+    journal(mode, before);
+  }
+
+  void complete(Mode<AppState> *mode) {
+    complete(*mode);
+  }
+
+  template <class Fn>
+  void complete(Mode<AppState> &mode, Fn fn) {
+    if (_journal==NULL) {
+      _respire.complete(mode, fn);
+      return;
+    }
+    const AppState before(_state);
+    _respire.complete(mode, fn);
+    journal(mode, before);
+  }
+
+  template <class Fn>
+  void complete(Mode<AppState> *mode, Fn fn) {
+    complete(*mode, fn);
+  }
+};
+
+// Replays a JournalComplete record against respire, applying the recorded
+// completion fields the way the original callback did.
+void applyJournalComplete(RespireContext<AppState> &respire, const JournalRecord &record, const uint8_t *payload);
+
+#endif
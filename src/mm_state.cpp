@@ -1,5 +1,70 @@
 #include "mm_state.h"
+#include "gps_assist.h"
 #include <Logging.h>
+#include <stddef.h>
+
+#define ELEMENTS(_array) (sizeof(_array) / sizeof(_array[0]))
+
+// Predicates
+
+// Also reads the clock: the sample goes stale with no field changing. Updates
+// skip Modes whose fields (kModes) didn't change, so this is only seen to
+// turn false when RespireContext::loop() re-evaluates every Mode.
+static bool hasRecentGpsLocation(const AppState &state) {
+  return state.hasRecentGpsLocation();
+}
+
+static bool displayInspired(const AppState &state, const AppState &oldState) {
+  return (state.field()!=oldState.field())                            // Field changes
+      || (state.buttonAny() && !oldState.buttonAny());                // Any button is pressed
+}
+
+static bool pageRedisplayed(const AppState &state, const AppState &oldState) {
+  return state.changes(oldState, FieldField | FieldRedisplay)!=0;     // Field or redisplayRequested changes
+}
+
+static bool onStatusPage(const AppState &state) {
+  return state.page()==0;
+}
+
+static bool onParametersPage(const AppState &state) {
+  return state.page()==1;
+}
+
+static bool onErrorsPage(const AppState &state) {
+  return state.page()==2;
+}
+
+static bool lowPowerNotJoined(const AppState &state) {
+  return !state.getUsbPower() && !state.getJoined();
+}
+
+// gpsSearchDue() also reads the clock, so like hasRecentGpsLocation() a
+// parked search coming due is only seen by RespireContext::loop().
+static bool lowPowerSearchingGps(const AppState &state) {
+  return !state.getUsbPower() && state.getJoined() && !state.hasGpsFix() && !state.gpsSearchOver()
+      && state.gpsSearchDue();
+}
+
+static bool joined(const AppState &state) {
+  return state.getJoined();
+}
+
+static bool hasGpsFix(const AppState &state) {
+  return state.hasGpsFix();
+}
+
+static bool lowPowerWithFix(const AppState &state) {
+  return !state.getUsbPower() && state.getJoined() && state.hasGpsFix();
+}
+
+static bool usbPowerNotJoined(const AppState &state) {
+  return state.getUsbPower() && !state.getJoined();
+}
+
+static bool usbPowerWithFix(const AppState &state) {
+  return state.getUsbPower() && state.getJoined() && state.hasGpsFix();
+}
 
 // Shared
 Mode<AppState> ModeAttemptJoin(Mode<AppState>::Builder("AttemptJoin").invokeFn(attemptJoin));
@@ -8,9 +73,7 @@ Mode<AppState> ModeSend(Mode<AppState>::Builder("Send")
     .childSimultaneousLimit(1)
     .addChild(&ModeSendAck)
     .addChild(&ModeSendNoAck)
-    .requiredPred([](const AppState &state) -> bool {
-      return state.hasRecentGpsLocation();
-    }));
+    .requiredPred(hasRecentGpsLocation));
   Mode<AppState> ModeSendNoAck(Mode<AppState>::Builder("SendNoAck").invokeFn(sendLocation));
   Mode<AppState> ModeSendAck(Mode<AppState>::Builder("SendAck")
                     .invokeFn(sendLocationAck)
@@ -22,10 +85,7 @@ Mode<AppState> ModeMain(Mode<AppState>::Builder("Main")
               .addChild(&ModeFunctional));
   Mode<AppState> ModeDisplay(Mode<AppState>::Builder("Display")
       .idleMode(&ModeDisplayBlank)
-      .inspirationPred([](const AppState &state, const AppState &oldState) -> bool {
-        return (state.field()!=oldState.field())                            // Field changes
-            || (state.buttonAny() && !oldState.buttonAny());                // Any button is pressed
-      })
+      .inspirationPred(displayInspired)
       .addChild(&ModeDisplayBlank)
       .addChild(&ModeDisplayStatus)
       .addChild(&ModeDisplayParameters)
@@ -35,32 +95,16 @@ Mode<AppState> ModeMain(Mode<AppState>::Builder("Main")
         .invokeDelay(MINUTES_IN_MILLIS(1)));
     Mode<AppState> ModeDisplayStatus(Mode<AppState>::Builder("DisplayStatus")
         .invokeFn(displayStatus)
-        .requiredPred([](const AppState &state) -> bool {
-          return state.page()==0;
-        })
-        .inspirationPred([](const AppState &state, const AppState &oldState) -> bool {
-          return (state.field()!=oldState.field())
-              || (state.redisplayRequested()!=oldState.redisplayRequested());  // redisplayRequested changes
-        }));
+        .requiredPred(onStatusPage)
+        .inspirationPred(pageRedisplayed));
     Mode<AppState> ModeDisplayParameters(Mode<AppState>::Builder("DisplayParameters")
         .invokeFn(displayParameters)
-        .requiredPred([](const AppState &state) -> bool {
-          return state.page()==1;
-        })
-        .inspirationPred([](const AppState &state, const AppState &oldState) -> bool {
-          return (state.field()!=oldState.field())
-              || (state.redisplayRequested()!=oldState.redisplayRequested());  // redisplayRequested changes
-        }));
+        .requiredPred(onParametersPage)
+        .inspirationPred(pageRedisplayed));
     Mode<AppState> ModeDisplayErrors(Mode<AppState>::Builder("DisplayErrors")
         .invokeFn(displayErrors)
-        .requiredPred([](const AppState &state) -> bool {
-          return state.page()==2;
-        })
-        .inspirationPred([](const AppState &state, const AppState &oldState) -> bool {
-          // Log.Debug("%s inspirationPred: %d != %d\n", ModeDisplayErrors.name(), (int)state.field(), (int)oldState.field());
-          return (state.field()!=oldState.field())
-              || (state.redisplayRequested()!=oldState.redisplayRequested());  // redisplayRequested changes
-        }));
+        .requiredPred(onErrorsPage)
+        .inspirationPred(pageRedisplayed));
 
 Mode<AppState> ModeFunctional(Mode<AppState>::Builder("Functional")
               .idleMode(&ModeSleep)
@@ -74,47 +118,231 @@ Mode<AppState> ModeFunctional(Mode<AppState>::Builder("Functional")
   Mode<AppState> ModeLowPowerJoin(Mode<AppState>::Builder("LowPowerJoin")
       .repeatLimit(1)
       .addChild(&ModeAttemptJoin)
-      .requiredPred([](const AppState &state) -> bool {
-        return !state.getUsbPower() && !state.getJoined();
-      }));
+      .requiredPred(lowPowerNotJoined));
   Mode<AppState> ModeLowPowerGpsSearch(Mode<AppState>::Builder("LowPowerGpsSearch")
-      .repeatLimit(1)
-      .minDuration(MINUTES_IN_MILLIS(5))
-      .maxDuration(MINUTES_IN_MILLIS(5))
-      .requiredPred([](const AppState &state) -> bool {
-        return !state.getUsbPower() && state.getJoined() && !state.hasGpsFix();
-      }));
+      .minGapDuration(LOW_POWER_CYCLE_GAP_MS)
+      .minDuration(GPS_SEARCH_MIN_MS)
+      .maxDuration(GPS_SEARCH_MAX_MS)   // Usually ended sooner by gpsSearchOver()
+      .requiredPred(lowPowerSearchingGps));
   Mode<AppState> ModeReadAndSend(Mode<AppState>::Builder("ReadAndSend")
       .addChild(&ModeReadGps)
       .addChild(&ModeSend)
       .addChild(&ModeLogGps)
-      .requiredPred([](const AppState &state) -> bool {
-        return state.getJoined();
-      }));
+      .requiredPred(joined));
   Mode<AppState> ModeReadGps(Mode<AppState>::Builder("ReadGps")
       .invokeFn(readGpsLocation)
-      .requiredPred([](const AppState &state) -> bool {
-        return state.hasGpsFix();
-      }));
+      .requiredPred(hasGpsFix));
   Mode<AppState> ModeLogGps(Mode<AppState>::Builder("LogGps")
       .invokeFn(writeLocation)
       .followMode(&ModeSend));
   Mode<AppState> ModeLowPowerSend(Mode<AppState>::Builder("LowPowerSend")
-      .repeatLimit(1)
+      .minGapDuration(LOW_POWER_CYCLE_GAP_MS)
       .addChild(&ModeReadAndSend)
-      .requiredPred([](const AppState &state) -> bool {
-        return !state.getUsbPower() && state.getJoined() && state.hasGpsFix();
-      }));
+      .requiredPred(lowPowerWithFix));
   Mode<AppState> ModePeriodicJoin(Mode<AppState>::Builder("PeriodicJoin")
       .periodic(12, TimeUnitHour)
       .addChild(&ModeAttemptJoin)
-      .requiredPred([](const AppState &state) -> bool {
-        return state.getUsbPower() && !state.getJoined();
-      }));
+      .requiredPred(usbPowerNotJoined));
   Mode<AppState> ModePeriodicSend(Mode<AppState>::Builder("PeriodicSend")
       .periodic(6, TimeUnitHour)
       .addChild(&ModeReadAndSend)
-      .requiredPred([](const AppState &state) -> bool {
-        return state.getUsbPower() && state.getJoined() && state.hasGpsFix();
-      }));
+      .requiredPred(usbPowerWithFix));
+
+static_assert(GPS_SEARCH_MIN_MS <= GPS_SEARCH_MAX_MS, "GPS search window bounds are inverted");
+
+// Each Mode in declaration order, with the fields its requiredPred/inspirationPred
+// read. Keep in step with the predicates above. At most 32 Modes, so Mode sets
+// fit in a uint32_t.
+static const struct {
+  Mode<AppState> *mode;
+  FieldMask dependsOn;
+} kModes[] = {
+  {&ModeMain,              0},
+  {&ModeDisplay,           FieldField | kButtonFields},
+  {&ModeDisplayBlank,      0},
+  {&ModeDisplayStatus,     FieldPage | FieldField | FieldRedisplay},
+  {&ModeDisplayParameters, FieldPage | FieldField | FieldRedisplay},
+  {&ModeDisplayErrors,     FieldPage | FieldField | FieldRedisplay},
+  {&ModeFunctional,        0},
+  {&ModeSleep,             0},
+  {&ModeAttemptJoin,       0},
+  {&ModeLowPowerJoin,      FieldUsbPower | FieldJoined},
+  {&ModeLowPowerGpsSearch, FieldUsbPower | FieldJoined | FieldGpsFix | FieldGpsSearchOver | FieldStationary | FieldGpsSample},
+  {&ModeLowPowerSend,      FieldUsbPower | FieldJoined | FieldGpsFix},
+  {&ModePeriodicJoin,      FieldUsbPower | FieldJoined},
+  {&ModePeriodicSend,      FieldUsbPower | FieldJoined | FieldGpsFix},
+  {&ModeReadAndSend,       FieldJoined},
+  {&ModeReadGps,           FieldGpsFix},
+  {&ModeSend,              FieldGpsSample},
+  {&ModeSendNoAck,         0},
+  {&ModeSendAck,           0},
+  {&ModeLogGps,            0},
+};
+
+uint8_t modeCount() {
+  return ELEMENTS(kModes);
+}
+
+Mode<AppState> *modeAt(uint8_t index) {
+  return index<ELEMENTS(kModes) ? kModes[index].mode : NULL;
+}
+
+uint8_t modeIndex(const Mode<AppState> &mode) {
+  uint8_t i = 0;
+  while (i<ELEMENTS(kModes) && kModes[i].mode!=&mode) {
+    ++i;
+  }
+  return i;
+}
+
+uint32_t activeModes(const AppState &state) {
+  uint32_t active = 0;
+  for (uint8_t i=0; i<ELEMENTS(kModes); ++i) {
+    if (kModes[i].mode->isActive(state)) {
+      active |= (1UL << i);
+    }
+  }
+  return active;
+}
+
+FieldMask modeDependencies(const Mode<AppState> &mode) {
+  for (uint16_t i=0; i<ELEMENTS(kModes); ++i) {
+    if (kModes[i].mode==&mode) {
+      return kModes[i].dependsOn;
+    }
+  }
+  return 0;
+}
+
+FieldMask attachedModeDependencies() {
+  FieldMask fields = 0;
+  for (uint16_t i=0; i<ELEMENTS(kModes); ++i) {
+    if (kModes[i].mode->attached()) {
+      fields |= kModes[i].dependsOn;
+    }
+  }
+  return fields;
+}
+
+// Updates only nest when an action runs synchronously inside one, so a few
+// views cover them. Each costs an AppState of RAM.
+static const uint8_t kUpdateViews = 4;
+static AppState sUpdateViews[kUpdateViews];
+static uint8_t sUpdateViewUsers[kUpdateViews];
+
+AppState *AppState::acquireView() {
+  uint8_t i = 0;
+  while (i<kUpdateViews - 1 && sUpdateViewUsers[i]!=0) {
+    ++i;
+  }
+  if (sUpdateViewUsers[i]!=0) {
+    // Shared with an outer update, which then sees this one's old values
+    Log.Error("More than %d nested AppState updates\n", kUpdateViews);
+  }
+  ++sUpdateViewUsers[i];
+  return &sUpdateViews[i];
+}
+
+void AppState::releaseView(AppState *view) {
+  --sUpdateViewUsers[view - sUpdateViews];
+}
+
+uint16_t snapshotCrc(const AppStateSnapshot &snapshot) {
+  // CRC-16/CCITT-FALSE over everything but the CRC itself
+  const uint8_t *bytes = (const uint8_t *)&snapshot;
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i<offsetof(AppStateSnapshot, _crc); ++i) {
+    crc ^= (uint16_t)bytes[i] << 8;
+    for (uint8_t bit = 0; bit<8; ++bit) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+  }
+  return crc;
+}
+
+// Rounds value to a float's 24 bit significand, to nearest with ties to even,
+// adjusting shift so that the result stands for value / 2^shift as before.
+static uint32_t roundSignificand(uint64_t value, int8_t &shift) {
+  uint8_t dropped = 0;
+  while ((value >> dropped) >= (1UL << 24)) {
+    ++dropped;
+  }
+  if (dropped==0) {
+    return value;
+  }
+  uint64_t significand = value >> dropped;
+  const uint64_t rest = value & ((1ULL << dropped) - 1);
+  const uint64_t half = 1ULL << (dropped - 1);
+  if (rest > half || (rest==half && (significand & 1))) {
+    ++significand;
+  }
+  shift -= dropped;
+  if (significand==(1UL << 24)) {
+    significand >>= 1;
+    --shift;
+  }
+  return significand;
+}
+
+// (value / divisor) * multiplier truncated toward zero, with both operations
+// rounded as float arithmetic rounds them, the way the packet was encoded
+// when GpsSample held floats. Integer only, so no soft-float on the M0.
+static int32_t floatScale(int32_t value, uint32_t divisor, uint32_t multiplier) {
+  if (value==0) {
+    return 0;
+  }
+  // The conversion to float rounds large values first
+  int8_t shift = 0;
+  const uint32_t rounded = roundSignificand(value<0 ? -(int64_t)value : value, shift);
+
+  // Quotient as significand / 2^shift, with the significand normalized to
+  // 24 bits before rounding
+  uint64_t numerator = rounded;
+  uint64_t denominator = divisor;
+  if (shift<0) {
+    numerator <<= -shift;
+    shift = 0;
+  }
+  while (numerator < (denominator << 23)) {
+    numerator <<= 1;
+    ++shift;
+  }
+  while (numerator >= (denominator << 24)) {
+    denominator <<= 1;
+    --shift;
+  }
+  uint64_t quotient = numerator / denominator;
+  const uint64_t remainder = numerator % denominator;
+  if (2 * remainder > denominator || (2 * remainder==denominator && (quotient & 1))) {
+    ++quotient;
+  }
+  quotient = roundSignificand(quotient, shift);
+
+  const uint32_t product = roundSignificand(quotient * multiplier, shift);
+  const uint32_t magnitude = shift>=0 ? product >> shift : product << -shift;
+  return value<0 ? -(int32_t)magnitude : magnitude;
+}
+
+uint8_t GpsSample::writePacket(uint8_t *packet, uint8_t packetSize) const {
+  const int32_t lat = floatScale(_latitude, 10000000, 93206);  // Expand +/-90 coordinate to fill 24bits
+  const int32_t lon = floatScale(_longitude, 10000000, 46603); // Expand +/-180 coordinate to fill 24bits
+  const int16_t alt = _altitude / 100;                          // Meters; cm/100 rounds exactly in float too
+  const int32_t hdop = floatScale(_HDOP, 100, 1000);           // Thousandths
+
+  // Big endian, bottom 24 bits of each coordinate
+  packet[0] = lat >> 16; packet[1] = lat >> 8; packet[2] = lat;
+  packet[3] = lon >> 16; packet[4] = lon >> 8; packet[5] = lon;
+  packet[6] = alt >> 8; packet[7] = alt;
+  packet[8] = hdop >> 8; packet[9] = hdop; // Wraps above 32.767, as the int16_t conversion did
+
+  return 10;
+}
 
+size_t formatFixedPoint(char *buffer, int32_t value, uint8_t decimals) {
+  uint32_t scale = 1;
+  for (uint8_t i = 0; i<decimals; ++i) {
+    scale *= 10;
+  }
+  const uint32_t magnitude = value<0 ? -(uint32_t)value : value;
+  return sprintf(buffer, "%s%lu.%0*lu", value<0 ? "-" : "", (unsigned long)(magnitude / scale), (int)decimals, (unsigned long)(magnitude % scale));
+}
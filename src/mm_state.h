@@ -14,6 +14,10 @@
           memcpy. (Not that we do, but, for instance, the way Modes have
           constant addresses that can be used to refer to them, as opposed
           to being members of AppState.)
+  FieldMask - Bits naming AppState fields. Setters record the fields they
+          change and skip the update cycle when no Mode, derived state or
+          listener reads any of them. Each Mode's predicate dependencies
+          are declared in mm_state.cpp.
  */
 
 #ifndef MM_STATE_H
@@ -22,6 +26,7 @@
 #include <Arduino.h>
 #include <limits.h>
 #include <cstdio>
+#include <cstring>
 #include <cassert>
 #undef min
 #undef max
@@ -75,18 +80,32 @@ extern Mode<AppState>
 
 #define SAMPLE_VALID_FOR_MS 2000
 
+// How often a parked device on battery searches for a fix. Often enough to
+// notice being moved, rarely enough that parked time costs little GPS power.
+#ifndef PARKED_SEARCH_INTERVAL_MS
+#define PARKED_SEARCH_INTERVAL_MS (60 * 60 * 1000UL)
+#endif
+
+// Least time from the end of one low power search (or send) to the start of
+// the next, so each cycle on battery is followed by a stretch of sleep.
+#ifndef LOW_POWER_CYCLE_GAP_MS
+#define LOW_POWER_CYCLE_GAP_MS (10 * 60 * 1000UL)
+#endif
+
 typedef struct GpsSample {
-  float _latitude = 0.0;
-  float _longitude = 0.0;
-  float _altitude = 0.0;
-  float _HDOP = 0.0;
+  // Fixed point throughout, as parsed. Neither the fix it comes from (see
+  // GpsReader, MotionEstimator) nor the packet it goes into uses soft-float.
+  int32_t _latitude = 0;      // 1e-7 degrees
+  int32_t _longitude = 0;     // 1e-7 degrees
+  int32_t _altitude = 0;      // Centimeters
+  uint16_t _HDOP = 0;         // Hundredths
   uint16_t _year = 0;
   uint8_t _month = 0, _day = 0, _hour = 0, _minute = 0, _seconds = 0;
   uint16_t _millis = 0;
 
   GpsSample() {};
 
-  GpsSample(float latitude, float longitude, float altitude, float HDOP, uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t seconds, uint16_t millis)
+  GpsSample(int32_t latitude, int32_t longitude, int32_t altitude, uint16_t HDOP, uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t seconds, uint16_t millis)
   : _latitude(latitude),
     _longitude(longitude),
     _altitude(altitude),
@@ -102,18 +121,73 @@ typedef struct GpsSample {
 
   uint8_t writePacket(uint8_t *packet, uint8_t packetSize) const;
 
+  bool same(const GpsSample &other) const {
+    return _latitude==other._latitude && _longitude==other._longitude && _altitude==other._altitude && _HDOP==other._HDOP
+        && _year==other._year && _month==other._month && _day==other._day
+        && _hour==other._hour && _minute==other._minute && _seconds==other._seconds && _millis==other._millis;
+  }
+
   void dump() const {
-    Log.Debug("- GPS Latitude, Longitude, Altitude, HDOP [Input]: %f, %f, %f, %f\n", _latitude, _longitude, _altitude, _HDOP);
+    Log.Debug("- GPS Latitude, Longitude (1e-7 deg), Altitude (cm), HDOP (x100) [Input]: %d, %d, %d, %d\n", _latitude, _longitude, _altitude, _HDOP);
   }
 } GpsSample;
 
-extern uint8_t fieldCountForPage(const AppState &state, uint8_t page);
+// Writes value / 10^decimals as a decimal string without going through float,
+// e.g. 407127753 with 7 decimals as "40.7127753". Returns the length.
+size_t formatFixedPoint(char *buffer, int32_t value, uint8_t decimals);
 
-class AppState : public RespireState<AppState> {
+extern uint8_t fieldCountForPage(const AppState &state, uint8_t page);
+extern void logStateChange(const AppState &state, const AppState &oldState);
+
+// Identifies AppState fields in change masks. Setters mark the fields they touch
+// and the update cycle only runs when something observes a changed field.
+typedef uint16_t FieldMask;
+enum {
+  FieldUsbPower     = 1 << 0,
+  FieldBatteryVolts = 1 << 1,
+  FieldGpsFix       = 1 << 2,
+  FieldGpsSample    = 1 << 3,
+  FieldTtnFrame     = 1 << 4,
+  FieldJoined       = 1 << 5,
+  FieldPage         = 1 << 6,
+  FieldField        = 1 << 7,
+  FieldButtonPage   = 1 << 8,
+  FieldButtonField  = 1 << 9,
+  FieldButtonChange = 1 << 10,
+  FieldRedisplay    = 1 << 11,
+  FieldStationary   = 1 << 12,
+  FieldGpsSearchOver = 1 << 13,
+};
+static const FieldMask kAllFields = (1 << 14) - 1;
+static const FieldMask kButtonFields = FieldButtonPage | FieldButtonField | FieldButtonChange;
+// Fields set from outside the state machine: hardware readings and buttons.
+static const FieldMask kInputFields = FieldUsbPower | FieldBatteryVolts | FieldGpsFix | FieldStationary | FieldGpsSearchOver | kButtonFields;
+
+// Fields read directly by updateDerivedState() and onChange(). Fields read by
+// Modes they consult are covered by the Mode dependency index.
+static const FieldMask kDerivedStateFields = FieldButtonPage | FieldButtonField | FieldUsbPower;
+
+// Fields read by the predicates of `mode`.
+extern FieldMask modeDependencies(const Mode<AppState> &mode);
+// Defined Modes by index, in declaration order.
+extern uint8_t modeCount();
+extern Mode<AppState> *modeAt(uint8_t index);
+// Index of mode among the defined Modes, or modeCount() if it isn't one.
+extern uint8_t modeIndex(const Mode<AppState> &mode);
+// Bit per Mode index that is active in state.
+extern uint32_t activeModes(const AppState &state);
+// Union of the dependencies of all attached Modes.
+extern FieldMask attachedModeDependencies();
+
+// The plain data of AppState. Grouped so that the values preceding an update
+// can be shadowed with a small struct copy.
+typedef struct AppFields {
   // External state
   bool _usbPower = false;
   float _batteryVolts = 0.0;
   bool _gpsFix = false;
+  bool _stationary = false;   // The GPS has seen no movement for a while
+  bool _gpsSearchOver = false; // The GPS has searched as long as its TTFF history warrants
 
   GpsSample _gpsSample;
   uint32_t _gpsSampleExpiry = 0;
@@ -129,223 +203,478 @@ class AppState : public RespireState<AppState> {
   bool _buttonField = false;
   bool _buttonChange = false;
   bool _redisplayRequested = false; // Toggle this to trigger redisplay.
+} AppFields;
+
+// The AppState fields worth keeping across a reset, saved to the parameter
+// store before standby and after each send and restored in setup(). Times are
+// stored relative to the snapshot so they survive millis() restarting.
+// Bump kAppStateSnapshotVersion whenever the layout changes.
+static const uint8_t kAppStateSnapshotVersion = 2;
+
+typedef struct AppStateSnapshot {
+  uint8_t _version;
+  uint8_t _size;              // sizeof(AppStateSnapshot)
+  bool _joined;
+  uint8_t _page;
+  uint32_t _seconds;          // Real time of the snapshot, 0 if unknown
+  uint32_t _ttnFrameCounter;
+  uint32_t _gpsSampleValidMs; // Remaining validity of _gpsSample, 0 if expired
+  GpsSample _gpsSample;
+  uint16_t _crc;              // CRC-16/CCITT of all preceding bytes
+} AppStateSnapshot;
+
+extern uint16_t snapshotCrc(const AppStateSnapshot &snapshot);
 
+// Called once per update with the input fields it changed, before the update
+// cycle runs. Used to journal inputs.
+typedef void (*InputObserverFn)(const AppState &state, FieldMask changed, void *context);
+
+class AppState : public RespireState<AppState> {
+  AppFields _fields;
+  FieldMask _dirty = 0;             // Fields changed by the update in progress
+  FieldMask _listenerFields = 0;    // Fields the registered listener cares about
+  uint8_t _updateDepth = 0;
+  AppState *_previous = NULL;       // Values before the update in progress, see acquireView()
+  Clock *_clock = NULL;             // Time base for sample expiry and sends; ::millis() if NULL
+  InputObserverFn _inputObserver = NULL;
+  void *_inputObserverContext = NULL;
+
+  // Old states for the updates in progress, from a small static pool, so that
+  // an update shadows the fields it starts with instead of building a second
+  // AppState. Defined in mm_state.cpp.
+  static AppState *acquireView();
+  static void releaseView(AppState *view);
+
+  void beginUpdate() {
+    if (_updateDepth++ == 0) {
+      _previous = acquireView();
+      _previous->_fields = _fields;
+      _dirty = 0;
+    }
+  }
+
+  void endUpdate(const FieldMask fields) {
+    _dirty |= fields;
+    if (--_updateDepth == 0) {
+      commitUpdate();
+    }
+  }
+
+  void commitUpdate() {
+    const FieldMask dirty = _dirty;
+    AppState *previous = _previous; // An update nested in this one takes its own
+    _dirty = 0;
+    _previous = NULL;
+    if (_inputObserver!=NULL && (dirty & kInputFields)!=0) {
+      _inputObserver(*this, dirty & kInputFields, _inputObserverContext);
+    }
+    // Unless no predicate reads these fields, and so no Mode can change
+    if ((dirty & observedFields()) != 0) {
+      // The shadowed fields, with everything else as it is now
+      previous->RespireState<AppState>::operator=(*this);
+      previous->_clock = _clock;
+      onUpdate(*previous);
+    }
+    releaseView(previous);
+  }
 
   public:
-  AppState() : _gpsSample() {
+  // Scoped guard that applies several mutations and then runs a single update
+  // cycle against the values from before the first one. Batches nest.
+  class Batch {
+    AppState &_state;
+
+    public:
+    Batch(AppState &state)
+    : _state(state) {
+      _state.beginUpdate();
+    }
+
+    ~Batch() {
+      _state.endUpdate(0);
+    }
+  };
+
+  AppState() {
     reset();
   }
 
+  // Copies are values: no update is in progress in the copy and the input
+  // observer stays with the original.
   AppState(const AppState &otherState)
   : RespireState(otherState),
-    _usbPower(otherState._usbPower),
-    _batteryVolts(otherState._batteryVolts),
-    _gpsFix(otherState._gpsFix),
-    _gpsSample(otherState._gpsSample),
-    _gpsSampleExpiry(otherState._gpsSampleExpiry),
-    _ttnFrameCounter(otherState._ttnFrameCounter),
-    _ttnLastSend(otherState._ttnLastSend),
-    _joined(otherState._joined),
-    _page(otherState._page),
-    _field(otherState._field),
-    _buttonPage(otherState._buttonPage),
-    _buttonField(otherState._buttonField),
-    _buttonChange(otherState._buttonChange),
-    _redisplayRequested(otherState._redisplayRequested)
+    _fields(otherState._fields),
+    _listenerFields(otherState._listenerFields),
+    _clock(otherState._clock)
   {}
 
+  AppState &operator=(const AppState &otherState) {
+    RespireState<AppState>::operator=(otherState);
+    _fields = otherState._fields;
+    _dirty = 0;
+    _listenerFields = otherState._listenerFields;
+    _updateDepth = 0;
+    _previous = NULL;
+    _clock = otherState._clock;
+    _inputObserver = NULL;
+    _inputObserverContext = NULL;
+    return *this;
+  }
+
   virtual void updateDerivedState(const AppState &oldState) {
     static const uint8_t kPageCount = 3;
     if (ModeDisplay.attached() && ModeDisplay.isActive(*this)) { // Buttons change page/field only while display is on
       if (buttonPage() && !oldState.buttonPage()) {
-        _page = (_page + 1) % kPageCount;
-        _field = 0;
+        _fields._page = (_fields._page + 1) % kPageCount;
+        _fields._field = 0;
       }
       if (buttonField() && !oldState.buttonField()) {
-        _field = (_field + 1) % fieldCountForPage(*this, _page);
+        _fields._field = (_fields._field + 1) % fieldCountForPage(*this, _fields._page);
       }
     }
   }
 
   void reset() {
     RespireState<AppState>::reset();
-    _usbPower = false;
-    _gpsFix = false;
-    _joined = false;
-    _gpsSampleExpiry = 0;
+    _fields._usbPower = false;
+    _fields._gpsFix = false;
+    _fields._stationary = false;
+    _fields._gpsSearchOver = false;
+    _fields._joined = false;
+    _fields._gpsSampleExpiry = 0;
+  }
+
+  // Fields (limited to `mask`) that differ between this state and oldState.
+  FieldMask changes(const AppState &oldState, const FieldMask mask = kAllFields) const {
+    const AppFields &a = _fields, &b = oldState._fields;
+    FieldMask changed = 0;
+    if ((mask & FieldUsbPower) && a._usbPower!=b._usbPower) changed |= FieldUsbPower;
+    if ((mask & FieldBatteryVolts) && a._batteryVolts!=b._batteryVolts) changed |= FieldBatteryVolts;
+    if ((mask & FieldGpsFix) && a._gpsFix!=b._gpsFix) changed |= FieldGpsFix;
+    if ((mask & FieldGpsSample) && (a._gpsSampleExpiry!=b._gpsSampleExpiry || !a._gpsSample.same(b._gpsSample))) changed |= FieldGpsSample;
+    if ((mask & FieldTtnFrame) && (a._ttnFrameCounter!=b._ttnFrameCounter || a._ttnLastSend!=b._ttnLastSend)) changed |= FieldTtnFrame;
+    if ((mask & FieldJoined) && a._joined!=b._joined) changed |= FieldJoined;
+    if ((mask & FieldPage) && a._page!=b._page) changed |= FieldPage;
+    if ((mask & FieldField) && a._field!=b._field) changed |= FieldField;
+    if ((mask & FieldButtonPage) && a._buttonPage!=b._buttonPage) changed |= FieldButtonPage;
+    if ((mask & FieldButtonField) && a._buttonField!=b._buttonField) changed |= FieldButtonField;
+    if ((mask & FieldButtonChange) && a._buttonChange!=b._buttonChange) changed |= FieldButtonChange;
+    if ((mask & FieldRedisplay) && a._redisplayRequested!=b._redisplayRequested) changed |= FieldRedisplay;
+    if ((mask & FieldStationary) && a._stationary!=b._stationary) changed |= FieldStationary;
+    if ((mask & FieldGpsSearchOver) && a._gpsSearchOver!=b._gpsSearchOver) changed |= FieldGpsSearchOver;
+    return changed;
+  }
+
+  // Uses clock instead of ::millis() for sample expiry and send times, so
+  // they follow the same time base as Respire. Copies share the clock.
+  void setClock(Clock *clock) {
+    _clock = clock;
+  }
+
+  uint32_t now() const {
+    return _clock!=NULL ? _clock->millis() : millis();
+  }
+
+  void setInputObserver(InputObserverFn observer, void *context) {
+    _inputObserver = observer;
+    _inputObserverContext = context;
+  }
+
+  // Fields whose changes run the update cycle.
+  FieldMask observedFields() const {
+    return kDerivedStateFields | attachedModeDependencies() | _listenerFields;
+  }
+
+  // Hides RespireState::setListener so the listener can declare the fields it watches.
+  void setListener(ListenerFn listener, const FieldMask fields = kAllFields) {
+    _listenerFields = (listener!=NULL) ? fields : 0;
+    RespireState<AppState>::setListener(listener);
   }
 
   // USB power
   bool getUsbPower() const {
-    return _usbPower;
+    return _fields._usbPower;
   }
 
   void setUsbPower(bool value) {
-    if (_usbPower == value) {
+    if (_fields._usbPower == value) {
       // Short circuit no change
       return;
     }
-    AppState oldState(*this);
-    _usbPower = value;
-    onUpdate(oldState);
+    beginUpdate();
+    _fields._usbPower = value;
+    endUpdate(FieldUsbPower);
   }
 
   float batteryVolts() const {
-    return _batteryVolts;
+    return _fields._batteryVolts;
   }
 
   void batteryVolts(float value) {
-    if (FLOAT_SAME(_batteryVolts, value, 0.01)) {
+    if (FLOAT_SAME(_fields._batteryVolts, value, 0.01)) {
       // Short circuit no change
       return;
     }
-    AppState oldState(*this);
-    _batteryVolts = value;
-    onUpdate(oldState);
+    beginUpdate();
+    _fields._batteryVolts = value;
+    endUpdate(FieldBatteryVolts);
   }
 
   bool hasGpsFix() const {
-    return _gpsFix;
+    return _fields._gpsFix;
   }
 
   void setGpsFix(bool value) {
-    if (_gpsFix == value) {
+    if (_fields._gpsFix == value) {
       // Short circuit no change
       return;
     }
-    AppState oldState(*this);
-    _gpsFix = value;
-    onUpdate(oldState);
+    beginUpdate();
+    _fields._gpsFix = value;
+    endUpdate(FieldGpsFix);
   }
 
   void setGpsLocation(GpsSample gpsSample) {
     Log.Debug("setGpsLocation -----------------------------\n");
-    AppState oldState(*this);
-    _gpsSample = gpsSample;
-    _gpsSampleExpiry = millis() + SAMPLE_VALID_FOR_MS;
-    onUpdate(oldState);
+    beginUpdate();
+    _fields._gpsSample = gpsSample;
+    _fields._gpsSampleExpiry = now() + SAMPLE_VALID_FOR_MS;
+    endUpdate(FieldGpsSample);
   }
 
   const GpsSample &gpsSample() const {
-    return _gpsSample;
+    return _fields._gpsSample;
   }
 
   bool hasRecentGpsLocation() const {
-    return _gpsSampleExpiry != 0 && (millis() < _gpsSampleExpiry);
+    return _fields._gpsSampleExpiry != 0 && (now() < _fields._gpsSampleExpiry);
+  }
+
+  // How much longer the GPS sample counts as recent, 0 if it no longer does.
+  uint32_t gpsSampleValidMs() const {
+    return hasRecentGpsLocation() ? _fields._gpsSampleExpiry - now() : 0;
   }
 
   bool getJoined() const {
-    return _joined;
+    return _fields._joined;
   }
 
   void setJoined(bool value) {
-    if (_joined == value) {
+    if (_fields._joined == value) {
+      // Short circuit no change
+      return;
+    }
+    beginUpdate();
+    _fields._joined = value;
+    endUpdate(FieldJoined);
+  }
+
+  // Parked, as far as the GPS can tell. While stationary with a fix, the GPS
+  // stays powered but only wakes periodically (see GpsPhasePark). On battery
+  // it stays set while the GPS is off, and spaces out searches (see
+  // gpsSearchDue()).
+  bool isStationary() const {
+    return _fields._stationary;
+  }
+
+  // Whether a low power search for a fix is worth making: every cycle while
+  // moving, but only every PARKED_SEARCH_INTERVAL_MS after the last sample
+  // while parked.
+  bool gpsSearchDue() const {
+    if (!isStationary() || _fields._gpsSampleExpiry==0) {
+      return true;
+    }
+    return now() - (_fields._gpsSampleExpiry - SAMPLE_VALID_FOR_MS) >= PARKED_SEARCH_INTERVAL_MS;
+  }
+
+  // Time until gpsSearchDue() turns true by itself, 0 if it already is.
+  uint32_t gpsSearchDueIn() const {
+    if (gpsSearchDue()) {
+      return 0;
+    }
+    return PARKED_SEARCH_INTERVAL_MS - (now() - (_fields._gpsSampleExpiry - SAMPLE_VALID_FOR_MS));
+  }
+
+  void setStationary(bool value) {
+    if (_fields._stationary == value) {
       // Short circuit no change
       return;
     }
-    AppState oldState(*this);
-    _joined = value;
-    onUpdate(oldState);
+    beginUpdate();
+    _fields._stationary = value;
+    endUpdate(FieldStationary);
+  }
+
+  // A low power search has gone on as long as recent TTFFs say is worthwhile
+  // (see gpsSearchWindow()), so it ends before ModeLowPowerGpsSearch's maximum.
+  bool gpsSearchOver() const {
+    return _fields._gpsSearchOver;
+  }
+
+  void setGpsSearchOver(bool value) {
+    if (_fields._gpsSearchOver == value) {
+      // Short circuit no change
+      return;
+    }
+    beginUpdate();
+    _fields._gpsSearchOver = value;
+    endUpdate(FieldGpsSearchOver);
   }
 
   bool getGpsPower() const {
     return getUsbPower() || (ModeLowPowerGpsSearch.attached() && ModeLowPowerGpsSearch.isActive(*this));
   }
 
+  // How long the device may stand by: 0 unless Sleep is active and no GPS,
+  // radio or SD work is pending, otherwise the time until Respire next needs
+  // to act, capped at limit. Respire has no timer for a parked search coming
+  // due (see gpsSearchDue()), so standby ends then too.
+  uint32_t sleepInterval(const Mode<AppState> &mainMode, const uint32_t limit) const {
+    if (!ModeSleep.attached() || !ModeSleep.isActive(*this) || getGpsPower()
+        || ModeAttemptJoin.isActive(*this) || ModeReadGps.isActive(*this)
+        || ModeSend.isActive(*this) || ModeLogGps.isActive(*this)) {
+      return 0;
+    }
+    const uint32_t sleep = mainMode.maxSleep(*this, limit);
+    const uint32_t due = gpsSearchDueIn();
+    return (due>0 && due<sleep) ? due : sleep;
+  }
+
   uint32_t ttnFrameCounter() const {
-    return _ttnFrameCounter;
+    return _fields._ttnFrameCounter;
   }
 
   uint8_t page() const {
-    return _page;
+    return _fields._page;
   }
 
   void page(uint8_t page) {
-    if (_page == page) {
+    if (_fields._page == page) {
       // Short circuit no change
       return;
     }
-    AppState oldState(*this);
-    _page = page;
-    onUpdate(oldState);
+    beginUpdate();
+    _fields._page = page;
+    endUpdate(FieldPage);
   }
 
   uint8_t field() const {
-    return _field;
+    return _fields._field;
   }
 
   void field(uint8_t field) {
-    if (_field == field) {
+    if (_fields._field == field) {
       // Short circuit no change
       return;
     }
-    AppState oldState(*this);
-    _field = field;
-    onUpdate(oldState);
+    beginUpdate();
+    _fields._field = field;
+    endUpdate(FieldField);
   }
 
   bool buttonAny() const {
-    return _buttonPage || _buttonField || _buttonChange;
+    return _fields._buttonPage || _fields._buttonField || _fields._buttonChange;
   }
 
   bool buttonPage() const {
-    return _buttonPage;
+    return _fields._buttonPage;
   }
 
   void buttonPage(bool btn) {
-    if (_buttonPage == btn) {
+    if (_fields._buttonPage == btn) {
       // Short circuit no change
       return;
     }
-    AppState oldState(*this);
-    _buttonPage = btn;
-    onUpdate(oldState);
+    beginUpdate();
+    _fields._buttonPage = btn;
+    endUpdate(FieldButtonPage);
   }
 
   bool buttonField() const {
-    return _buttonField;
+    return _fields._buttonField;
   }
 
   void buttonField(bool btn) {
-    if (_buttonField == btn) {
+    if (_fields._buttonField == btn) {
       // Short circuit no change
       return;
     }
-    AppState oldState(*this);
-    _buttonField = btn;
-    onUpdate(oldState);
+    beginUpdate();
+    _fields._buttonField = btn;
+    endUpdate(FieldButtonField);
   }
 
   bool buttonChange() const {
-    return _buttonChange;
+    return _fields._buttonChange;
   }
 
   void buttonChange(bool btn) {
-    if (_buttonChange == btn) {
+    if (_fields._buttonChange == btn) {
       // Short circuit no change
       return;
     }
-    AppState oldState(*this);
-    _buttonChange = btn;
-    onUpdate(oldState);
+    beginUpdate();
+    _fields._buttonChange = btn;
+    endUpdate(FieldButtonChange);
   }
 
   bool redisplayRequested() const {
-    return _redisplayRequested;
+    return _fields._redisplayRequested;
   }
 
   void requestRedisplay() {
     // A request is represented by a change in this value. The actual value doesn't matter.
-    AppState oldState(*this);
-    _redisplayRequested = !_redisplayRequested;
-    onUpdate(oldState);
+    beginUpdate();
+    _fields._redisplayRequested = !_fields._redisplayRequested;
+    endUpdate(FieldRedisplay);
   }
 
   void transmittedFrame(const uint32_t frameCounter) {
-    AppState oldState(*this);
-    _ttnFrameCounter = frameCounter;
-    _ttnLastSend = millis();
-    onUpdate(oldState);
+    beginUpdate();
+    _fields._ttnFrameCounter = frameCounter;
+    _fields._ttnLastSend = now();
+    endUpdate(FieldTtnFrame);
+  }
+
+  // Captures the persistent fields. seconds is the current real time, or 0 if
+  // unknown.
+  void snapshot(AppStateSnapshot &snapshot, const uint32_t seconds) const {
+    memset((void *)&snapshot, 0, sizeof(snapshot)); // Padding takes part in the CRC
+    snapshot._version = kAppStateSnapshotVersion;
+    snapshot._size = sizeof(snapshot);
+    snapshot._joined = _fields._joined;
+    snapshot._page = _fields._page;
+    snapshot._seconds = seconds;
+    snapshot._ttnFrameCounter = _fields._ttnFrameCounter;
+    snapshot._gpsSampleValidMs = gpsSampleValidMs();
+    snapshot._gpsSample = _fields._gpsSample;
+    snapshot._crc = snapshotCrc(snapshot);
+  }
+
+  // Applies a snapshot taken before a reset, in a single update. Returns false,
+  // leaving state untouched, if its version, size or CRC don't match.
+  // secondsNow is the current real time, or 0 if unknown, in which case any
+  // remaining GPS sample validity is discarded.
+  bool restore(const AppStateSnapshot &snapshot, const uint32_t secondsNow) {
+    if (snapshot._version!=kAppStateSnapshotVersion || snapshot._size!=sizeof(snapshot)
+        || snapshot._crc!=snapshotCrc(snapshot)) {
+      return false;
+    }
+    uint32_t validMs = 0;
+    if (snapshot._seconds!=0 && secondsNow>=snapshot._seconds) {
+      const uint32_t elapsedMs = (secondsNow - snapshot._seconds) * 1000;
+      if (elapsedMs < snapshot._gpsSampleValidMs) {
+        validMs = snapshot._gpsSampleValidMs - elapsedMs;
+      }
+    }
+    beginUpdate();
+    _fields._joined = snapshot._joined;
+    _fields._page = snapshot._page;
+    _fields._ttnFrameCounter = snapshot._ttnFrameCounter;
+    _fields._gpsSample = snapshot._gpsSample;
+    _fields._gpsSampleExpiry = validMs!=0 ? now() + validMs : 0;
+    endUpdate(FieldJoined | FieldPage | FieldTtnFrame | FieldGpsSample);
+    return true;
   }
 
   void dump(const Mode<AppState> &mainMode = ModeMain) const {
@@ -358,12 +687,14 @@ class AppState : public RespireState<AppState> {
     Log.Debug("- Joined [Input]:     %T\n", getJoined());
     Log.Debug("- GPS Power [Output]: %T\n", getGpsPower());
     Log.Debug("- GPS Fix [Input]:     %T\n", hasGpsFix());
+    Log.Debug("- Stationary [Input]: %T\n", isStationary());
+    Log.Debug("- GPS Search Over [Input]: %T\n", gpsSearchOver());
     Log.Debug("- GPS Location [Input]: %T\n", hasRecentGpsLocation());
-    Log.Debug("- GPS Expiry [Input]: %u\n", _gpsSampleExpiry);
-    Log.Debug("- TTN Frame Up [Input]: %u\n", _ttnFrameCounter);
-    Log.Debug("- TTN Last Send [Input]: %u\n", _ttnLastSend);
+    Log.Debug("- GPS Expiry [Input]: %u\n", _fields._gpsSampleExpiry);
+    Log.Debug("- TTN Frame Up [Input]: %u\n", _fields._ttnFrameCounter);
+    Log.Debug("- TTN Last Send [Input]: %u\n", _fields._ttnLastSend);
     Log.Debug("- Max Sleep [Calculated]: %u (where %u is a day)\n", mainMode.maxSleep(*this, DAYS_IN_MILLIS(1)), DAYS_IN_MILLIS(1));
-    _gpsSample.dump();
+    _fields._gpsSample.dump();
     mainMode.dump(*this);
     Log.Debug("AppState: ---------------- END\n");
   }
@@ -376,7 +707,7 @@ class AppState : public RespireState<AppState> {
   }
 
   virtual void didUpdate(const AppState &oldState, const Mode<AppState> &mainMode, const uint16_t holdLevel) {
-    dump(mainMode);
+    logStateChange(*this, oldState);
   }
 };
 
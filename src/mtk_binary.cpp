@@ -0,0 +1,87 @@
+#include "mtk_binary.h"
+
+static uint32_t readU32(const uint8_t *bytes) {
+  return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+NmeaResult MtkBinaryParser::end() {
+  const uint8_t *p = _payload;
+  const int32_t latitude = readU32(p + 0);
+  const int32_t longitude = readU32(p + 4);
+  const int32_t altitude = readU32(p + 8);
+  const int32_t speed = readU32(p + 12);  // cm/s
+  const int32_t course = readU32(p + 16);
+  const uint8_t satellites = p[20];
+  const uint8_t fixType = p[21];
+  const uint32_t date = readU32(p + 22);  // ddmmyy
+  const uint32_t time = readU32(p + 26);  // hhmmssmmm
+  const uint16_t hdop = p[30] | (p[31] << 8);
+
+  ++_packets;
+  _fix._latitude = latitude;
+  _fix._longitude = longitude;
+  _fix._altitude = altitude;
+  _fix._HDOP = hdop;
+  _fix._quality = fixType>=2 ? 1 : 0;
+  _fix._valid = fixType>=2;
+  _fix._satellites = satellites;
+  _fix._speed = speed>0 ? (uint32_t)speed * 3600 / 1852 : 0; // Knots * 100
+  _fix._course = course;
+  _fix._hour = time / 10000000;
+  _fix._minute = time / 100000 % 100;
+  _fix._seconds = time / 1000 % 100;
+  _fix._millis = time % 1000;
+  if (date!=0) {
+    _fix._day = date / 10000;
+    _fix._month = date / 100 % 100;
+    _fix._year = 2000 + date % 100;
+  }
+  return NmeaGga;
+}
+
+NmeaResult MtkBinaryParser::feed(char c) {
+  const uint8_t byte = c;
+  switch (_state) {
+    case Preamble1:
+      if (byte==kPreamble1) {
+        _state = Preamble2;
+      }
+      return NmeaNone;
+    case Preamble2:
+      _state = byte==kPreamble2 ? Length : byte==kPreamble1 ? Preamble2 : Preamble1;
+      return NmeaNone;
+    case Length:
+      if (byte!=kPayloadSize) {
+        _state = Preamble1;
+        ++_invalid;
+        return NmeaInvalid;
+      }
+      _ckA = _ckB = byte;
+      _received = 0;
+      _state = Payload;
+      return NmeaNone;
+    case Payload:
+      _payload[_received++] = byte;
+      _ckB += (_ckA += byte);
+      if (_received==kPayloadSize) {
+        _state = ChecksumA;
+      }
+      return NmeaNone;
+    case ChecksumA:
+      if (byte!=_ckA) {
+        _state = Preamble1;
+        ++_invalid;
+        return NmeaInvalid;
+      }
+      _state = ChecksumB;
+      return NmeaNone;
+    case ChecksumB:
+      _state = Preamble1;
+      if (byte!=_ckB) {
+        ++_invalid;
+        return NmeaInvalid;
+      }
+      return end();
+  }
+  return NmeaNone;
+}
@@ -0,0 +1,86 @@
+/*
+  MtkBinaryParser - Decoder for the binary position output of MTK modules
+  running the DIYDrones 1.9 firmware, selected in gps.cpp with GPS_BINARY.
+
+  Each fix is one 37 byte packet instead of ~150 bytes of RMC+GGA text:
+    0xD1 0xDD  length(32)  payload  ck_a ck_b
+  where the payload is little-endian
+    int32 latitude, longitude   degrees * 1e7
+    int32 altitude              centimeters
+    int32 speed                 cm/s
+    int32 course                degrees * 100
+    uint8 satellites, fix type  fix type 1: none, 2: 2D, 3: 3D
+    uint32 date                 ddmmyy
+    uint32 time                 hhmmssmmm
+    uint16 HDOP                 * 100
+  and ck_a/ck_b is an 8 bit Fletcher checksum over the length and payload.
+
+  The parser has NmeaParser's interface and fills the same NmeaFix, so
+  gps.cpp can use either. Every good packet reports as NmeaGga.
+ */
+
+#ifndef MTK_BINARY_H
+#define MTK_BINARY_H
+
+#include <stdint.h>
+#include "nmea.h"
+
+// Switches a DIYDrones-firmware MTK module from NMEA to binary output.
+#define MTK_SET_BINARY "PGCMD,16,0,0,0,0,0"
+
+class MtkBinaryParser {
+  public:
+  enum {
+    kPreamble1 = 0xD1,
+    kPreamble2 = 0xDD,
+    kPayloadSize = 32,
+  };
+
+  private:
+  enum State : uint8_t {
+    Preamble1,
+    Preamble2,
+    Length,
+    Payload,
+    ChecksumA,
+    ChecksumB,
+  };
+
+  State _state = Preamble1;
+  uint8_t _payload[kPayloadSize];
+  uint8_t _received = 0;
+  uint8_t _ckA = 0;
+  uint8_t _ckB = 0;
+  NmeaFix _fix;
+  uint32_t _packets = 0;
+  uint32_t _invalid = 0;
+
+  NmeaResult end();
+
+  public:
+  // Consumes one byte. Returns NmeaGga when it completes a good packet and
+  // NmeaInvalid when it completes a bad one.
+  NmeaResult feed(char c);
+
+  const NmeaFix &fix() const {
+    return _fix;
+  }
+
+  bool hasSample() const {
+    return _fix._year!=0 && _fix._quality!=0;
+  }
+
+  GpsSample sample() const {
+    return toGpsSample(_fix);
+  }
+
+  uint32_t sentences() const {
+    return _packets;
+  }
+
+  uint32_t invalid() const {
+    return _invalid;
+  }
+};
+
+#endif
@@ -0,0 +1,252 @@
+#include "nmea.h"
+
+static int8_t hexValue(char c) {
+  if (c>='0' && c<='9') return c - '0';
+  if (c>='A' && c<='F') return c - 'A' + 10;
+  if (c>='a' && c<='f') return c - 'a' + 10;
+  return -1;
+}
+
+size_t nmeaSentence(char *buffer, size_t size, const char *body) {
+  static const char kHex[] = "0123456789ABCDEF";
+  const size_t length = strlen(body);
+  if (length + 7 > size) {
+    return 0;
+  }
+  uint8_t sum = 0;
+  buffer[0] = '$';
+  for (size_t i = 0; i<length; ++i) {
+    buffer[1 + i] = body[i];
+    sum ^= body[i];
+  }
+  char *end = buffer + 1 + length;
+  *end++ = '*';
+  *end++ = kHex[sum >> 4];
+  *end++ = kHex[sum & 0xF];
+  *end++ = '\r';
+  *end++ = '\n';
+  *end = 0;
+  return end - buffer;
+}
+
+void NmeaParser::start() {
+  _state = Fields;
+  _type = TypeOther;
+  _length = 0;
+  _sum = 0;
+  _field = 0;
+  _number = 0;
+  _decimals = 0;
+  _point = false;
+  _negative = false;
+  _empty = true;
+  _char = 0;
+  memset(_address, 0, sizeof(_address));
+  _pending = NmeaFix();
+}
+
+// The current field as a number with `decimals` digits after the point,
+// truncating any finer digits. Saturates rather than overflowing on garbage.
+int32_t NmeaParser::scaled(uint8_t decimals) const {
+  int64_t value = _number;
+  for (uint8_t d = _decimals; d<decimals; ++d) {
+    value *= 10;
+  }
+  for (uint8_t d = decimals; d<_decimals; ++d) {
+    value /= 10;
+  }
+  if (value > INT32_MAX) {
+    value = INT32_MAX;
+  }
+  return _negative ? -(int32_t)value : (int32_t)value;
+}
+
+// The current field, a (d)ddmm.mmmmm coordinate, in degrees * 1e7.
+int32_t NmeaParser::degrees() const {
+  const int32_t value = scaled(5);
+  const int32_t whole = value / 10000000;
+  const int32_t minutes = value % 10000000; // Minutes * 1e5
+  if (whole > 180 || whole < -180) {
+    return INT32_MAX; // Garbage; a checksum failure will discard it
+  }
+  return whole * 10000000 + (minutes * 10 + 3) / 6;
+}
+
+void NmeaParser::endField() {
+  if (_field==0) {
+    if (memcmp(_address + 2, "GGA", 3)==0) {
+      _type = TypeGga;
+    }
+    else if (memcmp(_address + 2, "RMC", 3)==0) {
+      _type = TypeRmc;
+    }
+    return;
+  }
+  if (_empty) {
+    return; // Leave the zero from start()
+  }
+
+  // Field 1, the UTC time hhmmss.sss, is common to both
+  if (_field==1 && _type!=TypeOther) {
+    const int32_t time = scaled(0);
+    _pending._hour = time / 10000;
+    _pending._minute = time / 100 % 100;
+    _pending._seconds = time % 100;
+    _pending._millis = scaled(3) % 1000;
+    return;
+  }
+
+  if (_type==TypeGga) {
+    switch (_field) {
+      case 2: _pending._latitude = degrees(); break;
+      case 3: if (_char=='S') _pending._latitude = -_pending._latitude; break;
+      case 4: _pending._longitude = degrees(); break;
+      case 5: if (_char=='W') _pending._longitude = -_pending._longitude; break;
+      case 6: _pending._quality = scaled(0); break;
+      case 7: _pending._satellites = scaled(0); break;
+      case 8: _pending._HDOP = scaled(2); break;
+      case 9: _pending._altitude = scaled(2); break;
+    }
+  }
+  else if (_type==TypeRmc) {
+    switch (_field) {
+      case 2: _pending._valid = _char=='A'; break;
+      case 7: _pending._speed = scaled(2); break;
+      case 8: _pending._course = scaled(2); break;
+      case 9: {
+        const int32_t date = scaled(0); // ddmmyy
+        _pending._day = date / 10000;
+        _pending._month = date / 100 % 100;
+        _pending._year = 2000 + date % 100;
+        break;
+      }
+    }
+  }
+}
+
+NmeaResult NmeaParser::end() {
+  _state = Idle;
+  if (_expected!=_sum) {
+    ++_invalid;
+    return NmeaInvalid;
+  }
+  ++_sentences;
+  switch (_type) {
+    case TypeGga:
+      _fix._latitude = _pending._latitude;
+      _fix._longitude = _pending._longitude;
+      _fix._altitude = _pending._altitude;
+      _fix._HDOP = _pending._HDOP;
+      _fix._quality = _pending._quality;
+      _fix._satellites = _pending._satellites;
+      break;
+    case TypeRmc:
+      _fix._year = _pending._year;
+      _fix._month = _pending._month;
+      _fix._day = _pending._day;
+      _fix._valid = _pending._valid;
+      _fix._speed = _pending._speed;
+      _fix._course = _pending._course;
+      break;
+    default:
+      return NmeaOther;
+  }
+  _fix._hour = _pending._hour;
+  _fix._minute = _pending._minute;
+  _fix._seconds = _pending._seconds;
+  _fix._millis = _pending._millis;
+  return _type==TypeGga ? NmeaGga : NmeaRmc;
+}
+
+NmeaResult NmeaParser::feed(char c) {
+  if (c=='$') {
+    // A '$' mid-sentence means the rest of that sentence was lost
+    const bool interrupted = _state!=Idle;
+    start();
+    if (interrupted) {
+      ++_invalid;
+      return NmeaInvalid;
+    }
+    return NmeaNone;
+  }
+  if (_state==Idle) {
+    return NmeaNone;
+  }
+  if (++_length > kMaxSentence) {
+    _state = Idle;
+    ++_invalid;
+    return NmeaInvalid;
+  }
+
+  if (_state==Checksum) {
+    const int8_t value = hexValue(c);
+    if (value<0) {
+      _state = Idle;
+      ++_invalid;
+      return NmeaInvalid;
+    }
+    _expected = (_expected << 4) | value;
+    return ++_digits==2 ? end() : NmeaNone;
+  }
+
+  switch (c) {
+    case '*':
+      endField();
+      _state = Checksum;
+      _expected = 0;
+      _digits = 0;
+      return NmeaNone;
+    case '\r':
+    case '\n':
+      // Line ended without a checksum
+      _state = Idle;
+      ++_invalid;
+      return NmeaInvalid;
+    case ',':
+      _sum ^= c;
+      endField();
+      ++_field;
+      _number = 0;
+      _decimals = 0;
+      _point = false;
+      _negative = false;
+      _empty = true;
+      _char = 0;
+      return NmeaNone;
+  }
+
+  _sum ^= c;
+  if (_field==0) {
+    if (_length<=sizeof(_address)) {
+      _address[_length - 1] = c;
+    }
+    return NmeaNone;
+  }
+  if (_empty) {
+    _char = c;
+    _empty = false;
+  }
+  if (c>='0' && c<='9') {
+    if (_point && _decimals>=kMaxDecimals) {
+      return NmeaNone;
+    }
+    if (_number <= (INT32_MAX - 9) / 10) {
+      _number = _number * 10 + (c - '0');
+      if (_point) {
+        ++_decimals;
+      }
+    }
+  }
+  else if (c=='.') {
+    _point = true;
+  }
+  else if (c=='-') {
+    _negative = true;
+  }
+  return NmeaNone;
+}
+
+GpsSample toGpsSample(const NmeaFix &fix) {
+  return GpsSample(fix._latitude, fix._longitude, fix._altitude, fix._HDOP,
+    fix._year, fix._month, fix._day, fix._hour, fix._minute, fix._seconds, fix._millis);
+}
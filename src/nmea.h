@@ -0,0 +1,133 @@
+/*
+  NmeaParser - Incremental NMEA 0183 parser for the GPS byte stream.
+
+  Bytes are fed one at a time as they come off the UART ring; there is no line
+  buffer. Each field is decoded into integers as its characters arrive, and
+  the XOR checksum is accumulated alongside. Only GGA and RMC sentences (from
+  any talker: GP, GN, GL...) are decoded; others are checked and skipped. A
+  sentence's values become visible in fix() only once its checksum matches, so
+  a corrupted sentence never leaves a half-updated fix.
+
+  Values are fixed point: degrees * 1e7, centimeters, HDOP * 100, knots * 100.
+ */
+
+#ifndef NMEA_H
+#define NMEA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "mm_state.h"
+
+// Result of NmeaParser::feed
+enum NmeaResult {
+  NmeaNone = 0,       // Mid-sentence, or between sentences
+  NmeaGga,            // A GGA sentence was decoded into fix()
+  NmeaRmc,            // An RMC sentence was decoded into fix()
+  NmeaOther,          // A valid sentence of another type ended
+  NmeaInvalid,        // A sentence failed its checksum, had none, or ran too long
+};
+
+typedef struct NmeaFix {
+  // From GGA
+  int32_t _latitude = 0;      // Degrees * 1e7, north positive
+  int32_t _longitude = 0;     // Degrees * 1e7, east positive
+  int32_t _altitude = 0;      // Centimeters above mean sea level
+  uint16_t _HDOP = 0;         // HDOP * 100
+  uint8_t _quality = 0;       // 0: no fix, 1: GPS, 2: DGPS...
+  uint8_t _satellites = 0;
+  // From either; the time of the most recent sentence
+  uint8_t _hour = 0, _minute = 0, _seconds = 0;
+  uint16_t _millis = 0;
+  // From RMC
+  uint16_t _year = 0;         // 0 until an RMC has been seen
+  uint8_t _month = 0, _day = 0;
+  bool _valid = false;        // RMC status 'A'
+  uint16_t _speed = 0;        // Knots * 100
+  uint16_t _course = 0;       // Degrees * 100
+} NmeaFix;
+
+GpsSample toGpsSample(const NmeaFix &fix);
+
+// Formats body, e.g. "PMTK220,1000", as a sentence: "$PMTK220,1000*1F\r\n".
+// Returns the length, or 0 if it doesn't fit in size.
+size_t nmeaSentence(char *buffer, size_t size, const char *body);
+
+class NmeaParser {
+  enum {
+    kMaxSentence = 90,        // NMEA allows 82 including $ and CRLF
+    kMaxDecimals = 5,         // Finer fractions are ignored
+  };
+
+  enum State : uint8_t {
+    Idle,                     // Waiting for '$'
+    Address,                  // Talker and sentence type
+    Fields,
+    Checksum,
+  };
+
+  enum Type : uint8_t {
+    TypeOther,
+    TypeGga,
+    TypeRmc,
+  };
+
+  State _state = Idle;
+  Type _type = TypeOther;
+  uint8_t _length = 0;        // Characters since '$'
+  uint8_t _sum = 0;           // XOR of characters between '$' and '*'
+  uint8_t _expected = 0;      // Checksum digits as received
+  uint8_t _digits = 0;        // Checksum digits received
+  char _address[5];
+  uint8_t _field = 0;         // Index of the current field; the address is 0
+
+  // Current field
+  int32_t _number = 0;        // Digits so far, ignoring the decimal point
+  uint8_t _decimals = 0;      // Digits after the decimal point
+  bool _point = false;
+  bool _negative = false;
+  bool _empty = true;
+  char _char = 0;             // First character, for N/S/E/W and A/V fields
+
+  // Decoded so far from the current sentence, committed on a good checksum
+  NmeaFix _pending;
+  NmeaFix _fix;
+
+  uint32_t _sentences = 0;
+  uint32_t _invalid = 0;
+
+  void start();
+  void endField();
+  NmeaResult end();
+  int32_t scaled(uint8_t decimals) const;
+  int32_t degrees() const;
+
+  public:
+  // Consumes one byte. Returns what, if anything, the byte completed.
+  NmeaResult feed(char c);
+
+  // Values of the last good GGA and RMC sentences.
+  const NmeaFix &fix() const {
+    return _fix;
+  }
+
+  // Whether the fix has a position and a date, so sample() is meaningful.
+  bool hasSample() const {
+    return _fix._year!=0 && _fix._quality!=0;
+  }
+
+  GpsSample sample() const {
+    return toGpsSample(_fix);
+  }
+
+  // Sentences that ended with a good checksum.
+  uint32_t sentences() const {
+    return _sentences;
+  }
+
+  // Sentences rejected for checksum, missing checksum or length.
+  uint32_t invalid() const {
+    return _invalid;
+  }
+};
+
+#endif
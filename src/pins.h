@@ -0,0 +1,21 @@
+/*
+  Pin mapping of the Feather M0 LoRa board and its wings, shared by the sketch,
+  ui.cpp, gps.cpp and sleep.cpp.
+ */
+
+#ifndef PINS_H
+#define PINS_H
+
+#include <Arduino.h>
+
+#define VBATPIN A7  // Battery divider, shared with button A (see uiReadSharedVbatPin())
+#define VUSBPIN A1
+
+#define BUTTON_A_PIN 9
+#define BUTTON_B_PIN 6
+#define BUTTON_C_PIN 5
+
+#define GPS_FIX_PIN 18
+#define GPS_ENABLE_PIN 19
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef UNIT_TEST
+
+#include <Arduino.h>
+#include <ArduinoLowPower.h>
+#include <Logging.h>
+
+#include "sleep.h"
+#include "pins.h"
+
+static void (*sleepWakeFn)(void) = NULL;
+
+// USB plugged or unplugged. VUSBPIN is also read through the ADC, and each
+// analogRead() muxes it away from the EIC, so this is redone before every
+// standby rather than once.
+static void sleepAttachUsbWakeup() {
+  pinMode(VUSBPIN, INPUT);
+  LowPower.attachInterruptWakeup(VUSBPIN, sleepWakeFn, CHANGE);
+}
+
+void sleepSetup(void (*wakeFn)(void)) {
+  sleepWakeFn = wakeFn;
+  sleepAttachUsbWakeup();
+  LowPower.attachInterruptWakeup(BUTTON_B_PIN, wakeFn, FALLING);
+  LowPower.attachInterruptWakeup(BUTTON_C_PIN, wakeFn, FALLING);
+  // Button A shares its pin with the battery divider, so it cannot wake us.
+  // The GPS fix pin belongs to gps.cpp's own interrupt, and we never stand by
+  // with the GPS powered (see AppState::sleepInterval()).
+}
+
+void sleepFor(uint32_t ms, SleepClock &clock, uint32_t (*secondsNow)(void)) {
+  // millis() does not advance in standby, so measure with the external RTC.
+  Log.Debug("Standby for up to %ums\n", ms);
+  Serial.flush();
+  clock.sleeping(secondsNow());
+  sleepAttachUsbWakeup();
+  LowPower.sleep(ms); // Standby until the RTC alarm or a wake interrupt
+  const uint32_t slept = clock.woke(secondsNow(), ms);
+  Log.Debug("Woke after %ums\n", slept);
+}
+
+#endif
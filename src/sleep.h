@@ -0,0 +1,55 @@
+#ifndef SLEEP_H
+#define SLEEP_H
+
+#include <Arduino.h>
+#include "respire.h"
+
+// Respire clock that keeps counting while the MCU is in standby, when millis() stops.
+//
+// Standby is timed against one RTC reading paired with this clock's time
+// (the anchor) rather than from readings either side of each sleep. The RTC
+// only counts whole seconds, so per-sleep readings drift up to 1s each time;
+// against the anchor the error stays under 1s however many times we sleep.
+class SleepClock : public Clock {
+  uint32_t _slept = 0;
+  bool _anchored = false;
+  uint32_t _anchorSeconds = 0; // RTC time ...
+  uint32_t _anchorMillis = 0;  // ... and this clock's time when it was read
+
+  public:
+  virtual uint32_t millis() {
+    return ::millis() + _slept;
+  }
+
+  // Called before standby with the RTC time.
+  void sleeping(uint32_t rtcSeconds) {
+    if (!_anchored) {
+      _anchored = true;
+      _anchorSeconds = rtcSeconds;
+      _anchorMillis = millis();
+    }
+  }
+
+  // Called after a standby of at most maxMs with the RTC time, and returns
+  // how far the clock moved. A wake within the second the RTC last showed
+  // doesn't move it. Rounding before and after can add at most 2s to maxMs,
+  // so more than that means the RTC was set and the anchor starts again here.
+  uint32_t woke(uint32_t rtcSeconds, uint32_t maxMs) {
+    const uint32_t now = millis();
+    const int32_t ahead = (int32_t)(_anchorMillis + 1000 * (rtcSeconds - _anchorSeconds) - now);
+    uint32_t ms = ahead > 0 ? ahead : 0;
+    if (ms > maxMs + 2000) {
+      ms = maxMs;
+      _anchorSeconds = rtcSeconds;
+      _anchorMillis = now + ms;
+    }
+    _slept += ms;
+    return ms;
+  }
+};
+
+void sleepSetup(void (*wakeFn)(void));
+// Stands by for up to ms, advancing clock by the time spent.
+void sleepFor(uint32_t ms, SleepClock &clock, uint32_t (*secondsNow)(void));
+
+#endif
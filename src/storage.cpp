@@ -6,15 +6,19 @@
 #include <ParameterStore.h>
 #include <Logging.h>
 #include "mm_state.h"
+#include "journal.h"
 
 #define SD_CARD_CS 10
 
 extern AppState gState;
-extern RespireContext<AppState> gRespire;
+extern JournalingContext gRespire;
 extern ParameterStore gParameters;
 static bool gSDAvailable = false;
 
 static const char *kParamFile = "params.ini";
+static const char *kJournalFile = "journal.bin";
+static const char *kJournalOldFile = "journal.old";
+static const uint32_t kJournalMaxBytes = 1024UL * 1024; // Per file; one older file is kept
 
 // Here's some sample code not used in the current system. If necessary, we could configure SDFat to use SPI based on SERCOM3 on pins 11-13.
 // https://learn.adafruit.com/using-atsamd21-sercom-to-add-more-spi-i2c-serial-ports/creating-a-new-spi
@@ -137,11 +141,16 @@ void writeLocation(const AppState &state, const AppState &oldState, Mode<AppStat
   else {
     strcpy(devAddrStr, "00000000");
   }
+  char latitude[16], longitude[16], altitude[16], hdop[8];
+  formatFixedPoint(latitude, gps._latitude, 7);
+  formatFixedPoint(longitude, gps._longitude, 7);
+  formatFixedPoint(altitude, gps._altitude, 2);
+  formatFixedPoint(hdop, gps._HDOP, 2);
   char dataString[300];
-  sprintf(dataString, "%04d-%02d-%02d,\"%02d:%02d:%02d.%03d\",%f,%f,%f,%f,%f,%s,%ld,%s",
+  sprintf(dataString, "%04d-%02d-%02d,\"%02d:%02d:%02d.%03d\",%s,%s,%s,%s,%f,%s,%ld,%s",
         (int)gps._year, (int)gps._month, (int)gps._day,
         (int)gps._hour, (int)gps._minute, (int)gps._seconds, (int)gps._millis,
-        gps._latitude, gps._longitude, gps._altitude, gps._HDOP,
+        latitude, longitude, altitude, hdop,
         state.batteryVolts(), (state.getUsbPower() ? "'USB'" : "'BAT'"),
         state.ttnFrameCounter(), devAddrStr);
 
@@ -166,6 +175,35 @@ void writeLocation(const AppState &state, const AppState &oldState, Mode<AppStat
   gRespire.complete(triggeringMode);
 }
 
+void appendJournalToSD(const uint8_t *bytes, uint16_t size) {
+  if (!gSDAvailable) {
+    return;
+  }
+  File file = SD.open(kJournalFile, FILE_WRITE); // Appends
+  if (!file) {
+    Log.Error("Error opening %s\n", kJournalFile);
+    return;
+  }
+  if (file.size() + size > kJournalMaxBytes) {
+    // Rotate at a flush boundary, so journal.old followed by journal.bin is
+    // still one record stream for the replayer.
+    file.close();
+    SD.remove(kJournalOldFile);
+    if (!SD.rename(kJournalFile, kJournalOldFile)) {
+      Log.Error("Error rotating %s\n", kJournalFile);
+    }
+    file = SD.open(kJournalFile, FILE_WRITE);
+    if (!file) {
+      Log.Error("Error opening %s\n", kJournalFile);
+      return;
+    }
+  }
+  if (file.write(bytes, size)!=size) {
+    Log.Error("Short write to %s\n", kJournalFile);
+  }
+  file.close();
+}
+
 void storageSetup() {
   if (!SD.begin(SD_CARD_CS, SPISettings(1000000, MSBFIRST, SPI_MODE0))) {
     Log.Error("Card failed or not present\n");
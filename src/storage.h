@@ -6,4 +6,8 @@ bool readParametersFromSD(ParameterStore &pstore);
 bool writeParametersToSD(ParameterStore &pstore);
 void writeLocation(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode);
 
+// Appends journal records (see journal.h) to journal.bin. Past 1MB it becomes
+// journal.old, replacing the previous one, and journal.bin starts again.
+void appendJournalToSD(const uint8_t *bytes, uint16_t size);
+
 void storageSetup();
\ No newline at end of file
@@ -11,19 +11,18 @@
 #include <Adafruit_SSD1306.h>
 #include <Adafruit_FeatherOLED.h>
 #include <mm_state.h>
+#include "journal.h"
 #include <ParameterStore.h>
+#include "pins.h"
 
 extern AppState gState;
-extern RespireContext<AppState> gRespire;
+extern JournalingContext gRespire;
 extern ParameterStore gParameters;
 
 static Adafruit_FeatherOLED gDisplay;
 static bool gRequestDisplay = false; // Request display flag. Set it and next loop we will request redisplay.
 
 #define BUTTON_TIMER_PERIOD_MICROSECONDS 2000
-#define BUTTON_A_PIN 9
-#define BUTTON_B_PIN 6
-#define BUTTON_C_PIN 5
 
 static volatile bool gButtonA = false;
 static volatile bool gButtonB = false;
@@ -102,6 +101,7 @@ void uiSetup() {
 }
 
 void uiLoop() {
+  AppState::Batch batch(gState); // Button edges and redisplay request evaluate together
   gState.buttonPage(gButtonA);
   gState.buttonField(gButtonB);
   gState.buttonChange(gButtonC);
@@ -125,6 +125,7 @@ class Field {
   const size_t _psize;
   FormatFn _formatter;
   RespireState<AppState>::ListenerFn _listener = NULL;
+  FieldMask _listenerFields = 0;
 
   char hexFormat(uint8_t hex) {
     hex &= 0x0F;
@@ -169,8 +170,8 @@ class Field {
 
   public:
 
-  Field(const char * const pname, FormatFn formatter, RespireState<AppState>::ListenerFn listener = NULL)
-  : _pname(pname), _psize(0), _formatter(formatter), _listener(listener) {
+  Field(const char * const pname, FormatFn formatter, RespireState<AppState>::ListenerFn listener = NULL, FieldMask listenerFields = kAllFields)
+  : _pname(pname), _psize(0), _formatter(formatter), _listener(listener), _listenerFields(listenerFields) {
   }
 
   Field(const char * const pname, const size_t psize)
@@ -183,7 +184,7 @@ class Field {
 
   void display(const AppState &state) {
     if (_listener) {
-      gState.setListener(_listener);
+      gState.setListener(_listener, _listenerFields);
     }
 
     gDisplay.setTextSize(2);
@@ -204,6 +205,12 @@ class Field {
   }
 };
 
+// value / divisor, rounded half away from zero, for showing fixed point at
+// lower precision.
+static int32_t roundedDivide(int32_t value, int32_t divisor) {
+  return (value<0 ? value - divisor / 2 : value + divisor / 2) / divisor;
+}
+
 Field gStatusFields[] = {
   Field("Power", [](char *value, const AppState &state) {
     if (state.getUsbPower()) {
@@ -217,7 +224,7 @@ Field gStatusFields[] = {
         || !FLOAT_SAME(state.batteryVolts(), oldState.batteryVolts(), 0.05)) {
       gRequestDisplay = true;
     }
-  }),
+  }, FieldUsbPower | FieldBatteryVolts),
   Field("GPS Power", [](char *value, const AppState &state) {
     strcpy(value, state.getGpsPower() ? "Yes" : "No");
   }),
@@ -227,7 +234,7 @@ Field gStatusFields[] = {
     if (state.hasGpsFix()!=oldState.hasGpsFix()) {
       gRequestDisplay = true;
     }
-  }),
+  }, FieldGpsFix),
   Field("GPS Date", [](char *value, const AppState &state) {
     const GpsSample &gpsSample = state.gpsSample();
     sprintf(value, "%04d/%02d/%02d", gpsSample._year, gpsSample._month, gpsSample._day);
@@ -238,11 +245,15 @@ Field gStatusFields[] = {
   }),
   Field("GPS Lt/Ln", [](char *value, const AppState &state) {
     const GpsSample &gpsSample = state.gpsSample();
-    sprintf(value, "%2.1f/%2.1f", gpsSample._latitude, gpsSample._longitude);
+    const size_t length = formatFixedPoint(value, roundedDivide(gpsSample._latitude, 1000000), 1);
+    value[length] = '/';
+    formatFixedPoint(value + length + 1, roundedDivide(gpsSample._longitude, 1000000), 1);
   }),
   Field("GPS Alt/H", [](char *value, const AppState &state) {
     const GpsSample &gpsSample = state.gpsSample();
-    sprintf(value, "%3.1f,%1.1f", gpsSample._altitude, gpsSample._HDOP);
+    const size_t length = formatFixedPoint(value, roundedDivide(gpsSample._altitude, 10), 1);
+    value[length] = ',';
+    formatFixedPoint(value + length + 1, roundedDivide(gpsSample._HDOP, 10), 1);
   }),
   Field("TTN Join", [](char *value, const AppState &state) {
     strcpy(value, state.getJoined() ? "Yes" : "No");
@@ -0,0 +1,43 @@
+/*
+  Heap allocation counter for native builds (unit tests, tools).
+
+  Replaces the global operator new/delete with versions that count calls, so
+  a test can assert that a code path performs no allocation. Include exactly
+  once per program.
+ */
+
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <cstdlib>
+#include <new>
+
+static uint32_t gAllocCount = 0;
+
+// Number of allocations made so far by operator new.
+uint32_t allocCount() {
+  return gAllocCount;
+}
+
+void *operator new(size_t size) {
+  ++gAllocCount;
+  void *p = malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+void operator delete[](void *p) noexcept {
+  free(p);
+}
+
+#endif
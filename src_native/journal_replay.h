@@ -0,0 +1,265 @@
+/*
+  JournalReplay - Replays a device journal (see src/journal.h) against the
+  mode tree. Used by tools/replay and the tests.
+
+  Every run in the journal starts from its boot record: a fresh AppState gets
+  the recorded snapshot and inputs, and RespireContext::init() gets the real
+  time and store values the device's init() had, so Modes resume with the
+  per-Mode state a warm boot restored. Inputs and completions are then applied
+  at their recorded times. Between records the clock jumps from one Respire
+  deadline to the next, so a day's trace replays in well under a second.
+  Actions are not run; their completions come from the journal.
+
+  At each checkpoint the replayed set of active Modes is compared with the
+  recorded one, and differences are counted as divergences. A gap record
+  (records lost on the device) ends the run; what follows is skipped up to
+  the next boot.
+
+  Native only.
+ */
+
+#ifndef JOURNAL_REPLAY_H
+#define JOURNAL_REPLAY_H
+
+#include <cstring>
+#include <vector>
+#include "journal.h"
+
+class JournalReplayClock : public Clock {
+  uint32_t _millis = 0;
+
+  public:
+  virtual uint32_t millis() {
+    return _millis;
+  }
+
+  void set(uint32_t ms) {
+    _millis = ms;
+  }
+};
+
+class JournalReplayExecutor : public Executor<AppState> {
+  public:
+  virtual void exec(Mode<AppState>::ActionFn fn, const AppState &state, const AppState &oldState, Mode<AppState> *trigger) {
+  }
+};
+
+// Serves the values a JournalingStore recorded back to RespireContext::init().
+// Payloads point into the journal, which must outlive the store.
+class JournalReplayStore : public RespireStore {
+  std::vector<const uint8_t *> _loads;  // JournalStoreLoad payloads
+  std::vector<uint16_t> _sizes;
+
+  bool find(const char *name, void *value, uint16_t size) {
+    for (size_t i = 0; i<_loads.size(); ++i) {
+      const uint16_t nameSize = strlen((const char *)_loads[i]) + 1;
+      if (strcmp((const char *)_loads[i], name)==0 && _sizes[i]==nameSize + size) {
+        memcpy(value, _loads[i] + nameSize, size);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  public:
+  void add(const JournalRecord &record, const uint8_t *payload) {
+    if (record._kind==JournalStoreLoad && memchr(payload, 0, record._value)!=NULL) {
+      _loads.push_back(payload);
+      _sizes.push_back(record._value);
+    }
+  }
+
+  void clear() {
+    _loads.clear();
+    _sizes.clear();
+  }
+
+  virtual void beginTransaction() {
+  }
+
+  virtual void endTransaction() {
+  }
+
+  virtual bool load(const char *name, uint8_t *bytes, const uint16_t size) {
+    return find(name, bytes, size);
+  }
+
+  virtual bool load(const char *name, uint32_t *value) {
+    return find(name, value, sizeof(*value));
+  }
+
+  // The replay doesn't persist anything.
+  virtual bool store(const char *name, const uint8_t *bytes, const uint16_t size) {
+    return true;
+  }
+
+  virtual bool store(const char *name, const uint32_t value) {
+    return true;
+  }
+};
+
+enum {
+  kJournalReplayMinStep = 1000,     // Step taken while Respire reports no slack
+};
+
+// One run of the device, from a boot record to the next.
+class JournalReplayRun {
+  Mode<AppState> &_root;
+  AppState _state;
+  JournalReplayClock _clock;
+  JournalReplayExecutor _executor;
+  RespireContext<AppState> _respire;
+
+  public:
+  JournalReplayRun(Mode<AppState> &root, uint32_t realTime, JournalReplayStore &store, const JournalRecord &boot, const uint8_t *payload)
+  : _root(root),
+    _respire(_state, root, &_clock, &_executor) {
+    _clock.set(boot._millis);
+    _state.setClock(&_clock);
+    _respire.init(realTime, &store);
+    AppStateSnapshot snapshot;
+    memcpy((void *)&snapshot, payload, sizeof(snapshot));
+    _state.restore(snapshot, 0);
+    applyInputs(_state, kInputFields, boot._value32);
+    _respire.begin();
+  }
+
+  // Runs Respire up to ms, stopping at each deadline on the way.
+  void advanceTo(uint32_t ms) {
+    while (_clock.millis() < ms) {
+      uint32_t step = _root.maxSleep(_state, ms - _clock.millis());
+      if (step==0) {
+        step = kJournalReplayMinStep;
+      }
+      _clock.set((ms - _clock.millis()) < step ? ms : _clock.millis() + step);
+      _respire.loop();
+    }
+  }
+
+  void apply(const JournalRecord &record, const uint8_t *payload) {
+    advanceTo(record._millis);
+    switch (record._kind) {
+      case JournalInputs:
+        applyInputs(_state, record._value, record._value32);
+        break;
+      case JournalComplete:
+        applyJournalComplete(_respire, record, payload);
+        break;
+      case JournalActiveModes:
+        _respire.loop();
+        break;
+    }
+  }
+
+  const AppState &state() const {
+    return _state;
+  }
+};
+
+typedef struct JournalReplayStats {
+  uint32_t records = 0;
+  uint32_t boots = 0;
+  uint32_t checkpoints = 0;
+  uint32_t divergences = 0;
+  uint32_t gaps = 0;
+  uint32_t skipped = 0;             // Records outside any run
+  uint64_t replayedMillis = 0;
+  size_t consumed = 0;              // Bytes of whole records; the rest was truncated
+} JournalReplayStats;
+
+class JournalReplay {
+  public:
+  // Called at a checkpoint where the replay's active Modes differ from the device's.
+  typedef void (*DivergenceFn)(const JournalRecord &checkpoint, uint32_t replayed, uint32_t run, void *context);
+
+  private:
+  Mode<AppState> &_root;
+  JournalReplayRun *_run = NULL;
+  JournalReplayStore _store;
+  uint32_t _realTime = 0;
+  uint32_t _runStart = 0;
+  uint32_t _lastMillis = 0;
+  JournalReplayStats _stats;
+
+  void endRun() {
+    _stats.replayedMillis += _lastMillis - _runStart;
+    _runStart = _lastMillis;
+    delete _run;
+    _run = NULL;
+  }
+
+  public:
+  JournalReplay(Mode<AppState> &root = ModeMain)
+  : _root(root) {
+  }
+
+  ~JournalReplay() {
+    delete _run;
+  }
+
+  // Replays a whole journal. Stops at a record cut short by a reset mid-write.
+  const JournalReplayStats &replay(const uint8_t *bytes, size_t size, DivergenceFn onDivergence = NULL, void *context = NULL) {
+    size_t offset = 0;
+    while (offset + sizeof(JournalRecord) <= size) {
+      JournalRecord record;
+      memcpy(&record, bytes + offset, sizeof(record));
+      const uint16_t payloadSize = journalPayloadSize(record);
+      if (offset + sizeof(record) + payloadSize > size) {
+        break;
+      }
+      const uint8_t *payload = bytes + offset + sizeof(record);
+      offset += sizeof(record) + payloadSize;
+      ++_stats.records;
+
+      switch (record._kind) {
+        case JournalRespireInit:
+          _realTime = record._value32;
+          _store.clear();
+          continue;
+        case JournalStoreLoad:
+          _store.add(record, payload);
+          continue;
+        case JournalBoot:
+          endRun();
+          _run = new JournalReplayRun(_root, _realTime, _store, record, payload);
+          _store.clear();
+          _realTime = 0;
+          _runStart = _lastMillis = record._millis;
+          ++_stats.boots;
+          continue;
+        case JournalGap:
+          // Records were lost, so the run can't be followed to its next boot
+          ++_stats.gaps;
+          endRun();
+          continue;
+      }
+      if (_run==NULL) {
+        ++_stats.skipped;
+        continue;
+      }
+      _run->apply(record, payload);
+      _lastMillis = record._millis;
+      if (record._kind==JournalActiveModes) {
+        ++_stats.checkpoints;
+        const uint32_t replayed = activeModes(_run->state());
+        if (replayed!=record._value32) {
+          ++_stats.divergences;
+          if (onDivergence!=NULL) {
+            onDivergence(record, replayed, _stats.boots, context);
+          }
+        }
+      }
+    }
+    _stats.replayedMillis += _lastMillis - _runStart;
+    _runStart = _lastMillis;
+    _stats.consumed = offset;
+    return _stats;
+  }
+
+  // State of the run in progress, or NULL between runs.
+  const AppState *state() const {
+    return _run!=NULL ? &_run->state() : NULL;
+  }
+};
+
+#endif
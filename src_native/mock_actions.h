@@ -0,0 +1,87 @@
+/*
+  Mock actions for native builds (unit tests, tools).
+
+  The mode tree in mm_state.cpp references the action functions that
+  ManhattanMapper.ino implements against real hardware. Native programs
+  include this file exactly once to satisfy those references.
+ */
+
+#ifndef MOCK_ACTIONS_H
+#define MOCK_ACTIONS_H
+
+#ifdef MOCK_ACTIONS
+
+// The first calls made to the mock actions since mockCallsReset(), for tests
+// that check when and in what order actions run.
+static Mode<AppState>::ActionFn gMockCalls[16];
+static uint8_t gMockCallCount = 0;
+
+static void mockCallsReset() {
+  gMockCallCount = 0;
+}
+
+static void mockCalled(Mode<AppState>::ActionFn fn) {
+  if (gMockCallCount < sizeof(gMockCalls) / sizeof(gMockCalls[0])) {
+    gMockCalls[gMockCallCount++] = fn;
+  }
+}
+
+uint8_t fieldCountForPage(const AppState &state, uint8_t page) {
+  return 1; // Never 0: updateDerivedState takes the field index modulo this
+}
+
+void changeGpsPower(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
+  mockCalled(changeGpsPower);
+  // Reify GpsPower value
+}
+
+void readGpsLocation(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
+  mockCalled(readGpsLocation);
+}
+
+void attemptJoin(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
+  mockCalled(attemptJoin);
+  // Enter the AttempJoin state, which is to say, call lorawan.join()
+}
+
+void changeSleep(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
+  mockCalled(changeSleep);
+  // Enter or exit Sleep state
+}
+
+void writeLocation(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
+  mockCalled(writeLocation);
+}
+
+void sendLocation(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
+  mockCalled(sendLocation);
+  // Send location
+}
+
+void sendLocationAck(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
+  mockCalled(sendLocationAck);
+  // Send location
+}
+
+void displayBlank(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
+  mockCalled(displayBlank);
+  Log.Debug("Test displayBlank\n");
+}
+
+void displayStatus(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
+  mockCalled(displayStatus);
+  Log.Debug("Test displayStatus\n");
+}
+
+void displayParameters(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
+  mockCalled(displayParameters);
+  Log.Debug("Test displayParameters\n");
+}
+
+void displayErrors(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
+  mockCalled(displayErrors);
+  Log.Debug("Test displayErrors\n");
+}
+
+#endif
+#endif
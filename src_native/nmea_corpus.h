@@ -0,0 +1,92 @@
+/*
+  NMEA corpora for the native tools: a generated hour of 1Hz RMC+GGA, or
+  the lines of a capture from the device (GPSECHO, or a logic analyser on the
+  UART).
+
+  Native only.
+ */
+
+#ifndef NMEA_CORPUS_H
+#define NMEA_CORPUS_H
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+inline uint32_t nextRandom(uint32_t &state) {
+  // xorshift32
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+inline uint8_t checksum(const char *begin, const char *end) {
+  uint8_t sum = 0;
+  for (const char *c = begin; c<end; ++c) {
+    sum ^= *c;
+  }
+  return sum;
+}
+
+inline std::string sentence(const char *body) {
+  char text[100];
+  snprintf(text, sizeof(text), "$%s*%02X\r\n", body, checksum(body, body + strlen(body)));
+  return text;
+}
+
+// Formats degrees as NMEA (d)ddmm.mmmm with hemisphere.
+inline void formatCoordinate(char *text, double degrees, bool latitude) {
+  const char hemisphere = latitude ? (degrees<0 ? 'S' : 'N') : (degrees<0 ? 'W' : 'E');
+  degrees = fabs(degrees);
+  const int whole = (int)degrees;
+  sprintf(text, latitude ? "%02d%07.4f,%c" : "%03d%07.4f,%c", whole, (degrees - whole) * 60, hemisphere);
+}
+
+// An hour of 1Hz RMC+GGA, as configured by gpsInit(), along a wandering route.
+inline std::vector<std::string> generateCorpus() {
+  std::vector<std::string> corpus;
+  uint32_t random = 12345;
+  double latitude = 40.7128, longitude = -74.0060;
+  for (uint32_t second = 0; second<3600; ++second) {
+    latitude += ((int32_t)(nextRandom(random) % 201) - 100) * 1e-6;
+    longitude += ((int32_t)(nextRandom(random) % 201) - 100) * 1e-6;
+    const uint32_t hms = (second / 3600 + 14) * 10000 + (second / 60 % 60) * 100 + second % 60;
+    char lat[20], lon[20], body[100];
+    formatCoordinate(lat, latitude, true);
+    formatCoordinate(lon, longitude, false);
+    snprintf(body, sizeof(body), "GPGGA,%06u.000,%s,%s,1,%02u,%.2f,%.1f,M,-34.2,M,,",
+      hms, lat, lon, 5 + nextRandom(random) % 8, 0.8 + (nextRandom(random) % 100) / 100.0, 10 + (nextRandom(random) % 100) / 10.0);
+    corpus.push_back(sentence(body));
+    snprintf(body, sizeof(body), "GPRMC,%06u.000,A,%s,%s,%.2f,%.2f,160326,,,A",
+      hms, lat, lon, (nextRandom(random) % 500) / 100.0, (nextRandom(random) % 36000) / 100.0);
+    corpus.push_back(sentence(body));
+  }
+  return corpus;
+}
+
+inline bool readCorpus(const char *path, std::vector<std::string> &corpus) {
+  FILE *file = fopen(path, "rb");
+  if (file==NULL) {
+    perror(path);
+    return false;
+  }
+  std::string line;
+  int c;
+  while ((c = fgetc(file))!=EOF) {
+    line.push_back((char)c);
+    if (c=='\n') {
+      corpus.push_back(line);
+      line.clear();
+    }
+  }
+  if (!line.empty()) {
+    corpus.push_back(line);
+  }
+  fclose(file);
+  return true;
+}
+
+#endif
@@ -0,0 +1,125 @@
+/*
+  NmeaReplaySource - Plays recorded NMEA into a GpsReader at the pace the GPS
+  sent it.
+
+  Each GGA or RMC carries the UTC time of its fix; the sentences of one fix
+  are released together at that time (relative to the first fix in the
+  capture), and bytes then trickle out at the UART's rate, 960 bytes/s at 9600
+  baud. Sentences without a time go out right after the ones before them.
+  setTime() moves the replay along, so a caller can follow a real clock for a
+  real-time replay, a scaled one for an accelerated replay, or step virtual
+  time as fast as it likes.
+
+  Native only.
+ */
+
+#ifndef NMEA_REPLAY_H
+#define NMEA_REPLAY_H
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "gps_reader.h"
+
+class NmeaReplaySource : public GpsByteSource {
+  typedef struct Span {
+    uint64_t startUs;         // When its first byte arrives
+    uint32_t offset;          // Into _bytes
+    uint32_t length;
+  } Span;
+
+  std::string _bytes;
+  std::vector<Span> _spans;
+  uint32_t _bytesPerSecond;
+  size_t _span = 0;           // First span not completely released
+  uint32_t _released = 0;     // Bytes arrived by the current time
+  uint32_t _read = 0;         // Bytes taken by read()
+
+  // Milliseconds since midnight from the time field of a GGA or RMC, or -1.
+  static int32_t sentenceMillis(const std::string &line) {
+    if (line.size()<14 || line[0]!='$' || line[6]!=',' || (line.compare(3, 3, "GGA")!=0 && line.compare(3, 3, "RMC")!=0)) {
+      return -1;
+    }
+    const char *time = line.c_str() + 7;
+    if (strspn(time, "0123456789")<6) {
+      return -1;
+    }
+    const double hms = atof(time);
+    const int32_t whole = (int32_t)hms;
+    return ((whole / 10000) * 3600 + (whole / 100 % 100) * 60 + whole % 100) * 1000 + (int32_t)((hms - whole) * 1000 + 0.5);
+  }
+
+  public:
+  NmeaReplaySource(const std::vector<std::string> &lines, uint32_t bytesPerSecond = 960)
+  : _bytesPerSecond(bytesPerSecond) {
+    int32_t first = -1, previous = -1;
+    uint64_t dayUs = 0, fixUs = 0, endUs = 0;
+    for (const std::string &line : lines) {
+      const int32_t ms = sentenceMillis(line);
+      if (ms>=0) {
+        if (first<0) {
+          first = ms;
+        }
+        if (previous>=0 && ms + 12 * 3600 * 1000 < previous) {
+          dayUs += 24 * 3600 * 1000000ULL; // Past midnight
+        }
+        previous = ms;
+        fixUs = dayUs + (int64_t)(ms - first) * 1000; // Negative past midnight, before dayUs
+      }
+      Span span;
+      span.startUs = fixUs>endUs ? fixUs : endUs;
+      span.offset = _bytes.size();
+      span.length = line.size();
+      endUs = span.startUs + (uint64_t)span.length * 1000000 / _bytesPerSecond;
+      _spans.push_back(span);
+      _bytes += line;
+    }
+  }
+
+  // Moves replay time, in milliseconds from the start of the capture, to ms.
+  // Time only goes forward.
+  void setTime(uint32_t ms) {
+    const uint64_t nowUs = (uint64_t)ms * 1000;
+    while (_span<_spans.size() && _spans[_span].startUs<=nowUs) {
+      const Span &span = _spans[_span];
+      const uint64_t arrived = (nowUs - span.startUs) * _bytesPerSecond / 1000000;
+      if (arrived<span.length) {
+        _released = span.offset + (uint32_t)arrived;
+        return;
+      }
+      _released = span.offset + span.length;
+      ++_span;
+    }
+  }
+
+  // Milliseconds from the start until the last byte has arrived.
+  uint32_t duration() const {
+    if (_spans.empty()) {
+      return 0;
+    }
+    const Span &last = _spans.back();
+    return (uint32_t)((last.startUs + (uint64_t)last.length * 1000000 / _bytesPerSecond + 999) / 1000);
+  }
+
+  bool finished() const {
+    return _read==_bytes.size();
+  }
+
+  uint32_t size() const {
+    return _bytes.size();
+  }
+
+  virtual uint16_t read(uint8_t *buffer, uint16_t size) {
+    const uint32_t n = _released - _read < size ? _released - _read : size;
+    memcpy(buffer, _bytes.data() + _read, n);
+    _read += n;
+    return n;
+  }
+
+  virtual uint32_t available() const {
+    return _released - _read;
+  }
+};
+
+#endif
@@ -0,0 +1,294 @@
+/*
+  Discrete-event simulator for the Respire mode tree.
+
+  Runs one device (AppState + RespireContext) against a simulated clock.
+  Instead of stepping time, it asks the mode tree how long nothing needs to
+  happen (Mode::maxSleep, or a parked search coming due as in
+  AppState::sleepInterval) and jumps straight to the earlier of that deadline
+  and the next scripted input or action completion. Actions are not run;
+  SimExecutor counts them and schedules their completions according to a
+  SimPolicy, e.g. a join that succeeds 5 seconds after attemptJoin.
+
+  Native only. Links against the mock actions, which are never called.
+ */
+
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <map>
+#include "mm_state.h"
+
+class SimClock : public Clock {
+  uint32_t _millis = 100000;
+
+  public:
+  virtual uint32_t millis() {
+    return _millis;
+  }
+
+  void set(uint32_t ms) {
+    _millis = ms;
+  }
+};
+
+// How the outside world responds to actions. Probabilities are per mille.
+typedef struct SimPolicy {
+  uint32_t joinMs = 6000;
+  uint16_t joinSuccess = 1000;
+  uint32_t gpsReadMs = 1000;
+  uint32_t sendMs = 2500;           // Including RX windows
+  uint32_t logMs = 50;
+} SimPolicy;
+
+typedef struct SimStats {
+  uint32_t loops = 0;
+  uint32_t joins = 0;
+  uint32_t joinSuccesses = 0;
+  uint32_t reads = 0;
+  uint32_t sends = 0;
+  uint32_t ackSends = 0;
+  uint32_t logs = 0;
+  uint32_t sleeps = 0;
+  uint32_t gpsOns = 0;
+  uint32_t gpsOnMs = 0;
+} SimStats;
+
+enum SimEventKind {
+  SimUsbPower,
+  SimGpsFix,
+  SimStationary,
+  SimCompleteJoin,
+  SimCompleteRead,
+  SimCompleteSend,
+  SimComplete,
+};
+
+typedef struct SimEvent {
+  SimEventKind kind;
+  bool value;
+  Mode<AppState> *mode;
+} SimEvent;
+
+class Simulator;
+
+class SimExecutor : public Executor<AppState> {
+  Simulator &_sim;
+
+  public:
+  SimExecutor(Simulator &sim)
+  : _sim(sim) {
+  }
+
+  virtual void exec(Mode<AppState>::ActionFn fn, const AppState &state, const AppState &oldState, Mode<AppState> *trigger);
+};
+
+// Called with the device clock time of each send.
+typedef void (*SimSendObserverFn)(uint32_t millis, void *context);
+
+class Simulator {
+  friend class SimExecutor;
+
+  Mode<AppState> &_root;
+  SimPolicy _policy;
+  SimStats _stats;
+  uint32_t _random;
+  uint32_t _frameCounter = 0;
+  uint32_t _gpsOnSince = 0;
+  bool _gpsOn = false;
+  std::multimap<uint32_t, SimEvent> _events; // Ordered by time, then insertion
+  SimSendObserverFn _sendObserver = NULL;
+  void *_sendObserverContext = NULL;
+
+  AppState _state;
+  SimClock _clock;
+  SimExecutor _executor;
+  RespireContext<AppState> _respire;
+
+  enum {
+    kMaxStep = DAYS_IN_MILLIS(1), // Upper bound on a single jump
+    kMinStep = 1000,              // Step taken when Respire reports no slack, e.g. while an action is outstanding
+  };
+
+  bool chance(uint16_t perMille) {
+    // xorshift32
+    _random ^= _random << 13;
+    _random ^= _random >> 17;
+    _random ^= _random << 5;
+    return (_random % 1000) < perMille;
+  }
+
+  void schedule(uint32_t delay, SimEventKind kind, Mode<AppState> *mode, bool value = true) {
+    SimEvent event = {kind, value, mode};
+    _events.insert(std::make_pair(_clock.millis() + delay, event));
+  }
+
+  void gpsPower(bool on) {
+    if (on && !_gpsOn) {
+      ++_stats.gpsOns;
+      _gpsOnSince = _clock.millis();
+    }
+    else if (!on && _gpsOn) {
+      _stats.gpsOnMs += _clock.millis() - _gpsOnSince;
+    }
+    _gpsOn = on;
+  }
+
+  void apply(const SimEvent &event) {
+    switch (event.kind) {
+      case SimUsbPower:
+        _state.setUsbPower(event.value);
+        break;
+      case SimGpsFix:
+        _state.setGpsFix(event.value);
+        break;
+      case SimStationary:
+        _state.setStationary(event.value);
+        break;
+      case SimCompleteJoin:
+        _respire.complete(event.mode, [&event](AppState &state) {
+          if (event.value) {
+            state.setJoined(true);
+          }
+        });
+        break;
+      case SimCompleteRead:
+        if (event.value) {
+          _respire.complete(event.mode, [](AppState &state) {
+            GpsSample sample(407000000, -740000000, 1000, 120, 2018, 3, 20, 12, 0, 0, 0);
+            state.setGpsLocation(sample);
+          });
+        }
+        else {
+          _respire.complete(event.mode);
+        }
+        break;
+      case SimCompleteSend: {
+        const uint32_t frame = ++_frameCounter;
+        _respire.complete(event.mode, [frame](AppState &state) {
+          state.transmittedFrame(frame);
+        });
+        break;
+      }
+      case SimComplete:
+        _respire.complete(event.mode);
+        break;
+    }
+  }
+
+  public:
+  Simulator(Mode<AppState> &root, const SimPolicy &policy = SimPolicy(), uint32_t seed = 1)
+  : _root(root),
+    _policy(policy),
+    _random(seed ? seed : 1),
+    _executor(*this),
+    _respire(_state, root, &_clock, &_executor) {
+    _state.setClock(&_clock); // Sample expiry and sends on simulated time
+  }
+
+  void begin(uint32_t startMillis = 100000) {
+    _clock.set(startMillis);
+    _respire.init();
+    _respire.begin();
+  }
+
+  // Schedules an input change `delay` ms from now.
+  void input(uint32_t delay, SimEventKind kind, bool value) {
+    schedule(delay, kind, NULL, value);
+  }
+
+  void runFor(uint32_t duration) {
+    const uint32_t end = _clock.millis() + duration;
+    while (_clock.millis() < end) {
+      uint32_t sleep = _root.maxSleep(_state, kMaxStep);
+      const uint32_t due = _state.gpsSearchDueIn();
+      if (due>0 && due<sleep) {
+        sleep = due;
+      }
+      uint32_t next = _clock.millis() + sleep;
+      if (next==_clock.millis()) {
+        next += kMinStep;
+      }
+      if (!_events.empty() && _events.begin()->first < next) {
+        next = _events.begin()->first;
+      }
+      if (next > end) {
+        next = end;
+      }
+      if (next > _clock.millis()) {
+        _clock.set(next);
+      }
+      while (!_events.empty() && _events.begin()->first <= _clock.millis()) {
+        const SimEvent event = _events.begin()->second;
+        _events.erase(_events.begin());
+        apply(event);
+      }
+      _respire.loop();
+      ++_stats.loops;
+    }
+    if (_gpsOn) {
+      // Bring gpsOnMs up to date
+      _stats.gpsOnMs += _clock.millis() - _gpsOnSince;
+      _gpsOnSince = _clock.millis();
+    }
+  }
+
+  void observeSends(SimSendObserverFn observer, void *context) {
+    _sendObserver = observer;
+    _sendObserverContext = context;
+  }
+
+  uint32_t millis() {
+    return _clock.millis();
+  }
+
+  AppState &state() {
+    return _state;
+  }
+
+  RespireContext<AppState> &respire() {
+    return _respire;
+  }
+
+  const SimStats &stats() const {
+    return _stats;
+  }
+};
+
+inline void SimExecutor::exec(Mode<AppState>::ActionFn fn, const AppState &state, const AppState &oldState, Mode<AppState> *trigger) {
+  SimStats &stats = _sim._stats;
+  const SimPolicy &policy = _sim._policy;
+  if (fn==changeGpsPower) {
+    _sim.gpsPower(state.getGpsPower());
+  }
+  else if (fn==attemptJoin) {
+    ++stats.joins;
+    const bool success = _sim.chance(policy.joinSuccess);
+    stats.joinSuccesses += success ? 1 : 0;
+    _sim.schedule(policy.joinMs, SimCompleteJoin, trigger, success);
+  }
+  else if (fn==readGpsLocation) {
+    ++stats.reads;
+    _sim.schedule(policy.gpsReadMs, SimCompleteRead, trigger, state.hasGpsFix());
+  }
+  else if (fn==sendLocation || fn==sendLocationAck) {
+    ++stats.sends;
+    stats.ackSends += (fn==sendLocationAck) ? 1 : 0;
+    if (_sim._sendObserver!=NULL) {
+      _sim._sendObserver(_sim._clock.millis(), _sim._sendObserverContext);
+    }
+    _sim.schedule(policy.sendMs, SimCompleteSend, trigger);
+  }
+  else if (fn==writeLocation) {
+    ++stats.logs;
+    _sim.schedule(policy.logMs, SimComplete, trigger);
+  }
+  else if (fn==changeSleep) {
+    ++stats.sleeps;
+  }
+  else {
+    // Display and other actions complete right away.
+    _sim.schedule(0, SimComplete, trigger);
+  }
+}
+
+#endif
@@ -4,6 +4,23 @@
 #include <Logging.h>
 
 #include "mm_state.h"
+#include "change_log.h"
+#include "../src_native/simulator.h"
+#include "../src_native/alloc_counter.h"
+#include "../src_native/mock_actions.h"
+#include "deferred_executor.h"
+#include "journal.h"
+#include "../src_native/journal_replay.h"
+#include "byte_ring.h"
+#include "nmea.h"
+#include "mtk_binary.h"
+#include "gps_phase.h"
+#include "gps_fix.h"
+#include "gps_sampler.h"
+#include "gps_assist.h"
+#include "gps_motion.h"
+#include "gps_reader.h"
+#include "../src_native/nmea_replay.h"
 
 #define UNIT_TEST
 #ifdef UNIT_TEST
@@ -79,6 +96,10 @@ class TestExecutor : public Executor<AppState> {
     _called.push_back(listener);
   }
 
+  const std::vector<Mode<AppState>::ActionFn> &called() const {
+    return _called;
+  }
+
   bool check() {
     // TEST_ASSERT_EQUAL(_expected.size(), _called.size());
     if (_expected != _called) {
@@ -220,7 +241,7 @@ void test_gps_power_and_send_after_low_power_successful_join(void) {
     state.setGpsFix(true);
 
     respire.complete(ModeReadGps, [](AppState &state) {
-      GpsSample sample(45, 45, 45, 1.5, 2018, 03, 20, 12, 00, 00, 0000);
+      GpsSample sample(450000000, 450000000, 4500, 150, 2018, 03, 20, 12, 00, 00, 0000);
       state.setGpsLocation(sample);
     });
 
@@ -250,7 +271,7 @@ void test_gps_power_and_send_after_low_power_successful_join(void) {
   }
 }
 
-void test_5m_limit_on_low_power_gps_search(void) {
+void test_max_limit_on_low_power_gps_search(void) {
   TestClock clock;
   TestExecutor expectedOps(attemptJoin, changeGpsPower, NULL);
   AppState state;
@@ -273,20 +294,132 @@ void test_5m_limit_on_low_power_gps_search(void) {
     TestExecutor expectedOps(changeGpsPower, changeSleep, NULL);
     respire.setExecutor(&expectedOps);
 
-    clock.advanceSeconds(60);
+    clock.advanceSeconds(GPS_SEARCH_MIN_MS / 1000);
     respire.loop();
     TEST_ASSERT(ModeLowPowerGpsSearch.isActive(state));
     TEST_ASSERT_FALSE(ModeSleep.isActive(state));
 
-    clock.advanceSeconds(4 * 60);
+    clock.advanceSeconds((GPS_SEARCH_MAX_MS - GPS_SEARCH_MIN_MS) / 1000);
+    respire.loop();
+    TEST_ASSERT_FALSE(ModeLowPowerGpsSearch.isActive(state));
+    TEST_ASSERT(ModeSleep.isActive(state));
+
+    TEST_ASSERT(expectedOps.check());
+  }
+}
+
+void test_gps_search_ends_when_over(void) {
+  TestClock clock;
+  TestExecutor expectedOps(attemptJoin, changeGpsPower, NULL);
+  AppState state;
+  RespireContext<AppState> respire(state, ModeFunctional, &clock, &expectedOps);
+  respire.init();
+  respire.begin();
+
+  respire.complete(ModeAttemptJoin, [](AppState &state){
+    state.setJoined(true);
+  });
+  TEST_ASSERT(ModeLowPowerGpsSearch.isActive(state));
+  TEST_ASSERT(expectedOps.check());
+
+  {
+    // Recent fixes came quickly, so the search gives up well before the maximum
+    TestExecutor expectedOps(changeGpsPower, changeSleep, NULL);
+    respire.setExecutor(&expectedOps);
+
+    clock.advanceSeconds(90);
+    state.setGpsSearchOver(true);
     respire.loop();
     TEST_ASSERT_FALSE(ModeLowPowerGpsSearch.isActive(state));
+    TEST_ASSERT_FALSE(state.getGpsPower());
     TEST_ASSERT(ModeSleep.isActive(state));
 
     TEST_ASSERT(expectedOps.check());
   }
 }
 
+void test_gps_search_waits_while_parked(void) {
+  TestClock clock;
+  TestExecutor expectedOps(attemptJoin, changeSleep, NULL);
+  AppState state;
+  state.setClock(&clock);
+  RespireContext<AppState> respire(state, ModeFunctional, &clock, &expectedOps);
+  respire.init();
+  respire.begin();
+
+  // Parked, with a sample from the last search
+  state.setStationary(true);
+  TEST_ASSERT(state.gpsSearchDue()); // None yet
+  state.setGpsLocation(GpsSample(407127753, -740059728, 1000, 120, 2018, 3, 20, 12, 0, 0, 0));
+  TEST_ASSERT_FALSE(state.gpsSearchDue());
+
+  respire.complete(ModeAttemptJoin, [](AppState &state){
+    state.setJoined(true);
+  });
+  TEST_ASSERT_FALSE(ModeLowPowerGpsSearch.isActive(state));
+  TEST_ASSERT_FALSE(state.getGpsPower());
+  TEST_ASSERT(ModeSleep.isActive(state));
+  TEST_ASSERT_EQUAL(PARKED_SEARCH_INTERVAL_MS, state.gpsSearchDueIn());
+  TEST_ASSERT_EQUAL(PARKED_SEARCH_INTERVAL_MS, state.sleepInterval(ModeFunctional, DAYS_IN_MILLIS(1)));
+  TEST_ASSERT(expectedOps.check());
+
+  {
+    // The next search waits out the interval since that sample
+    TestExecutor expectedOps(changeGpsPower, NULL);
+    respire.setExecutor(&expectedOps);
+
+    clock.advanceSeconds(PARKED_SEARCH_INTERVAL_MS / 1000 - 1);
+    respire.loop();
+    TEST_ASSERT_FALSE(state.gpsSearchDue());
+    TEST_ASSERT_FALSE(ModeLowPowerGpsSearch.isActive(state));
+
+    clock.advanceSeconds(1);
+    respire.loop();
+    TEST_ASSERT(state.gpsSearchDue());
+    TEST_ASSERT(ModeLowPowerGpsSearch.isActive(state));
+    TEST_ASSERT(state.getGpsPower());
+
+    TEST_ASSERT(expectedOps.check());
+  }
+
+  // Moving, every cycle searches
+  state.setStationary(false);
+  TEST_ASSERT(state.gpsSearchDue());
+}
+
+void test_time_alone_enters_modes(void) {
+  TestClock clock;
+  TestExecutor expectedOps(attemptJoin, changeSleep, NULL);
+  AppState state;
+  state.setClock(&clock);
+  RespireContext<AppState> respire(state, ModeFunctional, &clock, &expectedOps);
+  respire.init();
+  respire.begin();
+
+  state.setStationary(true);
+  state.setGpsLocation(GpsSample(407127753, -740059728, 1000, 120, 2018, 3, 20, 12, 0, 0, 0));
+  respire.complete(ModeAttemptJoin, [](AppState &state){
+    state.setJoined(true);
+  });
+  TEST_ASSERT(ModeSleep.isActive(state));
+  TEST_ASSERT(expectedOps.check());
+
+  {
+    // The parked search comes due with no field changing. An update to a
+    // field no Mode reads evaluates nothing; loop() sees it.
+    TestExecutor expectedOps(changeGpsPower, NULL);
+    respire.setExecutor(&expectedOps);
+    clock.advanceSeconds(PARKED_SEARCH_INTERVAL_MS / 1000);
+    state.batteryVolts(3.7);
+    TEST_ASSERT_FALSE(ModeLowPowerGpsSearch.isActive(state));
+
+    respire.loop();
+    TEST_ASSERT(ModeLowPowerGpsSearch.isActive(state));
+    TEST_ASSERT(state.getGpsPower());
+    TEST_ASSERT(expectedOps.check());
+  }
+}
+
 void startedJoinAfter(RespireContext<AppState> &respire, const char *context, AppState &state, TestClock &clock, uint16_t seconds, Mode<AppState>::ActionFn expected, ...) {
   // Starting fresh and we attempt a send.
   va_list args;
@@ -372,7 +505,7 @@ void startedSendAfter(RespireContext<AppState> &respire, const char *context, Ap
 
   TEST_ASSERT_MESSAGE(ModeReadGps.isActive(state), context);
   respire.complete(ModeReadGps, [](AppState &state){
-      GpsSample sample(45, 45, 45, 1.5, 2018, 03, 20, 12, 00, 00, 0000);
+      GpsSample sample(450000000, 450000000, 4500, 150, 2018, 03, 20, 12, 00, 00, 0000);
       state.setGpsLocation(sample);
   });
 
@@ -489,70 +622,1518 @@ void test_display(void) {
   }
 }
 
-int main(int argc, char **argv) {
-    UNITY_BEGIN();
-    LogPrinter printer(printFn);
-    Log.Init(LOGLEVEL, printer);
+// Every defined Mode. (ModeDisplayBlank2 and ModeRejoinAfterAck are declared but not yet defined.)
+static Mode<AppState> *_modes[] = {
+  &ModeMain, &ModeDisplay, &ModeDisplayBlank, &ModeDisplayStatus, &ModeDisplayParameters,
+  &ModeDisplayErrors, &ModeFunctional, &ModeSleep, &ModeAttemptJoin, &ModeLowPowerJoin, &ModeLowPowerGpsSearch,
+  &ModeLowPowerSend, &ModePeriodicJoin, &ModePeriodicSend, &ModeReadAndSend, &ModeReadGps, &ModeSend,
+  &ModeSendNoAck, &ModeSendAck, &ModeLogGps,
+};
 
-    RUN_TEST(test_gps_power_while_power);
-    RUN_TEST(test_join_once_when_low_power_then_sleep_on_fail);
-    RUN_TEST(test_gps_power_and_send_after_low_power_successful_join);
-    RUN_TEST(test_5m_limit_on_low_power_gps_search);
-    RUN_TEST(test_join_every_5_min);
-    RUN_TEST(test_send_every_10_min);
-    RUN_TEST(test_display);
-    UNITY_END();
+static FieldMask gListenerChanges = 0;
+static uint16_t gListenerCalls = 0;
 
-    return 0;
+void recordListenerChanges(const AppState &state, const AppState &oldState) {
+  gListenerChanges |= state.changes(oldState);
+  ++gListenerCalls;
+}
+
+void ignoreListener(const AppState &state, const AppState &oldState) {
+}
+
+// One mutation per field, each changing the value from its reset default.
+static const struct {
+  FieldMask field;
+  void (*mutate)(AppState &state);
+} _mutators[] = {
+  {FieldUsbPower, [](AppState &state){ state.setUsbPower(!state.getUsbPower()); }},
+  {FieldBatteryVolts, [](AppState &state){ state.batteryVolts(state.batteryVolts() + 0.1); }},
+  {FieldGpsFix, [](AppState &state){ state.setGpsFix(!state.hasGpsFix()); }},
+  {FieldJoined, [](AppState &state){ state.setJoined(!state.getJoined()); }},
+  {FieldTtnFrame, [](AppState &state){ state.transmittedFrame(state.ttnFrameCounter() + 1); }},
+  {FieldPage, [](AppState &state){ state.page(state.page() + 1); }},
+  {FieldField, [](AppState &state){ state.field(state.field() + 1); }},
+  {FieldButtonChange, [](AppState &state){ state.buttonChange(!state.buttonChange()); }},
+  {FieldRedisplay, [](AppState &state){ state.requestRedisplay(); }},
+  {FieldStationary, [](AppState &state){ state.setStationary(!state.isStationary()); }},
+  {FieldGpsSearchOver, [](AppState &state){ state.setGpsSearchOver(!state.gpsSearchOver()); }},
+};
+
+void runMixedInputs(RespireContext<AppState> &respire, AppState &state, TestClock &clock) {
+  state.batteryVolts(3.7);
+  respire.complete(ModeAttemptJoin, [](AppState &state){
+    state.setJoined(true);
+    state.transmittedFrame(1);
+  });
+  clock.advanceSeconds(30);
+  respire.loop();
+  state.batteryVolts(3.6);
+  state.setGpsFix(true);
+  respire.complete(ModeReadGps, [](AppState &state){
+    GpsSample sample(450000000, 450000000, 4500, 150, 2018, 03, 20, 12, 00, 00, 0000);
+    state.setGpsLocation(sample);
+  });
+  respire.complete(ModeSendAck, [](AppState &state){
+    state.transmittedFrame(2);
+  });
+  respire.complete(ModeLogGps);
+  state.batteryVolts(3.5);
+  state.setUsbPower(true);
+  clock.advanceSeconds(60);
+  respire.loop();
+}
+
+void test_update_tracking_matches_copy(void) {
+  // Reference run: a listener watching every field puts each mutation through the full update cycle.
+  TestClock copyClock;
+  TestExecutor copyOps(NULL);
+  AppState copyState;
+  RespireContext<AppState> copyRespire(copyState, ModeFunctional, &copyClock, &copyOps);
+  copyRespire.init();
+  copyRespire.begin();
+  copyState.setListener(ignoreListener, kAllFields);
+  runMixedInputs(copyRespire, copyState, copyClock);
+
+  TestClock clock;
+  TestExecutor ops(NULL);
+  AppState state;
+  RespireContext<AppState> respire(state, ModeFunctional, &clock, &ops);
+  respire.init();
+  respire.begin();
+  runMixedInputs(respire, state, clock);
+
+  TEST_ASSERT(ops.called()==copyOps.called());
+  for (uint16_t i=0; i<ELEMENTS(_modes); ++i) {
+    TEST_ASSERT_EQUAL_MESSAGE(_modes[i]->isActive(copyState), _modes[i]->isActive(state), _modes[i]->name());
+  }
+  // Expiry and last send are stamped with wall clock millis(), so compare those fields by value.
+  TEST_ASSERT_EQUAL(0, state.changes(copyState, kAllFields & ~(FieldGpsSample | FieldTtnFrame)));
+  TEST_ASSERT(state.gpsSample().same(copyState.gpsSample()));
+  TEST_ASSERT_EQUAL(copyState.ttnFrameCounter(), state.ttnFrameCounter());
+}
+
+void test_state_copies_are_values(void) {
+  TestClock clock;
+  TestExecutor ops(NULL);
+  AppState state;
+  RespireContext<AppState> respire(state, ModeFunctional, &clock, &ops);
+  respire.init();
+  respire.begin();
+  state.setListener(recordListenerChanges, kAllFields);
+
+  gListenerChanges = 0;
+  {
+    AppState::Batch batch(state);
+    state.setGpsFix(true);
+
+    // A copy made mid-update holds the values, not the update in progress
+    AppState copy(state);
+    TEST_ASSERT(copy.hasGpsFix());
+    TEST_ASSERT_EQUAL(0, copy.changes(state));
+    AppState assigned;
+    assigned = state;
+    TEST_ASSERT(assigned.hasGpsFix());
+    TEST_ASSERT_EQUAL(0, gListenerChanges);
+  }
+  // The outer update still compares against the values from before it began
+  TEST_ASSERT_EQUAL(FieldGpsFix, gListenerChanges);
+  state.setListener(NULL);
+}
+
+void test_changes_reports_mutated_field(void) {
+  TestClock clock;
+  TestExecutor ops(NULL);
+  AppState state;
+  RespireContext<AppState> respire(state, ModeFunctional, &clock, &ops);
+  respire.init();
+  respire.begin();
+  state.setListener(recordListenerChanges, kAllFields);
+
+  for (uint16_t i=0; i<ELEMENTS(_mutators); ++i) {
+    gListenerChanges = 0;
+    _mutators[i].mutate(state);
+    TEST_ASSERT_EQUAL(_mutators[i].field, gListenerChanges & _mutators[i].field);
+  }
+
+  // Changes to fields nobody observes skip the update cycle entirely.
+  state.setListener(recordListenerChanges, FieldUsbPower);
+  gListenerChanges = 0;
+  state.batteryVolts(3.9);
+  TEST_ASSERT_EQUAL(0, gListenerChanges);
+  state.setUsbPower(false);
+  TEST_ASSERT_EQUAL(FieldUsbPower, gListenerChanges & (FieldUsbPower | FieldBatteryVolts));
+  TEST_ASSERT(FLOAT_SAME(3.9, state.batteryVolts(), 0.01));
+}
+
+void test_batch_runs_one_update(void) {
+  TestClock clock;
+  TestExecutor expectedOps(attemptJoin, NULL);
+  AppState state;
+  RespireContext<AppState> respire(state, ModeFunctional, &clock, &expectedOps);
+  respire.init();
+  respire.begin();
+  state.setListener(recordListenerChanges, kAllFields);
+
+  gListenerChanges = 0;
+  gListenerCalls = 0;
+  {
+    AppState::Batch batch(state);
+    state.buttonPage(true);
+    state.buttonField(true);
+    {
+      AppState::Batch nested(state);
+      state.buttonChange(true);
+      state.requestRedisplay();
+    }
+    TEST_ASSERT_EQUAL(0, gListenerCalls); // Nothing evaluated until the outer batch ends
+  }
+  TEST_ASSERT_EQUAL(1, gListenerCalls);
+  TEST_ASSERT_EQUAL(kButtonFields | FieldRedisplay, gListenerChanges & (kButtonFields | FieldRedisplay));
+
+  {
+    // Mutations inside complete() see one update cycle as well.
+    TestExecutor expectedOps(changeGpsPower, NULL);
+    respire.setExecutor(&expectedOps);
+
+    gListenerChanges = 0;
+    respire.complete(ModeAttemptJoin, [](AppState &state){
+      AppState::Batch batch(state);
+      state.setJoined(true);
+      state.transmittedFrame(1);
+    });
+    TEST_ASSERT_EQUAL(FieldJoined | FieldTtnFrame, gListenerChanges & (FieldJoined | FieldTtnFrame));
+    TEST_ASSERT(state.getGpsPower());
+
+    TEST_ASSERT(expectedOps.check());
+  }
+
+  {
+    // A batch whose mutations cancel out still ends in a consistent state.
+    TestExecutor expectedOps(NULL);
+    respire.setExecutor(&expectedOps);
+    {
+      AppState::Batch batch(state);
+      state.setUsbPower(true);
+      state.setUsbPower(false);
+    }
+    TEST_ASSERT_FALSE(state.getUsbPower());
+    TEST_ASSERT(expectedOps.check());
+  }
+}
+
+void checkUndeclaredFieldsInert(RespireContext<AppState> &respire, AppState &state, const char *context) {
+  // Force every mutation through the update cycle, then check that fields outside
+  // the declared dependencies change neither Mode activity nor trigger actions.
+  state.setListener(ignoreListener, kAllFields);
+  const FieldMask declared = attachedModeDependencies() | kDerivedStateFields;
+  for (uint16_t i=0; i<ELEMENTS(_mutators); ++i) {
+    if (_mutators[i].field & declared) {
+      continue;
+    }
+    TestExecutor expectedOps(NULL);
+    respire.setExecutor(&expectedOps);
+    const uint32_t before = activeModes(state);
+    _mutators[i].mutate(state);
+    TEST_ASSERT_EQUAL_MESSAGE(before, activeModes(state), context);
+    TEST_ASSERT_MESSAGE(expectedOps.check(), context);
+  }
+  state.setListener(NULL);
+}
+
+void test_mode_dependencies(void) {
+  TEST_ASSERT_EQUAL(FieldGpsFix, modeDependencies(ModeReadGps));
+  TEST_ASSERT_EQUAL(0, modeDependencies(ModeSleep));
+  for (uint8_t i = 0; i<modeCount(); ++i) {
+    TEST_ASSERT_EQUAL(i, modeIndex(*modeAt(i)));
+  }
+  TEST_ASSERT_NULL(modeAt(modeCount()));
+
+  TestClock clock;
+  TestExecutor expectedOps(attemptJoin, NULL);
+  AppState state;
+  RespireContext<AppState> respire(state, ModeFunctional, &clock, &expectedOps);
+  respire.init();
+  respire.begin();
+  TEST_ASSERT(expectedOps.check());
+
+  TEST_ASSERT_FALSE(attachedModeDependencies() & FieldBatteryVolts);
+  checkUndeclaredFieldsInert(respire, state, "[low power join]");
+
+  {
+    TestExecutor expectedOps(changeGpsPower, NULL);
+    respire.setExecutor(&expectedOps);
+    respire.complete(ModeAttemptJoin, [](AppState &state){
+      state.setJoined(true);
+    });
+    TEST_ASSERT(expectedOps.check());
+  }
+  checkUndeclaredFieldsInert(respire, state, "[low power gps search]");
+
+  {
+    TestExecutor expectedOps(changeGpsPower, readGpsLocation, NULL);
+    respire.setExecutor(&expectedOps);
+    state.setGpsFix(true);
+    TEST_ASSERT(expectedOps.check());
+  }
+  checkUndeclaredFieldsInert(respire, state, "[read gps]");
+}
+
+void test_change_record(void) {
+  TestClock clock;
+  TestExecutor expectedOps(attemptJoin, NULL);
+  AppState state;
+  state.setClock(&clock);
+  RespireContext<AppState> respire(state, ModeFunctional, &clock, &expectedOps);
+  respire.init();
+  respire.begin();
+  TEST_ASSERT(expectedOps.check());
+
+  {
+    TestExecutor expectedOps(changeGpsPower, NULL);
+    respire.setExecutor(&expectedOps);
+    AppState oldState(state);
+    clock.advanceSeconds(3);
+    state.setUsbPower(true);
+    TEST_ASSERT(expectedOps.check());
+
+    const ChangeRecord record = makeChangeRecord(state, oldState);
+    TEST_ASSERT_EQUAL(clock.millis(), record._millis); // Respire's clock, not ::millis()
+    TEST_ASSERT_EQUAL(FieldUsbPower, record._fields);
+    TEST_ASSERT(record._flags & FieldUsbPower);
+    TEST_ASSERT_EQUAL(0, record._activated & record._deactivated);
+    TEST_ASSERT(record._activated != 0);
+
+    char line[160];
+    formatChangeRecord(line, sizeof(line), record);
+    TEST_ASSERT(strstr(line, " usb=1")!=NULL);
+    TEST_ASSERT(strstr(line, " +PeriodicJoin")!=NULL);
+    TEST_ASSERT(strstr(line, "bat=")==NULL); // Unchanged fields are left out
+
+    char shortLine[8];
+    TEST_ASSERT_EQUAL(sizeof(shortLine)-1, formatChangeRecord(shortLine, sizeof(shortLine), record));
+  }
+
+  ChangeLog log;
+  for (uint8_t i=0; i<20; ++i) {
+    ChangeRecord record;
+    record._counter = i;
+    log.add(record);
+  }
+  TEST_ASSERT_EQUAL(16, log.count());
+  TEST_ASSERT_EQUAL(4, log.at(0)._counter);
+  TEST_ASSERT_EQUAL(19, log.at(15)._counter);
 }
 
-#ifdef MOCK_ACTIONS
+void test_sleep_interval(void) {
+  const uint32_t limit = DAYS_IN_MILLIS(1);
+  TestClock clock;
+  TestExecutor expectedOps(attemptJoin, NULL);
+  AppState state;
+  RespireContext<AppState> respire(state, ModeFunctional, &clock, &expectedOps);
+  respire.init();
+  respire.begin();
+
+  // Join in progress on battery: stay awake for the radio.
+  TEST_ASSERT_EQUAL(0, state.sleepInterval(ModeFunctional, limit));
+
+  {
+    // Join succeeds and the GPS search begins: stay awake while GPS is powered.
+    TestExecutor expectedOps(changeGpsPower, NULL);
+    respire.setExecutor(&expectedOps);
+    respire.complete(ModeAttemptJoin, [](AppState &state){
+      state.setJoined(true);
+    });
+    TEST_ASSERT_EQUAL(0, state.sleepInterval(ModeFunctional, limit));
+    TEST_ASSERT(expectedOps.check());
+  }
 
-uint8_t fieldCountForPage(const AppState &state, uint8_t page) {
-  return 0;
+  {
+    // Search window expires with no fix: asleep until the next search, at
+    // most the gap between low power cycles away.
+    TestExecutor expectedOps(changeGpsPower, changeSleep, NULL);
+    respire.setExecutor(&expectedOps);
+    clock.advanceSeconds(GPS_SEARCH_MAX_MS / 1000);
+    respire.loop();
+    TEST_ASSERT(ModeSleep.isActive(state));
+    TEST_ASSERT(state.sleepInterval(ModeFunctional, limit) > 0);
+    TEST_ASSERT_LESS_OR_EQUAL(LOW_POWER_CYCLE_GAP_MS, state.sleepInterval(ModeFunctional, limit));
+    TEST_ASSERT_EQUAL(MINUTES_IN_MILLIS(1), state.sleepInterval(ModeFunctional, MINUTES_IN_MILLIS(1)));
+    TEST_ASSERT(expectedOps.check());
+  }
+
+  {
+    // The next search: awake again while the GPS is powered.
+    TestExecutor expectedOps(changeGpsPower, NULL);
+    respire.setExecutor(&expectedOps);
+    clock.advanceSeconds(LOW_POWER_CYCLE_GAP_MS / 1000);
+    respire.loop();
+    TEST_ASSERT(ModeLowPowerGpsSearch.isActive(state));
+    TEST_ASSERT_EQUAL(0, state.sleepInterval(ModeFunctional, limit));
+    TEST_ASSERT(expectedOps.check());
+  }
+
+  {
+    // USB power brings the device out of Sleep. (Actions are not under test here.)
+    TestExecutor ops(NULL);
+    respire.setExecutor(&ops);
+    state.setUsbPower(true);
+    state.setGpsFix(true);
+    TEST_ASSERT_EQUAL(0, state.sleepInterval(ModeFunctional, limit));
+  }
 }
 
-void changeGpsPower(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
-  // Reify GpsPower value
+void test_simulate_30_days_on_usb(void) {
+  Simulator sim(ModeFunctional);
+  sim.begin();
+  sim.input(0, SimUsbPower, true);
+  sim.input(MINUTES_IN_MILLIS(2), SimGpsFix, true);
+  sim.runFor(DAYS_IN_MILLIS(30));
+
+  const SimStats &stats = sim.stats();
+  TEST_ASSERT_EQUAL(1, stats.joins);
+  TEST_ASSERT(sim.state().getJoined());
+  // Six sends an hour, one of them a day with ACK
+  TEST_ASSERT_UINT32_WITHIN(6, 30 * 24 * 6, stats.sends);
+  TEST_ASSERT_UINT32_WITHIN(1, 30, stats.ackSends);
+  TEST_ASSERT_EQUAL(stats.sends, stats.reads);
+  TEST_ASSERT_EQUAL(stats.sends, stats.logs);
+  // GPS stays on the whole time on USB power
+  TEST_ASSERT_UINT32_WITHIN(1000, DAYS_IN_MILLIS(30), stats.gpsOnMs);
+  // Jumping between deadlines takes a handful of iterations per send, not one per second
+  TEST_ASSERT_LESS_OR_EQUAL(10 * stats.sends, stats.loops);
 }
 
-void readGpsLocation(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
+void test_simulate_battery_then_usb(void) {
+  SimPolicy policy;
+  policy.joinSuccess = 0; // First attempt fails
+  Simulator sim(ModeFunctional, policy);
+  sim.begin();
+  sim.runFor(DAYS_IN_MILLIS(2));
+
+  // On battery: a single failed join, then sleep
+  TEST_ASSERT_EQUAL(1, sim.stats().joins);
+  TEST_ASSERT_EQUAL(0, sim.stats().sends);
+  TEST_ASSERT(ModeSleep.isActive(sim.state()));
+
+  // Plugged in: periodic joins every 5 minutes while they keep failing
+  sim.input(0, SimUsbPower, true);
+  sim.runFor(MINUTES_IN_MILLIS(60));
+  TEST_ASSERT_UINT32_WITHIN(1, 1 + 12, sim.stats().joins);
 }
 
-void attemptJoin(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
-  // Enter the AttempJoin state, which is to say, call lorawan.join()
+void test_simulate_parked_on_battery(void) {
+  Simulator sim(ModeFunctional);
+  sim.begin();
+  const uint32_t start = sim.millis();
+  sim.input(0, SimStationary, true);
+  sim.input(MINUTES_IN_MILLIS(1), SimGpsFix, true);
+  sim.input(MINUTES_IN_MILLIS(2), SimGpsFix, false); // Lost with the GPS powered down
+  sim.runFor(MINUTES_IN_MILLIS(30));
+
+  // Joined, searched, sent the fix, then asleep
+  TEST_ASSERT_EQUAL(1, sim.stats().joins);
+  TEST_ASSERT_EQUAL(1, sim.stats().gpsOns);
+  TEST_ASSERT_EQUAL(1, sim.stats().sends);
+  TEST_ASSERT_FALSE(sim.state().getGpsPower());
+  TEST_ASSERT(ModeSleep.isActive(sim.state()));
+
+  // Parked, so the next search comes an interval after that fix was read,
+  // not a cycle gap after the search
+  sim.runFor(start + MINUTES_IN_MILLIS(1) + PARKED_SEARCH_INTERVAL_MS - sim.millis());
+  TEST_ASSERT_EQUAL(1, sim.stats().gpsOns);
+  sim.runFor(MINUTES_IN_MILLIS(1));
+  TEST_ASSERT_EQUAL(2, sim.stats().gpsOns);
+  TEST_ASSERT(sim.state().getGpsPower());
+  TEST_ASSERT(ModeLowPowerGpsSearch.isActive(sim.state()));
 }
 
-void changeSleep(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
-  // Enter or exit Sleep state
+void test_snapshot_restore(void) {
+  AppState state;
+  state.setJoined(true);
+  state.transmittedFrame(42);
+  state.page(2);
+  GpsSample sample(407000000, -740000000, 1000, 120, 2018, 3, 20, 12, 0, 0, 0);
+  state.setGpsLocation(sample);
+
+  AppStateSnapshot snapshot;
+  state.snapshot(snapshot, 1000);
+
+  {
+    // Restored straight away: everything, including the fresh GPS sample
+    AppState restored;
+    TEST_ASSERT(restored.restore(snapshot, 1000));
+    TEST_ASSERT(restored.getJoined());
+    TEST_ASSERT_EQUAL(42, restored.ttnFrameCounter());
+    TEST_ASSERT_EQUAL(2, restored.page());
+    TEST_ASSERT(restored.gpsSample().same(sample));
+    TEST_ASSERT(restored.hasRecentGpsLocation());
+  }
+  {
+    // Restored after the sample's validity ran out while powered off
+    AppState restored;
+    TEST_ASSERT(restored.restore(snapshot, 1000 + SAMPLE_VALID_FOR_MS / 1000 + 1));
+    TEST_ASSERT(restored.gpsSample().same(sample));
+    TEST_ASSERT_FALSE(restored.hasRecentGpsLocation());
+  }
+  {
+    // No real time: validity can't be carried over
+    AppState restored;
+    TEST_ASSERT(restored.restore(snapshot, 0));
+    TEST_ASSERT_FALSE(restored.hasRecentGpsLocation());
+  }
+  {
+    // Corrupt and stale snapshots are rejected without touching state
+    AppStateSnapshot corrupt = snapshot;
+    ((uint8_t *)&corrupt)[offsetof(AppStateSnapshot, _ttnFrameCounter)] ^= 0x01;
+    AppState restored;
+    TEST_ASSERT_FALSE(restored.restore(corrupt, 1000));
+    TEST_ASSERT_FALSE(restored.getJoined());
+    TEST_ASSERT_EQUAL(0, restored.ttnFrameCounter());
+
+    AppStateSnapshot stale = snapshot;
+    stale._version = kAppStateSnapshotVersion + 1;
+    stale._crc = snapshotCrc(stale);
+    TEST_ASSERT_FALSE(restored.restore(stale, 1000));
+  }
 }
 
-void writeLocation(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
+// Completes every action on the next pass, the way the firmware callbacks do,
+// without allocating: pending modes live in a fixed array.
+class CompletingExecutor : public Executor<AppState> {
+  Mode<AppState> *_pending[8];
+  uint8_t _count = 0;
+
+  public:
+  uint32_t _frameCounter = 0;
+
+  virtual void exec(Mode<AppState>::ActionFn fn, const AppState &state, const AppState &oldState, Mode<AppState> *trigger) {
+    if (fn==changeGpsPower || fn==changeSleep) {
+      return; // Not completed
+    }
+    TEST_ASSERT_LESS_THAN(ELEMENTS(_pending), _count);
+    _pending[_count++] = trigger;
+  }
+
+  void completeAll(RespireContext<AppState> &respire) {
+    while (_count>0) {
+      Mode<AppState> *mode = _pending[--_count];
+      if (mode==&ModeAttemptJoin) {
+        respire.complete(mode, [](AppState &state) {
+          state.setJoined(true);
+        });
+      }
+      else if (mode==&ModeReadGps) {
+        const GpsSample sample(407000000, -740000000, 1000, 120, 2018, 3, 20, 12, 0, 0, 0);
+        respire.complete(mode, [&sample](AppState &state) {
+          state.setGpsLocation(sample);
+        });
+      }
+      else if (mode==&ModeSendAck || mode==&ModeSendNoAck) {
+        const uint32_t frame = ++_frameCounter;
+        respire.complete(mode, [frame](AppState &state) {
+          state.transmittedFrame(frame);
+        });
+      }
+      else {
+        respire.complete(mode);
+      }
+    }
+  }
+};
+
+void test_no_allocation_after_setup(void) {
+  AppState state;
+  TestClock clock;
+  CompletingExecutor executor;
+  RespireContext<AppState> respire(state, ModeMain, &clock, &executor);
+  respire.init();
+  respire.begin();
+  respire.loop();
+  // setup() is done: from here on the heap must not be touched
+
+  const uint32_t allocs = allocCount();
+  for (uint32_t s = 0; s<2 * 24 * 3600; ++s) {
+    {
+      AppState::Batch batch(state);
+      // Plug and unplug every 6 hours, lose the fix for 10 minutes every hour,
+      // press buttons every 7 seconds.
+      state.setUsbPower((s / (6 * 3600)) % 2 == 0);
+      state.batteryVolts((s % 60) < 30 ? 3.7 : 3.6);
+      state.setGpsFix((s % 3600) >= 600);
+      state.buttonPage((s % 7) == 0);
+      state.buttonField((s % 7) == 3);
+      state.buttonChange((s % 7) == 5);
+      if ((s % 11) == 0) {
+        state.requestRedisplay();
+      }
+    }
+    executor.completeAll(respire);
+    clock.advanceSeconds(1);
+    respire.loop();
+  }
+  TEST_ASSERT(executor._frameCounter > 0);
+  TEST_ASSERT_EQUAL(allocs, allocCount());
 }
 
-void sendLocation(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
-  // Send location
+void test_deferred_executor(void) {
+  AppState state;
+  TestClock clock;
+  DeferredExecutor<2> executor(&clock);
+  mockCallsReset();
+
+  executor.exec(displayStatus, state, state, &ModeDisplayStatus);
+  executor.exec(writeLocation, state, state, &ModeLogGps);
+  executor.exec(attemptJoin, state, state, &ModeAttemptJoin);
+  TEST_ASSERT_EQUAL(0, gMockCallCount);
+  TEST_ASSERT_EQUAL(3, executor.pending());
+
+  // Background ring is full, so this one is dropped, not run inside the update
+  executor.exec(displayBlank, state, state, &ModeDisplayBlank);
+  TEST_ASSERT_EQUAL(0, gMockCallCount);
+  TEST_ASSERT_EQUAL(3, executor.pending());
+  TEST_ASSERT_EQUAL(1, executor.dropped());
+
+  // A zero budget still makes progress, urgent actions first
+  TEST_ASSERT_EQUAL(1, executor.drain(0));
+  TEST_ASSERT(gMockCalls[0]==attemptJoin);
+  TEST_ASSERT_EQUAL(2, executor.drain(1000));
+  TEST_ASSERT(gMockCalls[1]==displayStatus);
+  TEST_ASSERT(gMockCalls[2]==writeLocation);
+  TEST_ASSERT_EQUAL(3, gMockCallCount);
+  TEST_ASSERT_EQUAL(0, executor.pending());
+  TEST_ASSERT_EQUAL(0, executor.drain(1000));
+
+  // Sleep writes the parameter store and SD, so it waits behind the GPS
+  executor.exec(changeSleep, state, state, &ModeSleep);
+  executor.exec(changeGpsPower, state, state, &ModeLowPowerGpsSearch);
+  TEST_ASSERT_EQUAL(2, executor.drain(1000));
+  TEST_ASSERT(gMockCalls[3]==changeGpsPower);
+  TEST_ASSERT(gMockCalls[4]==changeSleep);
+  TEST_ASSERT_EQUAL(1, executor.dropped());
 }
 
-void sendLocationAck(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
-  // Send location
+void test_deferred_executor_runs_outside_update(void) {
+  AppState state;
+  TestClock clock;
+  DeferredExecutor<4> executor(&clock);
+  RespireContext<AppState> respire(state, ModeFunctional, &clock, &executor);
+  respire.init();
+  respire.begin();
+  executor.drain(1000);
+  mockCallsReset();
+
+  state.setUsbPower(true); // Powers on GPS
+  TEST_ASSERT_EQUAL(0, gMockCallCount);
+  TEST_ASSERT(executor.pending() > 0);
+  const uint8_t pending = executor.pending();
+  TEST_ASSERT_EQUAL(pending, executor.drain(1000));
+  TEST_ASSERT_EQUAL(pending, gMockCallCount);
 }
 
-void displayBlank(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
-  Log.Debug("Test displayBlank\n");
+static std::vector<uint8_t> gJournalBytes;
+
+static void journalToMemory(const uint8_t *bytes, uint16_t size) {
+  gJournalBytes.insert(gJournalBytes.end(), bytes, bytes + size);
 }
 
-void displayStatus(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
-  Log.Debug("Test displayStatus\n");
+// Respire store in RAM, for what Respire keeps across a warm boot.
+class MemoryStore : public RespireStore {
+  std::vector<std::string> _names;
+  std::vector<std::vector<uint8_t> > _values;
+
+  int find(const char *name) const {
+    for (size_t i = 0; i<_names.size(); ++i) {
+      if (_names[i]==name) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  public:
+  virtual void beginTransaction() {
+  }
+
+  virtual void endTransaction() {
+  }
+
+  virtual bool load(const char *name, uint8_t *bytes, const uint16_t size) {
+    const int i = find(name);
+    if (i<0 || _values[i].size()!=size) {
+      return false;
+    }
+    memcpy(bytes, _values[i].data(), size);
+    return true;
+  }
+
+  virtual bool load(const char *name, uint32_t *value) {
+    return load(name, (uint8_t *)value, sizeof(*value));
+  }
+
+  virtual bool store(const char *name, const uint8_t *bytes, const uint16_t size) {
+    int i = find(name);
+    if (i<0) {
+      i = _names.size();
+      _names.push_back(name);
+      _values.push_back(std::vector<uint8_t>());
+    }
+    _values[i].assign(bytes, bytes + size);
+    return true;
+  }
+
+  virtual bool store(const char *name, const uint32_t value) {
+    return store(name, (const uint8_t *)&value, sizeof(value));
+  }
+};
+
+// Records a low power join, fix, read and send from a warm boot into
+// gJournalBytes, the way setup() and loop() journal them. Returns the number
+// of checkpoints recorded.
+static uint8_t recordJournal(RespireStore &deviceStore, const GpsSample &sample) {
+  TestClock clock;
+  TestExecutor ops(NULL);
+  Journal journal(&clock, journalToMemory);
+  AppState state;
+  state.setClock(&clock);
+  JournalingContext respire(state, ModeFunctional, &clock, &ops);
+  JournalingStore store(deviceStore, journal);
+  journal.respireInit(1500000000);
+  respire.init(1500000000, &store);
+  journal.boot(state);
+  state.setInputObserver(Journal::observeInputs, &journal);
+  respire.setJournal(&journal);
+  respire.begin();
+
+  clock.advanceSeconds(5);
+  respire.complete(ModeAttemptJoin, [](AppState &state){
+    AppState::Batch batch(state);
+    state.setJoined(true);
+    state.transmittedFrame(1);
+  });
+  respire.loop();
+  journal.activeModes(activeModes(state));
+
+  clock.advanceSeconds(20);
+  state.setGpsFix(true);
+  respire.loop();
+  journal.activeModes(activeModes(state));
+  TEST_ASSERT(ModeReadGps.isActive(state));
+
+  clock.advanceSeconds(1);
+  respire.complete(ModeReadGps, [&sample](AppState &state){
+    state.setGpsLocation(sample);
+  });
+  respire.loop();
+  journal.activeModes(activeModes(state));
+  journal.flush();
+  return 3;
 }
 
-void displayParameters(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
-  Log.Debug("Test displayParameters\n");
+void test_journal_replay(void) {
+  gJournalBytes.clear();
+  GpsSample sample(407000000, -740000000, 1000, 120, 2018, 3, 20, 12, 0, 0, 0);
+  MemoryStore deviceStore;
+  const uint8_t checkpoints = recordJournal(deviceStore, sample);
+
+  // Replay with the real replayer and compare at each checkpoint
+  JournalReplay replay(ModeFunctional);
+  const JournalReplayStats &stats = replay.replay(gJournalBytes.data(), gJournalBytes.size());
+  TEST_ASSERT_EQUAL(gJournalBytes.size(), stats.consumed);
+  TEST_ASSERT_EQUAL(1, stats.boots);
+  TEST_ASSERT_EQUAL(checkpoints, stats.checkpoints);
+  TEST_ASSERT_EQUAL(0, stats.divergences);
+  TEST_ASSERT_EQUAL(0, stats.skipped);
+  TEST_ASSERT(replay.state()!=NULL);
+  TEST_ASSERT(replay.state()->getJoined());
+  TEST_ASSERT(replay.state()->hasGpsFix());
+  TEST_ASSERT_EQUAL(1, replay.state()->ttnFrameCounter());
+  TEST_ASSERT(replay.state()->gpsSample().same(sample));
 }
 
-void displayErrors(const AppState &state, const AppState &oldState, Mode<AppState> *triggeringMode) {
-  Log.Debug("Test displayErrors\n");
+// Values Respire loads at init are journaled and served back to the replay's init.
+void test_journal_store(void) {
+  gJournalBytes.clear();
+  TestClock clock;
+  Journal journal(&clock, journalToMemory);
+  MemoryStore deviceStore;
+  const uint8_t bytes[3] = {1, 2, 3};
+  deviceStore.store("MODEA", bytes, sizeof(bytes));
+  deviceStore.store("MODEB", 42);
+  JournalingStore store(deviceStore, journal);
+  uint8_t loadedBytes[3];
+  uint32_t loaded = 0;
+  TEST_ASSERT(store.load("MODEA", loadedBytes, sizeof(loadedBytes)));
+  TEST_ASSERT(store.load("MODEB", &loaded));
+  TEST_ASSERT(!store.load("MODEC", &loaded));
+  journal.flush();
+
+  JournalReplayStore replayStore;
+  size_t offset = 0;
+  while (offset + sizeof(JournalRecord) <= gJournalBytes.size()) {
+    JournalRecord record;
+    memcpy(&record, &gJournalBytes[offset], sizeof(record));
+    TEST_ASSERT_EQUAL(JournalStoreLoad, record._kind);
+    replayStore.add(record, &gJournalBytes[offset + sizeof(record)]);
+    offset += sizeof(record) + journalPayloadSize(record);
+  }
+  TEST_ASSERT_EQUAL(gJournalBytes.size(), offset);
+  memset(loadedBytes, 0, sizeof(loadedBytes));
+  loaded = 0;
+  TEST_ASSERT(replayStore.load("MODEA", loadedBytes, sizeof(loadedBytes)));
+  TEST_ASSERT_EQUAL(0, memcmp(bytes, loadedBytes, sizeof(bytes)));
+  TEST_ASSERT(replayStore.load("MODEB", &loaded));
+  TEST_ASSERT_EQUAL(42, loaded);
+  TEST_ASSERT(!replayStore.load("MODEA", &loaded)); // Wrong size
+  TEST_ASSERT(!replayStore.load("MODEC", &loaded));
+}
+
+void test_journal_gap(void) {
+  gJournalBytes.clear();
+  TestClock clock;
+  Journal journal(&clock, journalToMemory);
+  uint32_t fits = 0;
+  while (!journal.flushDue()) {
+    journal.activeModes(++fits);
+  }
+  // Nothing reaches the sink until flush(), however full the buffer gets
+  for (uint16_t i = 0; i<100; ++i) {
+    journal.activeModes(fits + 1 + i);
+  }
+  TEST_ASSERT_EQUAL(0, gJournalBytes.size());
+  journal.flush();
+  const size_t kept = gJournalBytes.size() / sizeof(JournalRecord);
+  TEST_ASSERT_EQUAL(0, gJournalBytes.size() % sizeof(JournalRecord));
+  TEST_ASSERT(fits < kept);
+  TEST_ASSERT(kept < fits + 100);
+
+  // The records that didn't fit are counted in a gap record, flushed next
+  journal.flush();
+  TEST_ASSERT_EQUAL((kept + 1) * sizeof(JournalRecord), gJournalBytes.size());
+  JournalRecord gap;
+  memcpy(&gap, &gJournalBytes[kept * sizeof(JournalRecord)], sizeof(gap));
+  TEST_ASSERT_EQUAL(JournalGap, gap._kind);
+  TEST_ASSERT_EQUAL(fits + 100 - kept, gap._value32);
+}
+
+void test_byte_ring(void) {
+  ByteRing<8> ring;
+  uint8_t out[8];
+  TEST_ASSERT_EQUAL(7, ring.capacity());
+  TEST_ASSERT_EQUAL(0, ring.pop(out, sizeof(out)));
+
+  // Fill past capacity: the extra bytes are dropped and counted
+  for (uint8_t i = 0; i<10; ++i) {
+    TEST_ASSERT_EQUAL(i<7, ring.push(i));
+  }
+  TEST_ASSERT_EQUAL(7, ring.available());
+  TEST_ASSERT_EQUAL(10, ring.received());
+  TEST_ASSERT_EQUAL(3, ring.dropped());
+  TEST_ASSERT_EQUAL(7, ring.highWater());
+
+  // Partial drain, then refill across the end of the buffer
+  TEST_ASSERT_EQUAL(5, ring.pop(out, 5));
+  TEST_ASSERT_EQUAL(4, out[4]);
+  for (uint8_t i = 10; i<15; ++i) {
+    TEST_ASSERT(ring.push(i));
+  }
+  TEST_ASSERT_EQUAL(7, ring.available());
+  TEST_ASSERT_EQUAL(7, ring.pop(out, sizeof(out)));
+  const uint8_t expected[] = {5, 6, 10, 11, 12, 13, 14};
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, out, sizeof(expected));
+  TEST_ASSERT_EQUAL(0, ring.available());
+  TEST_ASSERT_EQUAL(3, ring.dropped());
+  TEST_ASSERT_EQUAL(7, ring.highWater());
+}
+
+static NmeaResult feedNmea(NmeaParser &parser, const char *text) {
+  NmeaResult last = NmeaNone;
+  for (const char *c = text; *c; ++c) {
+    const NmeaResult result = parser.feed(*c);
+    if (result!=NmeaNone) {
+      last = result;
+    }
+  }
+  return last;
+}
+
+void test_nmea_parser(void) {
+  NmeaParser parser;
+  TEST_ASSERT_EQUAL(NmeaGga, feedNmea(parser, "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47\r\n"));
+  TEST_ASSERT_FALSE(parser.hasSample()); // No date until an RMC
+  TEST_ASSERT_EQUAL(NmeaRmc, feedNmea(parser, "$GPRMC,123519,A,4807.038,N,01131.000,E,022.4,084.4,230324,003.1,W*61\r\n"));
+  TEST_ASSERT(parser.hasSample());
+
+  const NmeaFix &fix = parser.fix();
+  TEST_ASSERT_EQUAL(481173000, fix._latitude);   // 48 + 7.038/60
+  TEST_ASSERT_EQUAL(115166667, fix._longitude);  // 11 + 31/60
+  TEST_ASSERT_EQUAL(54540, fix._altitude);
+  TEST_ASSERT_EQUAL(90, fix._HDOP);
+  TEST_ASSERT_EQUAL(1, fix._quality);
+  TEST_ASSERT_EQUAL(8, fix._satellites);
+  TEST_ASSERT_EQUAL(2240, fix._speed);
+  TEST_ASSERT_EQUAL(8440, fix._course);
+  TEST_ASSERT(fix._valid);
+  TEST_ASSERT_EQUAL(12, fix._hour);
+  TEST_ASSERT_EQUAL(35, fix._minute);
+  TEST_ASSERT_EQUAL(19, fix._seconds);
+
+  const GpsSample sample = parser.sample();
+  TEST_ASSERT_EQUAL(481173000, sample._latitude);
+  TEST_ASSERT_EQUAL(115166667, sample._longitude);
+  TEST_ASSERT_EQUAL(54540, sample._altitude);
+  TEST_ASSERT_EQUAL(90, sample._HDOP);
+  TEST_ASSERT_EQUAL(2024, sample._year);
+  TEST_ASSERT_EQUAL(3, sample._month);
+  TEST_ASSERT_EQUAL(23, sample._day);
+
+  // Southern/western hemisphere, other talker, with milliseconds
+  TEST_ASSERT_EQUAL(NmeaGga, feedNmea(parser, "$GNGGA,010203.250,3351.8000,S,15112.6000,W,2,10,1.25,-3.5,M,,,,*0A\r\n"));
+  TEST_ASSERT_EQUAL(-338633333, fix._latitude);
+  TEST_ASSERT_EQUAL(-1512100000, fix._longitude);
+  TEST_ASSERT_EQUAL(-350, fix._altitude);
+  TEST_ASSERT_EQUAL(125, fix._HDOP);
+  TEST_ASSERT_EQUAL(250, fix._millis);
+  TEST_ASSERT_EQUAL(0, parser.invalid());
+
+  // A bad checksum leaves the fix untouched
+  TEST_ASSERT_EQUAL(NmeaInvalid, feedNmea(parser, "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*48\r\n"));
+  TEST_ASSERT_EQUAL(-338633333, fix._latitude);
+  // So does a sentence cut short by the next one
+  TEST_ASSERT_EQUAL(NmeaInvalid, feedNmea(parser, "$GPGGA,123519,4807.0$"));
+  TEST_ASSERT_EQUAL(NmeaOther, feedNmea(parser, "GPGSA,A,3,,,,,,,,,,,,,2.1,1.0,1.8*39\r\n"));
+  TEST_ASSERT_EQUAL(2, parser.invalid());
+  TEST_ASSERT_EQUAL(4, parser.sentences());
+
+  // Bytes may arrive in any grouping, including noise between sentences
+  NmeaParser split;
+  const char *text = "noise\r\n$GPRMC,123519,A,4807.038,N,01131.000,E,022.4,084.4,230324,003.1,W*61\r\n";
+  const char *end = strchr(text, '*') + 2;
+  for (const char *c = text; *c; ++c) {
+    TEST_ASSERT_EQUAL(c==end ? NmeaRmc : NmeaNone, split.feed(*c));
+  }
+}
+
+static void putU32(uint8_t *bytes, uint32_t value) {
+  for (uint8_t i = 0; i<4; ++i) {
+    bytes[i] = value >> (8 * i);
+  }
+}
+
+void test_mtk_binary_parser(void) {
+  uint8_t packet[3 + MtkBinaryParser::kPayloadSize + 2] = {MtkBinaryParser::kPreamble1, MtkBinaryParser::kPreamble2, MtkBinaryParser::kPayloadSize};
+  uint8_t *payload = packet + 3;
+  putU32(payload + 0, 481173000);
+  putU32(payload + 4, (uint32_t)-738634500);
+  putU32(payload + 8, 54540);
+  putU32(payload + 12, 1152);       // cm/s
+  putU32(payload + 16, 8440);
+  payload[20] = 8;
+  payload[21] = 3;                  // 3D fix
+  putU32(payload + 22, 230324);
+  putU32(payload + 26, 123519250);
+  payload[30] = 90;
+  payload[31] = 0;
+  uint8_t ckA = 0, ckB = 0;
+  for (uint8_t i = 2; i<3 + MtkBinaryParser::kPayloadSize; ++i) {
+    ckB += (ckA += packet[i]);
+  }
+  packet[sizeof(packet) - 2] = ckA;
+  packet[sizeof(packet) - 1] = ckB;
+
+  MtkBinaryParser parser;
+  // Leftover NMEA from before the switch to binary is skipped
+  for (const char *c = "$GPGGA,123519,,,,,0,00,,,M,,M,,*66\r\n"; *c; ++c) {
+    TEST_ASSERT_EQUAL(NmeaNone, parser.feed(*c));
+  }
+  for (uint8_t i = 0; i<sizeof(packet); ++i) {
+    TEST_ASSERT_EQUAL(i==sizeof(packet) - 1 ? NmeaGga : NmeaNone, parser.feed(packet[i]));
+  }
+  TEST_ASSERT(parser.hasSample());
+  const NmeaFix &fix = parser.fix();
+  TEST_ASSERT_EQUAL(481173000, fix._latitude);
+  TEST_ASSERT_EQUAL(-738634500, fix._longitude);
+  TEST_ASSERT_EQUAL(54540, fix._altitude);
+  TEST_ASSERT_EQUAL(90, fix._HDOP);
+  TEST_ASSERT_EQUAL(8, fix._satellites);
+  TEST_ASSERT_EQUAL(2239, fix._speed);      // 22.39 knots
+  TEST_ASSERT_EQUAL(8440, fix._course);
+  TEST_ASSERT_EQUAL(2024, fix._year);
+  TEST_ASSERT_EQUAL(3, fix._month);
+  TEST_ASSERT_EQUAL(23, fix._day);
+  TEST_ASSERT_EQUAL(12, fix._hour);
+  TEST_ASSERT_EQUAL(35, fix._minute);
+  TEST_ASSERT_EQUAL(19, fix._seconds);
+  TEST_ASSERT_EQUAL(250, fix._millis);
+  TEST_ASSERT_EQUAL(1, parser.sentences());
+
+  // A corrupted packet is rejected and leaves the fix alone
+  payload[0] ^= 0x10;
+  NmeaResult last = NmeaNone;
+  for (uint8_t i = 0; i<sizeof(packet); ++i) {
+    const NmeaResult result = parser.feed(packet[i]);
+    last = result!=NmeaNone ? result : last;
+  }
+  TEST_ASSERT_EQUAL(NmeaInvalid, last);
+  TEST_ASSERT_EQUAL(481173000, fix._latitude);
+  TEST_ASSERT_EQUAL(1, parser.invalid());
+}
+
+void test_gps_phase(void) {
+  TestClock clock;
+  TestExecutor executor(NULL); // Not checked; only the phase matters here
+  AppState state;
+  RespireContext<AppState> respire(state, ModeFunctional, &clock, &executor);
+  respire.init();
+  respire.begin();
+
+  TEST_ASSERT_EQUAL(GpsPhaseOff, gpsPhase(state));
+  state.setUsbPower(true);
+  TEST_ASSERT_EQUAL(GpsPhaseIdle, gpsPhase(state)); // Searching
+  {
+    StateTransaction<AppState> t(respire);
+    respire.complete(ModeAttemptJoin, [](AppState &state){
+      state.setJoined(true);
+    });
+    state.setGpsFix(true);
+  }
+  TEST_ASSERT(ModeReadGps.isActive(state));
+  TEST_ASSERT_EQUAL(GpsPhaseRead, gpsPhase(state));
+
+  respire.complete(ModeReadGps, [](AppState &state) {
+    GpsSample sample(450000000, 450000000, 4500, 150, 2018, 03, 20, 12, 00, 00, 0000);
+    state.setGpsLocation(sample);
+  });
+  TEST_ASSERT(ModeSend.isActive(state));
+  TEST_ASSERT_EQUAL(GpsPhaseIdle, gpsPhase(state));
+  respire.complete(ModeSendAck);
+  TEST_ASSERT(ModeLogGps.isActive(state));
+  TEST_ASSERT_EQUAL(GpsPhaseTrack, gpsPhase(state));
+  respire.complete(ModeLogGps);
+  TEST_ASSERT_EQUAL(GpsPhaseIdle, gpsPhase(state));
+
+  // Parked: periodic until it moves or loses its fix
+  state.setStationary(true);
+  TEST_ASSERT_EQUAL(GpsPhasePark, gpsPhase(state));
+  state.setGpsFix(false);
+  TEST_ASSERT_EQUAL(GpsPhaseIdle, gpsPhase(state));
+  state.setGpsFix(true);
+  TEST_ASSERT_EQUAL(GpsPhasePark, gpsPhase(state));
+  state.setStationary(false);
+  TEST_ASSERT_EQUAL(GpsPhaseIdle, gpsPhase(state));
+
+  state.setUsbPower(false);
+  TEST_ASSERT_EQUAL(GpsPhaseOff, gpsPhase(state));
+
+  // Commands carry computed checksums; these match Adafruit_GPS's constants
+  char sentence[64];
+  TEST_ASSERT(gpsOutputSentence(sentence, sizeof(sentence), gpsOutput(GpsPhaseTrack))>0);
+  TEST_ASSERT_EQUAL_STRING("$PMTK314,0,1,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0*28\r\n", sentence);
+  TEST_ASSERT(gpsRateSentence(sentence, sizeof(sentence), gpsOutput(GpsPhaseTrack))>0);
+  TEST_ASSERT_EQUAL_STRING("$PMTK220,200*2C\r\n", sentence);
+  TEST_ASSERT(gpsRateSentence(sentence, sizeof(sentence), gpsOutput(GpsPhaseIdle))>0);
+  TEST_ASSERT_EQUAL_STRING("$PMTK220,1000*1F\r\n", sentence);
+  TEST_ASSERT_EQUAL(0, gpsOutputSentence(sentence, 20, gpsOutput(GpsPhaseIdle)));
+  TEST_ASSERT(gpsPeriodicSentence(sentence, sizeof(sentence), gpsOutput(GpsPhasePark))>0);
+  TEST_ASSERT_EQUAL_STRING("$PMTK225,2,6000,54000,18000,54000*16\r\n", sentence);
+  TEST_ASSERT(gpsPeriodicSentence(sentence, sizeof(sentence), gpsOutput(GpsPhaseIdle))>0);
+  TEST_ASSERT_EQUAL_STRING("$PMTK225,0*2B\r\n", sentence);
+}
+
+void test_gps_fix_detector(void) {
+  GpsFixDetector detector;
+  TEST_ASSERT_FALSE(detector.fix(0)); // Not started
+
+  uint32_t t = 1000;
+  detector.start(false, t);
+  TEST_ASSERT_FALSE(detector.fix(t + 1000));
+
+  // No fix: 1s high, 1s low
+  for (uint8_t i = 0; i<3; ++i) {
+    detector.edge(true, t += 1000);
+    TEST_ASSERT_FALSE(detector.fix(t + 400));
+    detector.edge(false, t += 1000);
+    TEST_ASSERT_FALSE(detector.fix(t + 900));
+  }
+  // Fix: the pin stays low, which is reported before the next pulse...
+  TEST_ASSERT_FALSE(detector.fix(t + GpsFixDetector::kMaxNoFixGap));
+  TEST_ASSERT(detector.fix(t + GpsFixDetector::kMaxNoFixGap + 1));
+  // ...and the 200ms pulses every 15s keep it
+  for (uint8_t i = 0; i<3; ++i) {
+    detector.edge(true, t += 14800);
+    TEST_ASSERT(detector.fix(t + 200));
+    detector.edge(false, t += 200);
+    TEST_ASSERT(detector.fix(t + 10000));
+    detector.edge(false, t + 5); // Repeated level is ignored
+    TEST_ASSERT(detector.fix(t + 10000));
+  }
+
+  // Losing fix shows half a second into the first long pulse
+  detector.edge(true, t += 14800);
+  TEST_ASSERT(detector.fix(t + GpsFixDetector::kMaxFixPulse));
+  TEST_ASSERT_FALSE(detector.fix(t + GpsFixDetector::kMaxFixPulse + 1));
+  detector.edge(false, t += 1000);
+  TEST_ASSERT_FALSE(detector.fix(t + 900));
+
+  // Powered off: no fix, whatever the pin does
+  detector.stop();
+  TEST_ASSERT_FALSE(detector.fix(t + 10000));
+  detector.edge(true, t += 200);
+  detector.edge(false, t += 200);
+  TEST_ASSERT_FALSE(detector.fix(t + 10000));
+}
+
+static NmeaFix samplerFix(int32_t latitude, int32_t longitude, uint16_t hdop, uint8_t satellites, uint8_t seconds) {
+  NmeaFix fix;
+  fix._latitude = latitude;
+  fix._longitude = longitude;
+  fix._altitude = 1000;
+  fix._HDOP = hdop;
+  fix._quality = 1;
+  fix._satellites = satellites;
+  fix._year = 2024;
+  fix._month = 3;
+  fix._day = 23;
+  fix._seconds = seconds;
+  return fix;
+}
+
+void test_gps_sampler(void) {
+  GpsSamplerConfig config;
+  config.count = 4;
+  GpsSampler sampler(config);
+  NmeaFix result;
+
+  sampler.start(1000);
+  TEST_ASSERT(sampler.active());
+  TEST_ASSERT_FALSE(sampler.done(1000));
+
+  // Rejected: no position, HDOP over the limit, too few satellites
+  NmeaFix none = samplerFix(0, 0, 100, 8, 0);
+  none._quality = 0;
+  sampler.add(none);
+  sampler.add(samplerFix(407000000, -740000000, 900, 8, 1));
+  sampler.add(samplerFix(407000000, -740000000, 100, 3, 2));
+  TEST_ASSERT_EQUAL(0, sampler.accepted());
+  TEST_ASSERT_EQUAL(3, sampler.rejected());
+
+  // The 300 is more than 1.5x the best and is left out of the average
+  sampler.add(samplerFix(407000010, -740000010, 120, 7, 3));
+  sampler.add(samplerFix(407000300, -740000300, 300, 5, 4));
+  sampler.add(samplerFix(407000020, -740000020, 100, 9, 5));
+  TEST_ASSERT_FALSE(sampler.done(1000));
+  sampler.add(samplerFix(407000030, -740000030, 140, 6, 6));
+  TEST_ASSERT(sampler.done(1000));
+  sampler.add(samplerFix(0, 0, 100, 9, 7)); // Full; ignored
+  TEST_ASSERT_EQUAL(4, sampler.accepted());
+
+  TEST_ASSERT(sampler.finish(result));
+  TEST_ASSERT_FALSE(sampler.active());
+  TEST_ASSERT_FALSE(sampler.done(1000));
+  TEST_ASSERT_EQUAL(407000020, result._latitude);
+  TEST_ASSERT_EQUAL(-740000020, result._longitude);
+  TEST_ASSERT_EQUAL(1000, result._altitude);
+  TEST_ASSERT_EQUAL(120, result._HDOP);
+  TEST_ASSERT_EQUAL(6, result._satellites);
+  TEST_ASSERT_EQUAL(6, result._seconds);
+  TEST_ASSERT_EQUAL(2024, result._year);
+  TEST_ASSERT_EQUAL(4, sampler.rejected());
+
+  // Best mode takes the latest of the lowest HDOP as is
+  config.mode = GpsSamplerBest;
+  GpsSampler best(config);
+  best.start(0);
+  best.add(samplerFix(407000010, -740000010, 100, 7, 1));
+  best.add(samplerFix(407000020, -740000020, 200, 9, 2));
+  best.add(samplerFix(407000030, -740000030, 100, 6, 3));
+  TEST_ASSERT(best.finish(result));
+  TEST_ASSERT_EQUAL(407000030, result._latitude);
+  TEST_ASSERT_EQUAL(100, result._HDOP);
+  TEST_ASSERT_EQUAL(3, result._seconds);
+
+  // The window closes with what there is, or with nothing
+  best.start(5000);
+  best.add(samplerFix(407000040, -740000040, 150, 7, 4));
+  TEST_ASSERT_FALSE(best.done(5000 + config.windowMs - 1));
+  TEST_ASSERT(best.done(5000 + config.windowMs));
+  TEST_ASSERT(best.finish(result));
+  TEST_ASSERT_EQUAL(407000040, result._latitude);
+
+  best.start(20000);
+  TEST_ASSERT(best.done(20000 + config.windowMs));
+  TEST_ASSERT_FALSE(best.finish(result));
+}
+
+void test_gps_assist(void) {
+  GpsAssist assist;
+  TEST_ASSERT(assist.valid());
+  char sentence[96];
+
+  // Nothing to inject without the time; just the time without a position
+  TEST_ASSERT_EQUAL(0, gpsAssistSentence(sentence, sizeof(sentence), assist, 0));
+  TEST_ASSERT(gpsAssistSentence(sentence, sizeof(sentence), assist, 1711200000)>0);
+  TEST_ASSERT_EQUAL_STRING("$PMTK740,2024,03,23,13,20,00*37\r\n", sentence);
+  TEST_ASSERT(gpsAssistSentence(sentence, sizeof(sentence), assist, 1709164800)>0);
+  TEST_ASSERT_EQUAL_STRING("$PMTK740,2024,02,29,00,00,00*3C\r\n", sentence);
+  TEST_ASSERT(gpsAssistSentence(sentence, sizeof(sentence), assist, 4107542399)>0);
+  TEST_ASSERT_EQUAL_STRING("$PMTK740,2100,02,28,23,59,59*3B\r\n", sentence);
+
+  // A fix without a position leaves it unknown
+  NmeaFix fix;
+  fix._latitude = 407127753;
+  fix._longitude = -740059728;
+  fix._altitude = 1234;
+  assist.setPosition(fix);
+  TEST_ASSERT_FALSE(assist._hasPosition);
+  fix._quality = 1;
+  assist.setPosition(fix);
+  TEST_ASSERT(assist._hasPosition);
+  TEST_ASSERT(gpsAssistSentence(sentence, sizeof(sentence), assist, 1711200000)>0);
+  TEST_ASSERT_EQUAL_STRING("$PMTK741,40.712775,-74.005972,12,2024,03,23,13,20,00*3B\r\n", sentence);
+  TEST_ASSERT_EQUAL(0, gpsAssistSentence(sentence, 32, assist, 1711200000));
+
+  // TTFF is timed from power up to the first fix of each cycle
+  GpsTtff ttff;
+  uint32_t ttffMs = 0;
+  TEST_ASSERT_FALSE(ttff.fix(100, ttffMs)); // Not started
+  TEST_ASSERT(ttff.stop());
+
+  ttff.start(1000);
+  TEST_ASSERT_EQUAL(20000, ttff.searchingMs(21000));
+  TEST_ASSERT(ttff.fix(33000, ttffMs));
+  TEST_ASSERT_EQUAL(32000, ttffMs);
+  TEST_ASSERT_EQUAL(0, ttff.searchingMs(34000));
+  assist.recordFix(ttffMs, 1711200000);
+  TEST_ASSERT_FALSE(ttff.fix(34000, ttffMs)); // Only the first counts
+  TEST_ASSERT(ttff.stop());
+
+  ttff.start(50000);
+  TEST_ASSERT(ttff.fix(54000, ttffMs));
+  assist.recordFix(ttffMs, 1711200060);
+  TEST_ASSERT(ttff.stop());
+
+  ttff.start(60000);
+  TEST_ASSERT_FALSE(ttff.stop()); // Powered down without a fix
+  assist.recordMiss();
+
+  TEST_ASSERT_EQUAL(0, assist._lastTtffMs);
+  TEST_ASSERT_EQUAL((32000 * 3 + 4000) / 4, assist._meanTtffMs);
+  TEST_ASSERT_EQUAL(2, assist._fixes);
+  TEST_ASSERT_EQUAL(1, assist._misses);
+  TEST_ASSERT_EQUAL(25, assist._missPercent);
+  TEST_ASSERT_EQUAL(1711200060, assist._fixSeconds);
+
+  // Searches last three mean TTFFs, and longer the more often they fail
+  GpsSearchLimits limits;
+  TEST_ASSERT_EQUAL(GPS_SEARCH_MAX_MS, gpsSearchWindow(GpsAssist(), 1711200100, limits)); // No history
+  TEST_ASSERT_EQUAL(GPS_SEARCH_MAX_MS, gpsSearchWindow(assist, 0, limits));               // No time
+  TEST_ASSERT_EQUAL(GPS_SEARCH_MAX_MS, gpsSearchWindow(assist, 1711200060 + 5 * 3600, limits)); // Ephemeris expired
+  const uint32_t window = assist._meanTtffMs * 3;
+  TEST_ASSERT_EQUAL(window + (GPS_SEARCH_MAX_MS - window) / 4, gpsSearchWindow(assist, 1711200100, limits));
+  assist._missPercent = 0;
+  TEST_ASSERT_EQUAL(window, gpsSearchWindow(assist, 1711200100, limits));
+  assist._meanTtffMs = 5000;
+  TEST_ASSERT_EQUAL(GPS_SEARCH_MIN_MS, gpsSearchWindow(assist, 1711200100, limits));
+  assist._meanTtffMs = 200000;
+  TEST_ASSERT_EQUAL(GPS_SEARCH_MAX_MS, gpsSearchWindow(assist, 1711200100, limits));
+  limits.maxMs = 2 * GPS_SEARCH_MAX_MS;
+  TEST_ASSERT_EQUAL(600000, gpsSearchWindow(assist, 1711200100, limits));
+
+  // A stored copy from another layout is not used
+  GpsAssist stored = assist;
+  stored._version = kGpsAssistVersion + 1;
+  TEST_ASSERT_FALSE(stored.valid());
+}
+
+void test_motion_estimator(void) {
+  MotionConfig config;
+  MotionEstimator motion(config);
+  TEST_ASSERT_FALSE(motion.stationary(config.stillMs)); // Not started
+
+  // Moving until a stillMs has passed without movement
+  uint32_t t = 1000;
+  motion.start(t);
+  motion.position(407127753, -740059728, t);
+  TEST_ASSERT_FALSE(motion.stationary(t + config.stillMs - 1));
+  // Jitter: ~20m and a knot or so
+  motion.position(407129553, -740059728, t += 60000);
+  motion.speed(120, t);
+  motion.position(407127753, -740057328, t += 60000);
+  TEST_ASSERT(motion.stationary(1000 + config.stillMs));
+
+  // Speed alone is movement, and the next fix is where it settles
+  motion.speed(config.movingSpeed, t += 60000);
+  motion.position(407127753, -740059728, t);
+  TEST_ASSERT_FALSE(motion.stationary(t + config.stillMs - 1));
+  TEST_ASSERT(motion.stationary(t + config.stillMs));
+
+  // So is a fix ~60m from where it settled, even at walking speed below the
+  // threshold; the anchor then follows it
+  motion.position(407133153, -740059728, t += config.stillMs);
+  TEST_ASSERT_FALSE(motion.stationary(t));
+  motion.position(407133153, -740059728, t + 1000);
+  TEST_ASSERT_FALSE(motion.stationary(t + config.stillMs - 1));
+  TEST_ASSERT(motion.stationary(t + config.stillMs));
+
+  // East-west distance shrinks with latitude: 0.0005 degrees is ~56m at the
+  // equator but only ~42m at 40N
+  motion.position(407133153, -740054728, t += config.stillMs);
+  TEST_ASSERT(motion.stationary(t));
+  motion.position(0, 0, t += 1000);
+  TEST_ASSERT_FALSE(motion.stationary(t + config.stillMs - 1));
+  motion.position(0, 5000, t + config.stillMs - 1);
+  TEST_ASSERT_FALSE(motion.stationary(t + config.stillMs));
+
+  motion.stop(t + config.stillMs);
+  TEST_ASSERT_FALSE(motion.stationary(t + 10 * config.stillMs));
+  motion.start(t += 10 * config.stillMs);
+  TEST_ASSERT_FALSE(motion.stationary(t + config.stillMs - 1)); // Moving when stopped
+
+  // Parked when stopped: stays parked while off and after the next power up
+  motion.position(0, 0, t);
+  motion.stop(t += config.stillMs);
+  TEST_ASSERT(motion.stationary(t + 10 * config.stillMs));
+  motion.start(t += 10 * config.stillMs);
+  TEST_ASSERT(motion.stationary(t));
+  motion.position(0, 3000, t += 1000);                         // Jitter
+  TEST_ASSERT(motion.stationary(t));
+  int32_t latitude, longitude;
+  motion.stop(t);
+  TEST_ASSERT(motion.parked(latitude, longitude));
+  TEST_ASSERT_EQUAL(0, latitude);
+  TEST_ASSERT_EQUAL(0, longitude);
+
+  // Until a fix shows it was moved while off
+  motion.start(t += 1000);
+  motion.position(0, 10000, t);
+  TEST_ASSERT_FALSE(motion.stationary(t));
+  motion.stop(t + 1000);
+  TEST_ASSERT_FALSE(motion.parked(latitude, longitude));
+
+  // Restored after a reset
+  MotionEstimator restored(config);
+  restored.park(407127753, -740059728);
+  TEST_ASSERT(restored.stationary(0));
+  restored.start(5000);
+  restored.position(407127753, -740059728, 6000);
+  TEST_ASSERT(restored.stationary(6000));
+  restored.speed(config.movingSpeed, 7000);
+  TEST_ASSERT_FALSE(restored.stationary(7000));
+}
+
+// The packet encoding from when GpsSample held floats, as it shipped: the
+// parser's fixed point divided down to float, then scaled in float.
+static void floatPacket(uint8_t *packet, int32_t latitude, int32_t longitude, int32_t altitude, uint16_t HDOP) {
+  const float latitudeDegrees = latitude / 1e7f;
+  const float longitudeDegrees = longitude / 1e7f;
+  const float altitudeMeters = altitude / 100.0f;
+  const float hdopFloat = HDOP / 100.0f;
+  const int32_t lat = latitudeDegrees * 93206;
+  const int32_t lon = longitudeDegrees * 46603;
+  const int16_t alt = altitudeMeters;
+  const int16_t hdop = hdopFloat * 1000;
+  packet[0] = lat >> 16; packet[1] = lat >> 8; packet[2] = lat;
+  packet[3] = lon >> 16; packet[4] = lon >> 8; packet[5] = lon;
+  packet[6] = alt >> 8; packet[7] = alt;
+  packet[8] = hdop >> 8; packet[9] = hdop;
+}
+
+// Packets written by the float GpsSample before it went fixed point. Chosen
+// where float rounding moves the result off the exact truncated value, as well
+// as at the extremes.
+static const struct {
+  int32_t latitude;
+  int32_t longitude;
+  int32_t altitude;
+  uint16_t HDOP;
+  uint8_t packet[10];
+} kFloatPackets[] = {
+  {407000000, -740000000, 1000, 120, {0x39, 0xE2, 0x4C, 0xCB, 0x60, 0xD2, 0x00, 0x0A, 0x04, 0xB0}},
+  {407127753, -740059720, 1530, 95, {0x39, 0xE6, 0xF3, 0xCB, 0x5F, 0xBC, 0x00, 0x0F, 0x03, 0xB6}},
+  {-338688000, 1512093000, 5800, 210, {0xCF, 0xD4, 0xD9, 0x6B, 0x86, 0x97, 0x00, 0x3A, 0x08, 0x34}},
+  {515007000, -1278000, 3500, 80, {0x49, 0x3E, 0xAE, 0xFF, 0xE8, 0xBD, 0x00, 0x23, 0x03, 0x20}},
+  {-228000000, -432000000, -150, 3000, {0xDF, 0x92, 0xD8, 0xE1, 0x47, 0xBF, 0xFF, 0xFF, 0x75, 0x30}},
+  {899999999, 1799999999, 884800, 50, {0x7F, 0xFF, 0xBC, 0x7F, 0xFF, 0xBC, 0x22, 0x90, 0x01, 0xF4}},
+  {-900000000, -1800000000, -43000, 99, {0x80, 0x00, 0x44, 0x80, 0x00, 0x44, 0xFE, 0x52, 0x03, 0xDE}},
+  {0, 0, 0, 0, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}},
+  {1, -1, 1, 1, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0A}},
+  {123456789, -98765432, -1, 1234, {0x11, 0x8E, 0xE3, 0xF8, 0xFA, 0x0C, 0x00, 0x00, 0x30, 0x34}},
+  {-1, 1, -99, 2500, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x61, 0xA8}},
+  {356762000, 1396503000, 4000, 150, {0x32, 0xBD, 0x33, 0x63, 0x4E, 0x5B, 0x00, 0x28, 0x05, 0xDC}},
+};
+
+void test_gps_sample_packet(void) {
+  uint8_t packet[10], expected[10];
+  for (uint8_t i = 0; i<sizeof(kFloatPackets) / sizeof(kFloatPackets[0]); ++i) {
+    const GpsSample sample(kFloatPackets[i].latitude, kFloatPackets[i].longitude, kFloatPackets[i].altitude, kFloatPackets[i].HDOP, 2018, 3, 20, 12, 0, 0, 0);
+    TEST_ASSERT_EQUAL(10, sample.writePacket(packet, sizeof(packet)));
+    TEST_ASSERT_EQUAL(0, memcmp(kFloatPackets[i].packet, packet, sizeof(packet)));
+  }
+
+  // Byte for byte the float encoding across the globe, below sea level and at poor HDOP
+  uint32_t random = 1;
+  for (uint16_t i = 0; i<2000; ++i) {
+    random = random * 1103515245 + 12345;
+    const int32_t latitude = (int32_t)(random % 1800000001) - 900000000;
+    random = random * 1103515245 + 12345;
+    const int32_t longitude = (int32_t)((int64_t)(random % 3600000001u) - 1800000000);
+    const int32_t altitude = (int32_t)(random % 1000000) - 50000;
+    const uint16_t HDOP = random % 3000;
+    GpsSample(latitude, longitude, altitude, HDOP, 2018, 3, 20, 12, 0, 0, 0).writePacket(packet, sizeof(packet));
+    floatPacket(expected, latitude, longitude, altitude, HDOP);
+    TEST_ASSERT_EQUAL(0, memcmp(expected, packet, sizeof(packet)));
+  }
+
+  char text[16];
+  TEST_ASSERT_EQUAL(10, formatFixedPoint(text, 407127753, 7));
+  TEST_ASSERT_EQUAL_STRING("40.7127753", text);
+  formatFixedPoint(text, -740059720, 7);
+  TEST_ASSERT_EQUAL_STRING("-74.0059720", text);
+  formatFixedPoint(text, -5, 2);
+  TEST_ASSERT_EQUAL_STRING("-0.05", text);
+  formatFixedPoint(text, 1410, 2);
+  TEST_ASSERT_EQUAL_STRING("14.10", text);
+}
+
+typedef struct ReaderResult {
+  uint8_t successes = 0;
+  uint8_t failures = 0;
+  GpsSample sample;
+} ReaderResult;
+
+static void readerSuccess(const GpsSample &sample, void *context) {
+  ReaderResult &result = *(ReaderResult *)context;
+  ++result.successes;
+  result.sample = sample;
+}
+
+static void readerFailure(void *context) {
+  ++((ReaderResult *)context)->failures;
+}
+
+// Replays source into reader in 10ms steps from `from` until `to`.
+static void replayReader(NmeaReplaySource &source, GpsReader &reader, uint32_t from, uint32_t to) {
+  for (uint32_t t = from; t<to; t += 10) {
+    source.setTime(t);
+    reader.loop(t);
+  }
+}
+
+void test_gps_reader(void) {
+  // Eight 1Hz fixes across midnight: two away from the rest, then three good
+  // ones, one after midnight, and two without a fix
+  std::vector<std::string> lines;
+  for (uint8_t i = 0; i<8; ++i) {
+    const uint32_t seconds = (23 * 3600 + 59 * 60 + 55 + i) % (24 * 3600);
+    char time[12], body[80], sentence[96];
+    snprintf(time, sizeof(time), "%02u%02u%02u.000", seconds / 3600, seconds / 60 % 60, seconds % 60);
+    snprintf(body, sizeof(body), "GPGGA,%s,%s,N,07400.0000,W,%d,08,1.00,15.0,M,-34.2,M,,", time, i<2 ? "4100.0000" : "4042.0000", i<6 ? 1 : 0);
+    nmeaSentence(sentence, sizeof(sentence), body);
+    lines.push_back(sentence);
+    snprintf(body, sizeof(body), "GPRMC,%s,A,4042.0000,N,07400.0000,W,0.10,0.00,%s,,,A", time, i<5 ? "160326" : "170326");
+    nmeaSentence(sentence, sizeof(sentence), body);
+    lines.push_back(sentence);
+  }
+  NmeaReplaySource source(lines);
+
+  // Each fix arrives at its time, at 960 bytes/s
+  source.setTime(0);
+  TEST_ASSERT_EQUAL(0, source.available());
+  source.setTime(50);
+  TEST_ASSERT_EQUAL(48, source.available());
+  source.setTime(999);
+  TEST_ASSERT_EQUAL(lines[0].size() + lines[1].size(), source.available());
+  source.setTime(1000);
+  TEST_ASSERT_EQUAL(lines[0].size() + lines[1].size(), source.available());
+  source.setTime(1010);
+  TEST_ASSERT_EQUAL(lines[0].size() + lines[1].size() + 9, source.available());
+
+  GpsSamplerConfig config;
+  config.count = 3;
+  GpsReader reader(source, config);
+  ReaderResult result;
+  replayReader(source, reader, 1010, 1500);
+  TEST_ASSERT_FALSE(reader.reading());
+
+  // Only fixes after the read count
+  reader.read(readerSuccess, readerFailure, &result, 1500);
+  TEST_ASSERT(reader.reading());
+  replayReader(source, reader, 1500, 4000);
+  TEST_ASSERT_EQUAL(0, result.successes);
+  replayReader(source, reader, 4000, 4200);
+  TEST_ASSERT_EQUAL(1, result.successes);
+  TEST_ASSERT_FALSE(reader.reading());
+  TEST_ASSERT_EQUAL(407000000, result.sample._latitude);
+  TEST_ASSERT_EQUAL(-740000000, result.sample._longitude);
+  TEST_ASSERT_EQUAL(23, result.sample._hour);
+  TEST_ASSERT_EQUAL(59, result.sample._seconds);
+  TEST_ASSERT_EQUAL(16, result.sample._day);
+
+  // After midnight, one fix comes before the window closes
+  replayReader(source, reader, 4200, 4500);
+  reader.read(readerSuccess, readerFailure, &result, 4500);
+  replayReader(source, reader, 4500, 14500);
+  TEST_ASSERT_EQUAL(1, result.successes);
+  replayReader(source, reader, 14500, 14510);
+  TEST_ASSERT_EQUAL(2, result.successes);
+  TEST_ASSERT_EQUAL(0, result.sample._hour);
+  TEST_ASSERT_EQUAL(0, result.sample._seconds);
+
+  // Nothing more arrives, so the last read fails
+  TEST_ASSERT(source.finished());
+  TEST_ASSERT_EQUAL(source.size(), reader.bytesParsed());
+  replayReader(source, reader, 14510, 15000);
+  reader.read(readerSuccess, readerFailure, &result, 15000);
+  replayReader(source, reader, 15000, 25010);
+  TEST_ASSERT_EQUAL(2, result.successes);
+  TEST_ASSERT_EQUAL(1, result.failures);
+  TEST_ASSERT_EQUAL(0, reader.parser().invalid());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    LogPrinter printer(printFn);
+    Log.Init(LOGLEVEL, printer);
+
+    RUN_TEST(test_gps_power_while_power);
+    RUN_TEST(test_join_once_when_low_power_then_sleep_on_fail);
+    RUN_TEST(test_gps_power_and_send_after_low_power_successful_join);
+    RUN_TEST(test_max_limit_on_low_power_gps_search);
+    RUN_TEST(test_gps_search_ends_when_over);
+    RUN_TEST(test_gps_search_waits_while_parked);
+    RUN_TEST(test_time_alone_enters_modes);
+    RUN_TEST(test_join_every_5_min);
+    RUN_TEST(test_send_every_10_min);
+    RUN_TEST(test_display);
+    RUN_TEST(test_update_tracking_matches_copy);
+    RUN_TEST(test_state_copies_are_values);
+    RUN_TEST(test_changes_reports_mutated_field);
+    RUN_TEST(test_batch_runs_one_update);
+    RUN_TEST(test_mode_dependencies);
+    RUN_TEST(test_change_record);
+    RUN_TEST(test_sleep_interval);
+    RUN_TEST(test_simulate_30_days_on_usb);
+    RUN_TEST(test_simulate_battery_then_usb);
+    RUN_TEST(test_simulate_parked_on_battery);
+    RUN_TEST(test_no_allocation_after_setup);
+    RUN_TEST(test_snapshot_restore);
+    RUN_TEST(test_deferred_executor);
+    RUN_TEST(test_deferred_executor_runs_outside_update);
+    RUN_TEST(test_journal_replay);
+    RUN_TEST(test_journal_store);
+    RUN_TEST(test_journal_gap);
+    RUN_TEST(test_byte_ring);
+    RUN_TEST(test_nmea_parser);
+    RUN_TEST(test_mtk_binary_parser);
+    RUN_TEST(test_gps_phase);
+    RUN_TEST(test_gps_fix_detector);
+    RUN_TEST(test_gps_sampler);
+    RUN_TEST(test_gps_assist);
+    RUN_TEST(test_motion_estimator);
+    RUN_TEST(test_gps_reader);
+    RUN_TEST(test_gps_sample_packet);
+    UNITY_END();
+
+    return 0;
 }
 
-#endif
 #endif
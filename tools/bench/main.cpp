@@ -0,0 +1,187 @@
+/*
+  Microbenchmarks for the Respire state engine.
+
+  Measures the hot paths the main loop exercises - AppState mutators (each of
+  which runs a Respire update cycle), Mode::isActive, Mode::maxSleep,
+  RespireContext::loop and RespireContext::complete - on the real mode tree
+  from mm_state.cpp. Actions are mocked and never complete unless a benchmark
+  completes them itself.
+
+  Output is one JSON object per line so runs can be diffed or collected:
+    {"name":"mutator/setUsbPower","iterations":200000,"ns_per_op":412.3,"allocs_per_op":0.00}
+
+  Build and run:
+    pio run -e native_bench && .pio/build/native_bench/program [name-substring]
+ */
+
+#include <Arduino.h>
+#include <Logging.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "mm_state.h"
+#include "../../src_native/alloc_counter.h"
+
+#ifndef ELEMENTS
+#define ELEMENTS(_array) (sizeof(_array) / sizeof(_array[0]))
+#endif
+
+class BenchClock : public Clock {
+  uint32_t _millis = 100000;
+
+  public:
+  virtual uint32_t millis() {
+    return _millis;
+  }
+
+  void advance(uint32_t ms) {
+    _millis += ms;
+  }
+};
+
+class NullExecutor : public Executor<AppState> {
+  public:
+  virtual void exec(Mode<AppState>::ActionFn fn, const AppState &state, const AppState &oldState, Mode<AppState> *trigger) {
+  }
+};
+
+// One device: state and context attached to a root mode.
+class Fixture {
+  public:
+  AppState state;
+  BenchClock clock;
+  NullExecutor executor;
+  RespireContext<AppState> respire;
+
+  Fixture(Mode<AppState> &root)
+  : respire(state, root, &clock, &executor) {
+    state.setClock(&clock);
+    respire.init();
+    respire.begin();
+  }
+
+  // Battery powered, joined, with a fix: the configuration that spends the
+  // most time in the field.
+  void tracking() {
+    AppState::Batch batch(state);
+    state.setUsbPower(false);
+    state.batteryVolts(3.7);
+    state.setJoined(true);
+    state.setGpsFix(true);
+  }
+};
+
+static volatile uint32_t gSink = 0;
+
+typedef void (*BenchFn)(Fixture &fixture, uint32_t i);
+
+typedef struct Bench {
+  const char *name;
+  Mode<AppState> *root;
+  BenchFn op;
+} Bench;
+
+static const Bench kBenches[] = {
+  {"mutator/setUsbPower", &ModeFunctional, [](Fixture &f, uint32_t i) {
+    f.state.setUsbPower(i & 1);
+  }},
+  {"mutator/batteryVolts", &ModeFunctional, [](Fixture &f, uint32_t i) {
+    f.state.batteryVolts((i & 1) ? 3.6 : 3.7);
+  }},
+  {"mutator/setGpsFix", &ModeFunctional, [](Fixture &f, uint32_t i) {
+    f.state.setGpsFix(i & 1);
+  }},
+  {"mutator/setJoined", &ModeFunctional, [](Fixture &f, uint32_t i) {
+    f.state.setJoined(i & 1);
+  }},
+  {"mutator/transmittedFrame", &ModeFunctional, [](Fixture &f, uint32_t i) {
+    f.state.transmittedFrame(i + 1);
+  }},
+  {"mutator/setGpsLocation", &ModeFunctional, [](Fixture &f, uint32_t i) {
+    GpsSample sample(407000000 + (i & 0xFF) * 100, -740000000, 1000, 120, 2018, 3, 20, 12, 0, i % 60, 0);
+    f.state.setGpsLocation(sample);
+  }},
+  {"mutator/page", &ModeMain, [](Fixture &f, uint32_t i) {
+    f.state.page(i % 3);
+  }},
+  {"mutator/buttonPage", &ModeMain, [](Fixture &f, uint32_t i) {
+    f.state.buttonPage(i & 1);
+  }},
+  {"mutator/requestRedisplay", &ModeMain, [](Fixture &f, uint32_t i) {
+    f.state.requestRedisplay();
+  }},
+  {"mutator/batch4", &ModeMain, [](Fixture &f, uint32_t i) {
+    // What uiLoop does once per pass: several button reads, one update
+    AppState::Batch batch(f.state);
+    f.state.buttonPage(false);
+    f.state.buttonField(false);
+    f.state.buttonChange(i & 1);
+    f.state.batteryVolts((i & 1) ? 3.6 : 3.7);
+  }},
+  {"mode/isActive", &ModeMain, [](Fixture &f, uint32_t i) {
+    gSink += ModeSend.isActive(f.state) ? 1 : 0;
+    gSink += ModeReadGps.isActive(f.state) ? 1 : 0;
+  }},
+  {"mode/maxSleep", &ModeMain, [](Fixture &f, uint32_t i) {
+    gSink += ModeMain.maxSleep(f.state, DAYS_IN_MILLIS(1));
+  }},
+  {"context/loop", &ModeMain, [](Fixture &f, uint32_t i) {
+    f.clock.advance(1000);
+    f.respire.loop();
+  }},
+  {"context/complete", &ModeMain, [](Fixture &f, uint32_t i) {
+    // Invoke DisplayStatus, then complete it as the display code would
+    f.state.requestRedisplay();
+    f.respire.complete(ModeDisplayStatus);
+  }},
+};
+
+static void run(const Bench &bench) {
+  Fixture fixture(*bench.root);
+  fixture.tracking();
+
+  // Warm up, then grow the iteration count until a run takes long enough to time.
+  uint32_t iterations = 1000;
+  for (uint32_t i = 0; i<iterations; ++i) {
+    bench.op(fixture, i);
+  }
+  const double kMinSeconds = 0.2;
+  for (;;) {
+    const uint32_t allocs = allocCount();
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i<iterations; ++i) {
+      bench.op(fixture, i);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    if (seconds < kMinSeconds && iterations < 100000000) {
+      iterations *= 4;
+      continue;
+    }
+    printf("{\"name\":\"%s\",\"iterations\":%u,\"ns_per_op\":%.1f,\"allocs_per_op\":%.2f}\n",
+      bench.name, iterations, seconds * 1e9 / iterations, (double)(allocCount() - allocs) / iterations);
+    fflush(stdout);
+    return;
+  }
+}
+
+static void printFn(const char c) {
+  fputc(c, stderr);
+}
+
+int main(int argc, char **argv) {
+  LogPrinter printer(printFn);
+  Log.Init(LOGLEVEL, printer);
+
+  const char *filter = argc > 1 ? argv[1] : NULL;
+  for (size_t i = 0; i<ELEMENTS(kBenches); ++i) {
+    if (filter==NULL || strstr(kBenches[i].name, filter)!=NULL) {
+      run(kBenches[i]);
+    }
+  }
+  return 0;
+}
+
+#include "../../src_native/mock_actions.h"
@@ -0,0 +1,501 @@
+/*
+  State-space explorer for the mode tree.
+
+  Breadth-first search over sequences of inputs (USB power, GPS fix, join,
+  GPS read and send results, button presses, time jumps) applied to the real
+  ModeMain tree. Each sequence is replayed from a fresh AppState and
+  RespireContext, and the resulting state is reduced to a canonical hash of
+  its inputs, display state, active Modes, outstanding actions, clock and
+  deadlines. A sequence whose hash was already seen is not extended.
+
+  Invariants checked after every input:
+  - GPS power is never on while on battery and not joined.
+  - A Mode with a minGapDuration is never invoked twice within that gap.
+  - A Mode never has more active children than its childSimultaneousLimit.
+
+  The search is split across worker processes, one per core by default. The
+  sequences of length kSplitDepth are dealt round-robin to the workers, each
+  of which explores below its share with its own visited set. Separate
+  processes keep the Mode globals and change log private to each worker.
+  Workers may revisit each other's states, so the reported state count is the
+  sum over workers.
+
+  The clock is part of the hash, so two states only merge when they are
+  reached at the same time. Respire's own timers are hashed through each
+  Mode's maxSleep(), the next deadline it reports for that subtree; timer
+  state that no deadline shows (a repeat count, say) is not.
+
+  Build and run:
+    pio run -e native_explore && .pio/build/native_explore/program [depth] [workers]
+ */
+
+#include <Arduino.h>
+#include <Logging.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <unordered_set>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "mm_state.h"
+
+#ifndef ELEMENTS
+#define ELEMENTS(_array) (sizeof(_array) / sizeof(_array[0]))
+#endif
+
+enum Input {
+  InputUsbOn,
+  InputUsbOff,
+  InputFixOn,
+  InputFixOff,
+  InputJoinOk,
+  InputJoinFail,
+  InputReadOk,
+  InputReadFail,
+  InputAck,
+  InputNoAck,
+  InputLogDone,
+  InputButtonPage,
+  InputButtonField,
+  InputWait1s,
+  InputWait1m,
+  InputWait10m,
+  InputWaitIdle,
+  kInputCount
+};
+
+static const char *kInputNames[kInputCount] = {
+  "UsbOn", "UsbOff", "FixOn", "FixOff", "JoinOk", "JoinFail", "ReadOk", "ReadFail",
+  "Ack", "NoAck", "LogDone", "ButtonPage", "ButtonField", "Wait1s", "Wait1m", "Wait10m", "WaitIdle",
+};
+
+enum Violation {
+  ViolationNone,
+  ViolationGpsPowerOnBattery,
+  ViolationMinGap,
+  ViolationSimultaneousChildren,
+};
+
+static const char *kViolationNames[] = {
+  "none",
+  "GPS power on while on battery and not joined",
+  "Mode invoked within its minGapDuration",
+  "More active children than childSimultaneousLimit",
+};
+
+enum {
+  kMaxDepth = 16,
+  kSplitDepth = 2,
+  kMaxModes = 32,
+};
+
+typedef std::vector<uint8_t> Sequence;
+
+class ExploreClock : public Clock {
+  uint32_t _millis = 100000;
+
+  public:
+  virtual uint32_t millis() {
+    return _millis;
+  }
+
+  uint32_t now() const {
+    return _millis;
+  }
+
+  void advance(uint32_t ms) {
+    _millis += ms;
+  }
+};
+
+// The limits the invariants check, as declared in src/mm_state.cpp. Respire
+// doesn't expose a Mode's limits, so keep these in step with the tree.
+static const struct {
+  Mode<AppState> *mode;
+  uint32_t minGapDuration;
+} kMinGaps[] = {
+  {&ModeSendAck, DAYS_IN_MILLIS(1)},
+};
+
+static Mode<AppState> *const kSendChildren[] = {&ModeSendAck, &ModeSendNoAck, NULL};
+
+static const struct {
+  Mode<AppState> *mode;
+  Mode<AppState> *const *children;  // NULL terminated
+  uint16_t simultaneousLimit;
+} kChildLimits[] = {
+  {&ModeSend, kSendChildren, 1},
+};
+
+// One device, driven by inputs. Also its own executor: actions are recorded as
+// outstanding until an input completes them. Display actions complete as soon
+// as the update that invoked them is over, as they do in the firmware.
+class World : public Executor<AppState> {
+  AppState _state;
+  ExploreClock _clock;
+  RespireContext<AppState> _respire;
+  uint32_t _outstanding = 0;          // Bit per Mode index awaiting completion
+  uint32_t _completeNow = 0;          // Display Modes to complete after this update
+  uint32_t _invokedAt[kMaxModes];
+  uint32_t _invoked = 0;              // Bit per Mode index invoked at least once
+  uint32_t _frameCounter = 0;
+  Violation _violation = ViolationNone;
+
+  bool outstanding(const Mode<AppState> &mode) const {
+    return _outstanding & (1UL << modeIndex(mode));
+  }
+
+  void complete(Mode<AppState> &mode) {
+    _outstanding &= ~(1UL << modeIndex(mode));
+    _respire.complete(mode);
+  }
+
+  public:
+  World()
+  : _respire(_state, ModeMain, &_clock, this) {
+    _state.setClock(&_clock);
+    _respire.init();
+    _respire.begin();
+    settle();
+  }
+
+  virtual void exec(Mode<AppState>::ActionFn fn, const AppState &state, const AppState &oldState, Mode<AppState> *trigger) {
+    if (trigger==NULL) {
+      return; // changeGpsPower, issued by AppState::onChange
+    }
+    const uint8_t index = modeIndex(*trigger);
+    if (index>=modeCount()) {
+      return;
+    }
+    for (uint8_t i = 0; i<ELEMENTS(kMinGaps); ++i) {
+      if (kMinGaps[i].mode==trigger && (_invoked & (1UL << index))
+          && _clock.millis() - _invokedAt[index] < kMinGaps[i].minGapDuration) {
+        _violation = ViolationMinGap;
+      }
+    }
+    _invoked |= 1UL << index;
+    _invokedAt[index] = _clock.millis();
+
+    if (fn==attemptJoin || fn==readGpsLocation || fn==sendLocation || fn==sendLocationAck || fn==writeLocation) {
+      _outstanding |= 1UL << index;
+    }
+    else if (fn!=changeSleep) {
+      _completeNow |= 1UL << index;
+    }
+  }
+
+  // Whether input would do anything in the current state.
+  bool enabled(Input input) const {
+    switch (input) {
+      case InputUsbOn: return !_state.getUsbPower();
+      case InputUsbOff: return _state.getUsbPower();
+      case InputFixOn: return !_state.hasGpsFix();
+      case InputFixOff: return _state.hasGpsFix();
+      case InputJoinOk:
+      case InputJoinFail: return outstanding(ModeAttemptJoin);
+      case InputReadOk:
+      case InputReadFail: return outstanding(ModeReadGps);
+      case InputAck: return outstanding(ModeSendAck);
+      case InputNoAck: return outstanding(ModeSendNoAck);
+      case InputLogDone: return outstanding(ModeLogGps);
+      default: return true;
+    }
+  }
+
+  void apply(Input input) {
+    switch (input) {
+      case InputUsbOn: _state.setUsbPower(true); break;
+      case InputUsbOff: _state.setUsbPower(false); break;
+      case InputFixOn: _state.setGpsFix(true); break;
+      case InputFixOff: _state.setGpsFix(false); break;
+      case InputJoinOk:
+        _outstanding &= ~(1UL << modeIndex(ModeAttemptJoin));
+        _respire.complete(ModeAttemptJoin, [](AppState &state) {
+          state.setJoined(true);
+        });
+        break;
+      case InputJoinFail: complete(ModeAttemptJoin); break;
+      case InputReadOk:
+        _outstanding &= ~(1UL << modeIndex(ModeReadGps));
+        _respire.complete(ModeReadGps, [](AppState &state) {
+          GpsSample sample(407000000, -740000000, 1000, 120, 2018, 3, 20, 12, 0, 0, 0);
+          state.setGpsLocation(sample);
+        });
+        break;
+      case InputReadFail: complete(ModeReadGps); break;
+      case InputAck:
+      case InputNoAck: {
+        Mode<AppState> &mode = (input==InputAck) ? ModeSendAck : ModeSendNoAck;
+        const uint32_t frame = ++_frameCounter;
+        _outstanding &= ~(1UL << modeIndex(mode));
+        _respire.complete(mode, [frame](AppState &state) {
+          state.transmittedFrame(frame);
+        });
+        break;
+      }
+      case InputLogDone: complete(ModeLogGps); break;
+      case InputButtonPage:
+        _state.buttonPage(true);
+        _state.buttonPage(false);
+        break;
+      case InputButtonField:
+        _state.buttonField(true);
+        _state.buttonField(false);
+        break;
+      case InputWait1s: _clock.advance(1000); break;
+      case InputWait1m: _clock.advance(MINUTES_IN_MILLIS(1)); break;
+      case InputWait10m: _clock.advance(MINUTES_IN_MILLIS(10)); break;
+      case InputWaitIdle: {
+        const uint32_t idle = ModeMain.maxSleep(_state, DAYS_IN_MILLIS(1));
+        _clock.advance(idle>1000 ? idle : 1000);
+        break;
+      }
+      default:
+        break;
+    }
+    _respire.loop();
+    settle();
+    check();
+  }
+
+  // Completes display actions invoked by the last update, which may invoke more.
+  void settle() {
+    while (_completeNow!=0) {
+      uint8_t index = 0;
+      while (!(_completeNow & (1UL << index))) {
+        ++index;
+      }
+      _completeNow &= ~(1UL << index);
+      _respire.complete(*modeAt(index));
+    }
+  }
+
+  void check() {
+    if (_violation!=ViolationNone) {
+      return;
+    }
+    if (!_state.getUsbPower() && !_state.getJoined() && _state.getGpsPower()) {
+      _violation = ViolationGpsPowerOnBattery;
+      return;
+    }
+    const uint32_t active = activeModes(_state);
+    for (uint8_t i = 0; i<ELEMENTS(kChildLimits); ++i) {
+      uint16_t activeChildren = 0;
+      for (Mode<AppState> *const *child = kChildLimits[i].children; *child!=NULL; ++child) {
+        activeChildren += (active & (1UL << modeIndex(**child))) ? 1 : 0;
+      }
+      if (activeChildren > kChildLimits[i].simultaneousLimit) {
+        _violation = ViolationSimultaneousChildren;
+        return;
+      }
+    }
+  }
+
+  Violation violation() const {
+    return _violation;
+  }
+
+  // FNV-1a over the values that decide what happens next. Sample validity is
+  // read on the explorer clock, so equal sequences always hash alike.
+  uint64_t hash() const {
+    uint64_t h = 14695981039346656037ULL;
+    auto mix = [&h](uint32_t value) {
+      for (uint8_t i = 0; i<4; ++i) {
+        h ^= (value >> (8 * i)) & 0xFF;
+        h *= 1099511628211ULL;
+      }
+    };
+    mix(_state.getUsbPower() | (_state.hasGpsFix() << 1) | (_state.getJoined() << 2));
+    mix(_state.gpsSampleValidMs());
+    mix(_state.page() | (_state.field() << 8));
+    mix(activeModes(_state));
+    mix(_outstanding);
+    mix(_frameCounter);
+    mix(_clock.now());
+    for (uint8_t i = 0; i<modeCount(); ++i) {
+      // Respire's timers, as far as it shows them: each subtree's next deadline
+      mix(modeAt(i)->maxSleep(_state, DAYS_IN_MILLIS(1)));
+    }
+    mix(_invoked);
+    for (uint8_t i = 0; i<modeCount(); ++i) {
+      if (_invoked & (1UL << i)) {
+        mix(_invokedAt[i]);
+      }
+    }
+    return h;
+  }
+};
+
+typedef struct WorkerResult {
+  uint64_t states;
+  uint64_t transitions;
+  uint64_t violations;
+  uint8_t firstViolation;             // Violation
+  uint8_t firstViolationLength;
+  uint8_t firstViolationInputs[kMaxDepth];
+} WorkerResult;
+
+static bool replay(const Sequence &sequence, World &world) {
+  for (size_t i = 0; i<sequence.size(); ++i) {
+    if (!world.enabled((Input)sequence[i])) {
+      return false;
+    }
+    world.apply((Input)sequence[i]);
+  }
+  return true;
+}
+
+static void noteViolation(WorkerResult &result, const Sequence &sequence, Violation violation) {
+  if (result.violations++==0) {
+    result.firstViolation = violation;
+    result.firstViolationLength = sequence.size();
+    memcpy(result.firstViolationInputs, sequence.data(), sequence.size());
+  }
+}
+
+// Explores the subtrees below the split-depth sequences dealt to this worker.
+static WorkerResult explore(const std::vector<Sequence> &roots, uint8_t depth) {
+  WorkerResult result;
+  memset(&result, 0, sizeof(result));
+  std::unordered_set<uint64_t> visited;
+  std::vector<Sequence> frontier;
+  for (size_t i = 0; i<roots.size(); ++i) {
+    World world;
+    if (replay(roots[i], world) && visited.insert(world.hash()).second) {
+      ++result.states;
+      if (world.violation()!=ViolationNone) {
+        noteViolation(result, roots[i], world.violation());
+      }
+      else {
+        frontier.push_back(roots[i]);
+      }
+    }
+  }
+
+  for (uint8_t level = kSplitDepth; level<depth && !frontier.empty(); ++level) {
+    std::vector<Sequence> next;
+    for (size_t i = 0; i<frontier.size(); ++i) {
+      for (uint8_t input = 0; input<kInputCount; ++input) {
+        World world;
+        replay(frontier[i], world);
+        if (!world.enabled((Input)input)) {
+          continue;
+        }
+        world.apply((Input)input);
+        ++result.transitions;
+        if (!visited.insert(world.hash()).second) {
+          continue;
+        }
+        ++result.states;
+        Sequence sequence(frontier[i]);
+        sequence.push_back(input);
+        if (world.violation()!=ViolationNone) {
+          noteViolation(result, sequence, world.violation());
+        }
+        else {
+          next.push_back(sequence);
+        }
+      }
+    }
+    frontier.swap(next);
+  }
+  return result;
+}
+
+static void printFn(const char c) {
+  fputc(c, stderr);
+}
+
+int main(int argc, char **argv) {
+  LogPrinter printer(printFn);
+  Log.Init(LOGLEVEL, printer);
+
+  const uint8_t depth = argc>1 ? atoi(argv[1]) : 6;
+  long workers = argc>2 ? atol(argv[2]) : sysconf(_SC_NPROCESSORS_ONLN);
+  if (depth<kSplitDepth || depth>kMaxDepth) {
+    fprintf(stderr, "Depth must be between %d and %d\n", kSplitDepth, kMaxDepth);
+    return 2;
+  }
+  if (workers<1) {
+    workers = 1;
+  }
+
+  // Every sequence of kSplitDepth inputs; disabled ones drop out on replay.
+  std::vector<Sequence> roots;
+  for (uint16_t i = 0; i<kInputCount * kInputCount; ++i) {
+    Sequence sequence;
+    sequence.push_back(i / kInputCount);
+    sequence.push_back(i % kInputCount);
+    roots.push_back(sequence);
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<pid_t> pids;
+  std::vector<int> pipes;
+  for (long w = 0; w<workers; ++w) {
+    int fds[2];
+    if (pipe(fds)!=0) {
+      perror("pipe");
+      return 1;
+    }
+    const pid_t pid = fork();
+    if (pid<0) {
+      perror("fork");
+      return 1;
+    }
+    if (pid==0) {
+      close(fds[0]);
+      std::vector<Sequence> share;
+      for (size_t i = w; i<roots.size(); i += workers) {
+        share.push_back(roots[i]);
+      }
+      const WorkerResult result = explore(share, depth);
+      const bool ok = write(fds[1], &result, sizeof(result))==sizeof(result);
+      _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    pids.push_back(pid);
+    pipes.push_back(fds[0]);
+  }
+
+  WorkerResult total;
+  memset(&total, 0, sizeof(total));
+  int status = 0;
+  for (size_t w = 0; w<pids.size(); ++w) {
+    WorkerResult result;
+    if (read(pipes[w], &result, sizeof(result))!=sizeof(result)) {
+      fprintf(stderr, "Worker %u failed\n", (unsigned)w);
+      status = 1;
+      memset(&result, 0, sizeof(result));
+    }
+    close(pipes[w]);
+    waitpid(pids[w], NULL, 0);
+    if (result.violations>0 && total.violations==0) {
+      total.firstViolation = result.firstViolation;
+      total.firstViolationLength = result.firstViolationLength;
+      memcpy(total.firstViolationInputs, result.firstViolationInputs, sizeof(total.firstViolationInputs));
+    }
+    total.states += result.states;
+    total.transitions += result.transitions;
+    total.violations += result.violations;
+  }
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("depth=%u workers=%ld states=%llu transitions=%llu violations=%llu seconds=%.2f states_per_second=%.0f\n",
+    depth, workers, (unsigned long long)total.states, (unsigned long long)total.transitions,
+    (unsigned long long)total.violations, seconds, total.states / seconds);
+  if (total.violations>0) {
+    printf("First violation: %s after", kViolationNames[total.firstViolation]);
+    for (uint8_t i = 0; i<total.firstViolationLength; ++i) {
+      printf(" %s", kInputNames[total.firstViolationInputs[i]]);
+    }
+    printf("\n");
+    status = 1;
+  }
+  return status;
+}
+
+#include "../../src_native/mock_actions.h"
@@ -0,0 +1,272 @@
+/*
+  Fleet simulator: many devices at once, across all cores.
+
+  Each device is a Simulator (src_native/simulator.h) with its own AppState,
+  RespireContext, clock and random seed, and a scripted day:
+  - half the devices live on USB power, the rest run on battery and charge
+    on USB for eight hours every evening
+  - the GPS gets its fix between 30 seconds and 3 minutes after boot
+  - devices boot at random times spread over the first `spread` minutes
+
+  Devices are dealt round-robin to worker processes, one per core by default.
+  Each worker runs its share for the given number of days and folds their
+  statistics into its own totals, which it sends back through a pipe to be
+  merged. Processes rather than threads because the Mode tree is global: each
+  worker gets its own copy of the Modes and change log, as in tools/explore. Over the last simulated day every send is placed in a
+  fleet-wide one-second bucket; sends that share a bucket with another send
+  are counted as colliding, which is what a single gateway would see.
+
+  Output is one JSON object:
+    {"devices":1000,"days":7,...,"sends_per_device_day":143.9,"peak_sends_per_second":12,"colliding_send_fraction":0.041}
+
+  Build and run:
+    pio run -e native_fleet && .pio/build/native_fleet/program [devices] [days] [workers] [spread minutes]
+ */
+
+#include <Arduino.h>
+#include <Logging.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "mm_state.h"
+#include "change_log.h"
+#include "../../src_native/simulator.h"
+
+enum {
+  kStartMillis = 100000,  // Device clock at boot
+  kDayMillis = DAYS_IN_MILLIS(1),
+  kDaySeconds = 24 * 3600,
+  kMaxDays = 40,          // Device clocks are 32 bit milliseconds
+};
+
+typedef struct FleetConfig {
+  uint32_t devices = 1000;
+  uint32_t days = 7;
+  uint32_t workers = 1;
+  uint32_t spreadMinutes = 60;
+} FleetConfig;
+
+typedef struct FleetTotals {
+  uint64_t sends = 0;
+  uint64_t ackSends = 0;
+  uint64_t joins = 0;
+  uint64_t joinSuccesses = 0;
+  uint64_t reads = 0;
+  uint64_t loops = 0;
+  uint64_t gpsOnMs = 0;
+  std::vector<uint16_t> sendsPerSecond;   // Fleet-wide, over the last day
+
+  FleetTotals()
+  : sendsPerSecond(kDaySeconds, 0) {
+  }
+
+  void add(const FleetTotals &other) {
+    sends += other.sends;
+    ackSends += other.ackSends;
+    joins += other.joins;
+    joinSuccesses += other.joinSuccesses;
+    reads += other.reads;
+    loops += other.loops;
+    gpsOnMs += other.gpsOnMs;
+    for (uint32_t i = 0; i<kDaySeconds; ++i) {
+      sendsPerSecond[i] += other.sendsPerSecond[i];
+    }
+  }
+
+  // Transfer from worker to parent, which run the same binary.
+  bool write(int fd) const {
+    uint64_t counts[] = {sends, ackSends, joins, joinSuccesses, reads, loops, gpsOnMs};
+    return transfer(fd, (uint8_t *)counts, sizeof(counts), false)
+        && transfer(fd, (uint8_t *)sendsPerSecond.data(), kDaySeconds * sizeof(uint16_t), false);
+  }
+
+  bool read(int fd) {
+    uint64_t counts[7];
+    if (!transfer(fd, (uint8_t *)counts, sizeof(counts), true)
+        || !transfer(fd, (uint8_t *)sendsPerSecond.data(), kDaySeconds * sizeof(uint16_t), true)) {
+      return false;
+    }
+    sends = counts[0];
+    ackSends = counts[1];
+    joins = counts[2];
+    joinSuccesses = counts[3];
+    reads = counts[4];
+    loops = counts[5];
+    gpsOnMs = counts[6];
+    return true;
+  }
+
+  private:
+  // Pipes move at most a buffer at a time, so loop until size is done.
+  static bool transfer(int fd, uint8_t *bytes, size_t size, bool in) {
+    while (size>0) {
+      const ssize_t done = in ? ::read(fd, bytes, size) : ::write(fd, bytes, size);
+      if (done<=0) {
+        return false;
+      }
+      bytes += done;
+      size -= done;
+    }
+    return true;
+  }
+} FleetTotals;
+
+// Maps one device's send times onto the fleet-wide last-day window.
+typedef struct SendWindow {
+  FleetTotals *totals;
+  uint32_t bootMillis;      // Fleet time at which the device booted
+  uint32_t windowMillis;    // Fleet time at which the last day starts
+} SendWindow;
+
+static void recordSend(uint32_t millis, void *context) {
+  const SendWindow &window = *(const SendWindow *)context;
+  const uint32_t fleetMillis = window.bootMillis + (millis - kStartMillis);
+  if (fleetMillis >= window.windowMillis && fleetMillis - window.windowMillis < kDayMillis) {
+    ++window.totals->sendsPerSecond[(fleetMillis - window.windowMillis) / 1000];
+  }
+}
+
+static uint32_t nextRandom(uint32_t &state) {
+  // xorshift32
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+static void runDevice(const FleetConfig &config, uint32_t device, FleetTotals &totals) {
+  uint32_t random = device * 2654435761u + 1;
+  nextRandom(random);
+  const uint32_t spreadMillis = MINUTES_IN_MILLIS(config.spreadMinutes);
+  const uint32_t bootMillis = spreadMillis ? nextRandom(random) % spreadMillis : 0;
+  const bool alwaysUsb = nextRandom(random) % 2;
+  const uint32_t fixAfter = 30000 + nextRandom(random) % 150000;
+
+  Simulator sim(ModeFunctional, SimPolicy(), device + 1);
+  SendWindow window = {&totals, bootMillis, spreadMillis + (config.days - 1) * kDayMillis};
+  sim.observeSends(recordSend, &window);
+  sim.begin(kStartMillis);
+
+  sim.input(fixAfter, SimGpsFix, true);
+  if (alwaysUsb) {
+    sim.input(0, SimUsbPower, true);
+  }
+  else {
+    // On USB from 18:00 to 02:00 fleet time
+    for (uint32_t day = 0; day<=config.days; ++day) {
+      const uint32_t plugIn = day * kDayMillis + MINUTES_IN_MILLIS(18 * 60);
+      if (plugIn >= bootMillis) {
+        sim.input(plugIn - bootMillis, SimUsbPower, true);
+        sim.input(plugIn - bootMillis + MINUTES_IN_MILLIS(8 * 60), SimUsbPower, false);
+      }
+    }
+  }
+  sim.runFor(spreadMillis - bootMillis + config.days * kDayMillis);
+
+  const SimStats &stats = sim.stats();
+  totals.sends += stats.sends;
+  totals.ackSends += stats.ackSends;
+  totals.joins += stats.joins;
+  totals.joinSuccesses += stats.joinSuccesses;
+  totals.reads += stats.reads;
+  totals.loops += stats.loops;
+  totals.gpsOnMs += stats.gpsOnMs;
+}
+
+static void printFn(const char c) {
+  fputc(c, stderr);
+}
+
+int main(int argc, char **argv) {
+  LogPrinter printer(printFn);
+  Log.Init(LOGLEVEL, printer);
+  // gChangeLog is shared by a worker's devices; the fleet doesn't need it
+  setChangeLogging(false);
+
+  FleetConfig config;
+  config.workers = sysconf(_SC_NPROCESSORS_ONLN);
+  if (argc>1) config.devices = atol(argv[1]);
+  if (argc>2) config.days = atol(argv[2]);
+  if (argc>3) config.workers = atol(argv[3]);
+  if (argc>4) config.spreadMinutes = atol(argv[4]);
+  if (config.days<1 || config.days>kMaxDays) {
+    fprintf(stderr, "Days must be between 1 and %d\n", kMaxDays);
+    return 2;
+  }
+  if (config.spreadMinutes > 24 * 60) {
+    fprintf(stderr, "Spread must be at most a day\n");
+    return 2;
+  }
+  if (config.workers<1) {
+    config.workers = 1;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<pid_t> pids;
+  std::vector<int> pipes;
+  for (uint32_t w = 0; w<config.workers; ++w) {
+    int fds[2];
+    if (pipe(fds)!=0) {
+      perror("pipe");
+      return 1;
+    }
+    const pid_t pid = fork();
+    if (pid<0) {
+      perror("fork");
+      return 1;
+    }
+    if (pid==0) {
+      close(fds[0]);
+      FleetTotals workerTotals;
+      for (uint32_t device = w; device<config.devices; device += config.workers) {
+        runDevice(config, device, workerTotals);
+      }
+      _exit(workerTotals.write(fds[1]) ? 0 : 1);
+    }
+    close(fds[1]);
+    pids.push_back(pid);
+    pipes.push_back(fds[0]);
+  }
+
+  FleetTotals totals;
+  int status = 0;
+  for (size_t w = 0; w<pids.size(); ++w) {
+    FleetTotals workerTotals;
+    if (workerTotals.read(pipes[w])) {
+      totals.add(workerTotals);
+    }
+    else {
+      fprintf(stderr, "Worker %u failed\n", (unsigned)w);
+      status = 1;
+    }
+    close(pipes[w]);
+    waitpid(pids[w], NULL, 0);
+  }
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  uint32_t peak = 0;
+  uint64_t windowSends = 0, colliding = 0;
+  for (uint32_t i = 0; i<kDaySeconds; ++i) {
+    const uint32_t count = totals.sendsPerSecond[i];
+    peak = count>peak ? count : peak;
+    windowSends += count;
+    colliding += count>1 ? count : 0;
+  }
+
+  const double deviceDays = (double)config.devices * config.days;
+  printf("{\"devices\":%u,\"days\":%u,\"workers\":%u,\"spread_minutes\":%u,\"seconds\":%.2f,\"device_days_per_second\":%.1f,"
+    "\"sends_per_device_day\":%.1f,\"ack_sends_per_device_day\":%.2f,\"joins_per_device_day\":%.2f,\"join_success_fraction\":%.3f,"
+    "\"gps_on_fraction\":%.3f,\"loops_per_device_day\":%.0f,\"peak_sends_per_second\":%u,\"colliding_send_fraction\":%.3f}\n",
+    config.devices, config.days, config.workers, config.spreadMinutes, seconds, deviceDays / seconds,
+    totals.sends / deviceDays, totals.ackSends / deviceDays, totals.joins / deviceDays,
+    totals.joins ? (double)totals.joinSuccesses / totals.joins : 0.0,
+    totals.gpsOnMs / (deviceDays * kDayMillis), totals.loops / deviceDays,
+    peak, windowSends ? (double)colliding / windowSends : 0.0);
+  return status;
+}
+
+#include "../../src_native/mock_actions.h"
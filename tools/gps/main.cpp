@@ -0,0 +1,177 @@
+/*
+  Runs the GPS read path (src/gps_reader.h) over recorded NMEA, the way
+  gps.cpp runs it on the device: the capture is released at its recorded pace
+  (src_native/nmea_replay.h), gpsLoop's GpsReader::loop() is called every
+  10ms of replay time as from a busy loop(), and a read is started every 10s
+  while none is pending, as ModeReadGps would.
+
+  replay: prints each answered read as a JSON line, then a summary. Output
+  depends only on the capture, so it can be diffed against the output of a
+  known-good build to catch regressions. speed 0 (the default) replays as
+  fast as possible; 1 is real time and 10 ten times faster.
+
+  bench: replays the capture as fast as possible until 50MB have been parsed
+  and reports throughput of the whole pipeline: replay pacing, parsing,
+  sampling and answering reads.
+
+  Without a capture, both use an hour of generated RMC+GGA at 1Hz.
+
+  Output is one JSON object per line:
+    {"t_ms":14080,"ok":1,"latitude":40.7129326,"longitude":-74.0062790,"altitude":14.10,"hdop":1.06,"utc":"2026-03-16T14:00:13.000"}
+    {"name":"gps/replay","bytes":524486,"sentences":7200,"invalid":0,"reads":360,"failures":0,"stationary_ms":0,"wall_ms":6}
+
+  Build and run:
+    pio run -e native_gps && .pio/build/native_gps/program replay [capture.nmea] [speed]
+    pio run -e native_gps && .pio/build/native_gps/program bench [capture.nmea]
+ */
+
+#include <Arduino.h>
+#include <Logging.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gps_reader.h"
+#include "../../src_native/nmea_corpus.h"
+#include "../../src_native/nmea_replay.h"
+
+enum {
+  kStepMs = 10,             // loop() period
+  kReadEveryMs = 10000,
+  kBenchBytes = 50000000,
+};
+
+typedef std::chrono::steady_clock WallClock;
+
+static uint32_t wallMillis(WallClock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(WallClock::now() - start).count();
+}
+
+typedef struct Results {
+  uint32_t now = 0;         // Replay time of the answer
+  uint64_t bytes = 0;
+  uint32_t reads = 0;
+  uint32_t failures = 0;
+  bool print = false;
+} Results;
+
+static void readSuccess(const GpsSample &sample, void *context) {
+  Results &results = *(Results *)context;
+  ++results.reads;
+  if (results.print) {
+    char latitude[16], longitude[16], altitude[16], hdop[8];
+    formatFixedPoint(latitude, sample._latitude, 7);
+    formatFixedPoint(longitude, sample._longitude, 7);
+    formatFixedPoint(altitude, sample._altitude, 2);
+    formatFixedPoint(hdop, sample._HDOP, 2);
+    printf("{\"t_ms\":%u,\"ok\":1,\"latitude\":%s,\"longitude\":%s,\"altitude\":%s,\"hdop\":%s,\"utc\":\"%04u-%02u-%02uT%02u:%02u:%02u.%03u\"}\n",
+      results.now, latitude, longitude, altitude, hdop,
+      sample._year, sample._month, sample._day, sample._hour, sample._minute, sample._seconds, sample._millis);
+  }
+}
+
+static void readFailure(void *context) {
+  Results &results = *(Results *)context;
+  ++results.reads;
+  ++results.failures;
+  if (results.print) {
+    printf("{\"t_ms\":%u,\"ok\":0}\n", results.now);
+  }
+}
+
+// Replays the whole corpus through a fresh reader. A speed of 0 doesn't wait.
+static void replay(const std::vector<std::string> &corpus, uint32_t speed, Results &results) {
+  NmeaReplaySource source(corpus);
+  GpsReader reader(source);
+  reader.motion().start(0);
+
+  const WallClock::time_point start = WallClock::now();
+  const uint32_t end = source.duration() + GpsSamplerConfig().windowMs;
+  uint32_t nextRead = 0, stationaryMs = 0;
+  for (uint32_t now = 0; now<=end; now += kStepMs) {
+    if (speed>0) {
+      const uint32_t due = now / speed;
+      const uint32_t elapsed = wallMillis(start);
+      if (due>elapsed) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(due - elapsed));
+      }
+    }
+    source.setTime(now);
+    results.now = now;
+    reader.loop(now);
+    if (!reader.reading() && now>=nextRead && !source.finished()) {
+      reader.read(readSuccess, readFailure, &results, now);
+      nextRead = now + kReadEveryMs;
+    }
+    if (reader.motion().stationary(now)) {
+      stationaryMs += kStepMs;
+    }
+  }
+  if (results.print) {
+    printf("{\"name\":\"gps/replay\",\"bytes\":%u,\"sentences\":%u,\"invalid\":%u,\"reads\":%u,\"failures\":%u,\"stationary_ms\":%u,\"wall_ms\":%u}\n",
+      reader.bytesParsed(), reader.parser().sentences(), reader.parser().invalid(), results.reads, results.failures, stationaryMs, wallMillis(start));
+  }
+  results.bytes += reader.bytesParsed();
+}
+
+static int bench(const std::vector<std::string> &corpus) {
+  Results results;
+  uint32_t runs = 0;
+  const WallClock::time_point start = WallClock::now();
+  while (results.bytes<kBenchBytes) {
+    replay(corpus, 0, results);
+    ++runs;
+  }
+  const uint64_t bytes = results.bytes;
+  const double seconds = std::chrono::duration<double>(WallClock::now() - start).count();
+  printf("{\"name\":\"gps/pipeline\",\"bytes\":%llu,\"runs\":%u,\"reads\":%u,\"failures\":%u,\"mb_per_second\":%.1f,\"ns_per_byte\":%.2f,\"us_per_read\":%.2f}\n",
+    (unsigned long long)bytes, runs, results.reads, results.failures, bytes / seconds / 1e6, seconds * 1e9 / bytes, seconds * 1e6 / results.reads);
+  return 0;
+}
+
+static void printFn(const char c) {
+  fputc(c, stderr);
+}
+
+int main(int argc, char **argv) {
+  LogPrinter printer(printFn);
+  Log.Init(LOGLEVEL, printer);
+
+  const char *command = argc>1 ? argv[1] : "replay";
+  const char *path = argc>2 ? argv[2] : NULL;
+  uint32_t speed = 0;
+  if (strcmp(command, "replay")==0) {
+    if (argc>3) speed = atol(argv[3]);
+  }
+  else if (strcmp(command, "bench")!=0) {
+    fprintf(stderr, "Usage: %s replay [capture.nmea] [speed] | bench [capture.nmea]\n", argv[0]);
+    return 2;
+  }
+
+  std::vector<std::string> corpus;
+  if (path!=NULL) {
+    if (!readCorpus(path, corpus)) {
+      return 2;
+    }
+  }
+  else {
+    corpus = generateCorpus();
+  }
+  if (corpus.empty()) {
+    fprintf(stderr, "Empty corpus\n");
+    return 2;
+  }
+  if (strcmp(command, "bench")==0) {
+    return bench(corpus);
+  }
+  Results results;
+  results.print = true;
+  replay(corpus, speed, results);
+  return 0;
+}
+
+#include "../../src_native/mock_actions.h"
@@ -0,0 +1,417 @@
+/*
+  Benchmark and fuzz harness for the NMEA parser (src/nmea.h).
+
+  bench: parses a corpus of NMEA sentences repeatedly and reports bytes per
+  second, both through NmeaParser and through the path gps.cpp used before
+  it: lines assembled in a buffer, strstr for the sentence type, then field
+  parsing with atof/atol in the manner of Adafruit_GPS::parse. It also
+  re-encodes each fix as an MTK binary packet (src/mtk_binary.h) and times
+  MtkBinaryParser over those, for the GPS_BINARY build. Give it a
+  capture from the device (GPSECHO, or a logic analyser on the UART); without
+  one it generates an hour of RMC+GGA at 1Hz along a made-up route.
+
+  fuzz: mutates corpus sentences (bit flips, dropped, duplicated and inserted
+  bytes, splices) and feeds them through the parser, checking that
+  - every sentence the parser accepts really has a matching checksum
+  - after any garbage, a good sentence is decoded exactly as it is alone
+  Build with -fsanitize=address,undefined to also catch memory errors.
+
+  Output is one JSON object per line:
+    {"name":"nmea/incremental","bytes":50350656,"mb_per_second":118.5,"ns_per_byte":8.44,"sentences":691200,"bytes_per_fix":145.7,"ns_per_fix":1229.7}
+
+  Build and run:
+    pio run -e native_nmea && .pio/build/native_nmea/program bench [corpus.nmea]
+    pio run -e native_nmea && .pio/build/native_nmea/program fuzz [iterations] [seed] [corpus.nmea]
+ */
+
+#include <Arduino.h>
+#include <Logging.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "nmea.h"
+#include "mtk_binary.h"
+#include "../../src_native/nmea_corpus.h"
+
+enum {
+  kBenchBytes = 50000000,   // Bytes parsed per benchmark
+  kLineLength = 120,        // Adafruit_GPS MAXLINELENGTH
+};
+
+// The pre-NmeaParser path: the fields Adafruit_GPS::parse fills, parsed the
+// way it parses them.
+typedef struct LineFix {
+  uint8_t hour, minute, seconds, year, month, day;
+  uint16_t milliseconds;
+  float latitude, longitude, latitudeDegrees, longitudeDegrees;
+  float altitude, HDOP, speed, angle;
+  char lat, lon;
+  uint8_t fixquality, satellites;
+  bool fix;
+} LineFix;
+
+static uint8_t parseHex(char c) {
+  if (c<'0') return 0;
+  if (c<='9') return c - '0';
+  if (c<'A') return 0;
+  if (c<='F') return (c - 'A') + 10;
+  return 0;
+}
+
+static float parseCoordinate(const char *p, uint8_t degreeDigits, float &degrees) {
+  char buffer[10];
+  strncpy(buffer, p, degreeDigits);
+  buffer[degreeDigits] = 0;
+  const long whole = atol(buffer);
+  strncpy(buffer, p + degreeDigits, 2);
+  p = strchr(p, '.') + 1;
+  strncpy(buffer + 2, p, 4);
+  buffer[6] = 0;
+  const long minutes = 50 * atol(buffer) / 3;
+  degrees = (whole * 10000000 + minutes) / 10000000.0f;
+  return whole * 100 + atol(buffer) / 10000.0f;
+}
+
+static bool lineParse(LineFix &fix, char *nmea) {
+  const size_t length = strlen(nmea);
+  if (length<4 || nmea[length - 4]!='*') {
+    return false;
+  }
+  uint8_t sum = parseHex(nmea[length - 3]) * 16 + parseHex(nmea[length - 2]);
+  for (size_t i = 1; i<length - 4; ++i) {
+    sum ^= nmea[i];
+  }
+  if (sum!=0) {
+    return false;
+  }
+  const bool gga = strstr(nmea, "$GPGGA")!=NULL;
+  const bool rmc = strstr(nmea, "$GPRMC")!=NULL;
+  if (!gga && !rmc) {
+    return false;
+  }
+  char *p = strchr(nmea, ',') + 1;
+  const float timef = atof(p);
+  const uint32_t time = timef;
+  fix.hour = time / 10000;
+  fix.minute = (time % 10000) / 100;
+  fix.seconds = time % 100;
+  fix.milliseconds = fmod(timef, 1.0) * 1000;
+  if (rmc) {
+    p = strchr(p, ',') + 1;
+    fix.fix = p[0]=='A';
+  }
+  p = strchr(p, ',') + 1;
+  if (',' != *p) fix.latitude = parseCoordinate(p, 2, fix.latitudeDegrees);
+  p = strchr(p, ',') + 1;
+  if (',' != *p) {
+    fix.lat = p[0];
+    if (p[0]=='S') fix.latitudeDegrees *= -1.0f;
+  }
+  p = strchr(p, ',') + 1;
+  if (',' != *p) fix.longitude = parseCoordinate(p, 3, fix.longitudeDegrees);
+  p = strchr(p, ',') + 1;
+  if (',' != *p) {
+    fix.lon = p[0];
+    if (p[0]=='W') fix.longitudeDegrees *= -1.0f;
+  }
+  if (gga) {
+    p = strchr(p, ',') + 1;
+    fix.fixquality = atoi(p);
+    p = strchr(p, ',') + 1;
+    fix.satellites = atoi(p);
+    p = strchr(p, ',') + 1;
+    fix.HDOP = atof(p);
+    p = strchr(p, ',') + 1;
+    fix.altitude = atof(p);
+  }
+  else {
+    p = strchr(p, ',') + 1;
+    fix.speed = atof(p);
+    p = strchr(p, ',') + 1;
+    fix.angle = atof(p);
+    p = strchr(p, ',') + 1;
+    const uint32_t date = atol(p);
+    fix.day = date / 10000;
+    fix.month = (date % 10000) / 100;
+    fix.year = date % 100;
+  }
+  return true;
+}
+
+// Line assembly as Adafruit_GPS::read() does it; the '\n' is dropped.
+class LineReader {
+  char _line[kLineLength];
+  uint8_t _length = 0;
+
+  public:
+  LineFix fix;
+  uint32_t sentences = 0;
+
+  void feed(char c) {
+    if (c=='\n') {
+      _line[_length] = 0;
+      if (lineParse(fix, _line)) {
+        ++sentences;
+      }
+      _length = 0;
+    }
+    else if (_length < kLineLength - 1) {
+      _line[_length++] = c;
+    }
+    else {
+      _length = 0;
+    }
+  }
+};
+
+static void appendU32(std::string &packet, uint32_t value) {
+  for (uint8_t i = 0; i<4; ++i) {
+    packet.push_back((char)(value >> (8 * i)));
+  }
+}
+
+// The MTK binary packet for fix.
+static std::string encodeMtk(const NmeaFix &fix) {
+  std::string packet;
+  packet.push_back((char)MtkBinaryParser::kPreamble1);
+  packet.push_back((char)MtkBinaryParser::kPreamble2);
+  packet.push_back((char)MtkBinaryParser::kPayloadSize);
+  appendU32(packet, fix._latitude);
+  appendU32(packet, fix._longitude);
+  appendU32(packet, fix._altitude);
+  appendU32(packet, (uint32_t)fix._speed * 1852 / 3600);
+  appendU32(packet, fix._course);
+  packet.push_back((char)fix._satellites);
+  packet.push_back((char)(fix._quality ? 3 : 1));
+  appendU32(packet, fix._day * 10000 + fix._month * 100 + fix._year % 100);
+  appendU32(packet, fix._hour * 10000000 + fix._minute * 100000 + fix._seconds * 1000 + fix._millis);
+  packet.push_back((char)(fix._HDOP & 0xFF));
+  packet.push_back((char)(fix._HDOP >> 8));
+  uint8_t ckA = 0, ckB = 0;
+  for (size_t i = 2; i<packet.size(); ++i) {
+    ckB += (ckA += (uint8_t)packet[i]);
+  }
+  packet.push_back((char)ckA);
+  packet.push_back((char)ckB);
+  return packet;
+}
+
+static volatile uint32_t gSink = 0;
+
+static void printBench(const char *name, uint64_t bytes, double seconds, uint32_t sentences, uint32_t fixes) {
+  printf("{\"name\":\"%s\",\"bytes\":%llu,\"mb_per_second\":%.1f,\"ns_per_byte\":%.2f,\"sentences\":%u,\"bytes_per_fix\":%.1f,\"ns_per_fix\":%.1f}\n",
+    name, (unsigned long long)bytes, bytes / seconds / 1e6, seconds * 1e9 / bytes, sentences,
+    fixes ? (double)bytes / fixes : 0.0, fixes ? seconds * 1e9 / fixes : 0.0);
+}
+
+static int bench(const std::vector<std::string> &corpus) {
+  std::string stream;
+  for (const std::string &line : corpus) {
+    stream += line;
+  }
+  if (stream.empty()) {
+    fprintf(stderr, "Empty corpus\n");
+    return 2;
+  }
+  const uint32_t passes = kBenchBytes / stream.size() + 1;
+  const uint64_t bytes = (uint64_t)passes * stream.size();
+
+  // The same fixes as binary packets, one per GGA
+  std::string packets;
+  uint32_t fixes = 0;
+  {
+    NmeaParser parser;
+    for (char c : stream) {
+      if (parser.feed(c)==NmeaGga) {
+        packets += encodeMtk(parser.fix());
+        ++fixes;
+      }
+    }
+  }
+  const uint32_t packetPasses = packets.empty() ? 0 : kBenchBytes / packets.size() + 1;
+
+  {
+    NmeaParser parser;
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t pass = 0; pass<passes; ++pass) {
+      for (char c : stream) {
+        gSink += parser.feed(c);
+      }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    gSink += parser.fix()._latitude;
+    printBench("nmea/incremental", bytes, seconds, parser.sentences(), passes * fixes);
+  }
+  {
+    LineReader reader;
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t pass = 0; pass<passes; ++pass) {
+      for (char c : stream) {
+        reader.feed(c);
+      }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    gSink += reader.fix.latitudeDegrees;
+    printBench("nmea/line_atof", bytes, seconds, reader.sentences, passes * fixes);
+  }
+  if (packetPasses>0) {
+    MtkBinaryParser parser;
+    const auto start = std::chrono::steady_clock::now();
+    for (uint32_t pass = 0; pass<packetPasses; ++pass) {
+      for (char c : packets) {
+        gSink += parser.feed(c);
+      }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    gSink += parser.fix()._latitude;
+    printBench("mtk/binary", (uint64_t)packetPasses * packets.size(), seconds, parser.sentences(), packetPasses * fixes);
+  }
+  return 0;
+}
+
+static std::string mutate(const std::vector<std::string> &corpus, uint32_t &random) {
+  std::string text = corpus[nextRandom(random) % corpus.size()];
+  const uint32_t mutations = 1 + nextRandom(random) % 4;
+  for (uint32_t m = 0; m<mutations && !text.empty(); ++m) {
+    const size_t at = nextRandom(random) % text.size();
+    switch (nextRandom(random) % 5) {
+      case 0:
+        text[at] ^= 1 << (nextRandom(random) % 8);
+        break;
+      case 1:
+        text.erase(at, 1 + nextRandom(random) % 8);
+        break;
+      case 2:
+        text.insert(at, 1, "$*,.-0123456789ANSEW\r\n"[nextRandom(random) % 22]);
+        break;
+      case 3:
+        text.insert(at, text.substr(at, 1 + nextRandom(random) % 16));
+        break;
+      case 4: {
+        const std::string &other = corpus[nextRandom(random) % corpus.size()];
+        text = text.substr(0, at) + other.substr(nextRandom(random) % other.size());
+        break;
+      }
+    }
+  }
+  return text;
+}
+
+// Whether a and b agree on the fields a sentence of type result sets.
+static bool sameFix(NmeaResult result, const NmeaFix &a, const NmeaFix &b) {
+  const bool time = a._hour==b._hour && a._minute==b._minute && a._seconds==b._seconds && a._millis==b._millis;
+  switch (result) {
+    case NmeaGga:
+      return time && a._latitude==b._latitude && a._longitude==b._longitude && a._altitude==b._altitude
+          && a._HDOP==b._HDOP && a._quality==b._quality && a._satellites==b._satellites;
+    case NmeaRmc:
+      return time && a._year==b._year && a._month==b._month && a._day==b._day
+          && a._valid==b._valid && a._speed==b._speed && a._course==b._course;
+    default:
+      return true;
+  }
+}
+
+// Feeds text and returns the last result other than NmeaNone.
+static NmeaResult feedAll(NmeaParser &parser, const std::string &text) {
+  NmeaResult last = NmeaNone;
+  for (char c : text) {
+    const NmeaResult result = parser.feed(c);
+    if (result!=NmeaNone) {
+      last = result;
+    }
+  }
+  return last;
+}
+
+static int fuzz(const std::vector<std::string> &corpus, uint32_t iterations, uint32_t seed) {
+  uint32_t random = seed ? seed : 1;
+  uint32_t failures = 0, accepted = 0, rejected = 0;
+  for (uint32_t i = 0; i<iterations; ++i) {
+    const std::string text = mutate(corpus, random);
+    NmeaParser parser;
+    size_t start = std::string::npos;
+    for (size_t at = 0; at<text.size(); ++at) {
+      if (text[at]=='$') {
+        start = at;
+      }
+      const NmeaResult result = parser.feed(text[at]);
+      if (result==NmeaGga || result==NmeaRmc || result==NmeaOther) {
+        ++accepted;
+        // Accepted: must end in *XX with XX the checksum of what's between $ and *
+        const char *sentence = text.c_str() + start;
+        const char *star = text.c_str() + at - 2;
+        char expected[3];
+        snprintf(expected, sizeof(expected), "%02X", checksum(sentence + 1, star));
+        if (start==std::string::npos || *star!='*' || strncasecmp(expected, star + 1, 2)!=0) {
+          if (failures++ < 10) {
+            fprintf(stderr, "Accepted bad sentence: %s\n", text.c_str());
+          }
+        }
+      }
+      else if (result==NmeaInvalid) {
+        ++rejected;
+      }
+    }
+
+    // Whatever came before, a good sentence decodes as it does alone
+    const std::string &good = corpus[nextRandom(random) % corpus.size()];
+    NmeaParser alone;
+    const NmeaResult expected = feedAll(alone, good);
+    const NmeaResult actual = feedAll(parser, good);
+    if (actual!=expected || !sameFix(expected, parser.fix(), alone.fix())) {
+      if (failures++ < 10) {
+        fprintf(stderr, "Did not resync after: %s\n", text.c_str());
+      }
+    }
+  }
+  printf("{\"name\":\"nmea/fuzz\",\"iterations\":%u,\"seed\":%u,\"accepted\":%u,\"rejected\":%u,\"failures\":%u}\n",
+    iterations, seed, accepted, rejected, failures);
+  return failures>0 ? 1 : 0;
+}
+
+static void printFn(const char c) {
+  fputc(c, stderr);
+}
+
+int main(int argc, char **argv) {
+  LogPrinter printer(printFn);
+  Log.Init(LOGLEVEL, printer);
+
+  const char *command = argc>1 ? argv[1] : "bench";
+  const char *path = NULL;
+  uint32_t iterations = 100000, seed = 1;
+  if (strcmp(command, "bench")==0) {
+    path = argc>2 ? argv[2] : NULL;
+  }
+  else if (strcmp(command, "fuzz")==0) {
+    if (argc>2) iterations = atol(argv[2]);
+    if (argc>3) seed = atol(argv[3]);
+    path = argc>4 ? argv[4] : NULL;
+  }
+  else {
+    fprintf(stderr, "Usage: %s bench [corpus.nmea] | fuzz [iterations] [seed] [corpus.nmea]\n", argv[0]);
+    return 2;
+  }
+
+  std::vector<std::string> corpus;
+  if (path!=NULL) {
+    if (!readCorpus(path, corpus)) {
+      return 2;
+    }
+  }
+  else {
+    corpus = generateCorpus();
+  }
+  if (corpus.empty()) {
+    fprintf(stderr, "Empty corpus\n");
+    return 2;
+  }
+  return strcmp(command, "bench")==0 ? bench(corpus) : fuzz(corpus, iterations, seed);
+}
+
+#include "../../src_native/mock_actions.h"
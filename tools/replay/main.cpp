@@ -0,0 +1,92 @@
+/*
+  Replays device journals (see src/journal.h) against the mode tree, with the
+  replayer in src_native/journal_replay.h.
+
+  Files are read in the order given and replayed as one stream, so a rotated
+  journal replays as journal.old then journal.bin. At each checkpoint where
+  the replayed set of active Modes differs from the recorded one, the
+  divergence is reported, naming the Modes only active on the device (-) or
+  only in the replay (+).
+
+  Build and run:
+    pio run -e native_replay && .pio/build/native_replay/program [journal.old] journal.bin
+ */
+
+#include <Arduino.h>
+#include <Logging.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "mm_state.h"
+#include "change_log.h"
+#include "journal.h"
+#include "../../src_native/journal_replay.h"
+
+enum {
+  kMaxDivergencesShown = 10,
+};
+
+static void printModes(const char *prefix, uint32_t modes) {
+  for (uint8_t i = 0; i<modeCount(); ++i) {
+    if (modes & (1UL << i)) {
+      printf(" %s%s", prefix, modeAt(i)->name());
+    }
+  }
+}
+
+static void printDivergence(const JournalRecord &checkpoint, uint32_t replayed, uint32_t run, void *context) {
+  uint32_t &shown = *(uint32_t *)context;
+  if (shown++ < kMaxDivergencesShown) {
+    printf("Divergence at %u ms (run %u):", checkpoint._millis, run);
+    printModes("-", checkpoint._value32 & ~replayed);
+    printModes("+", replayed & ~checkpoint._value32);
+    printf("\n");
+  }
+}
+
+static void printFn(const char c) {
+  fputc(c, stderr);
+}
+
+int main(int argc, char **argv) {
+  LogPrinter printer(printFn);
+  Log.Init(LOGLEVEL, printer);
+  setChangeLogging(false);
+
+  if (argc<2) {
+    fprintf(stderr, "Usage: %s [journal.old] journal.bin\n", argv[0]);
+    return 2;
+  }
+  std::vector<uint8_t> bytes;
+  for (int i = 1; i<argc; ++i) {
+    FILE *file = fopen(argv[i], "rb");
+    if (file==NULL) {
+      perror(argv[i]);
+      return 2;
+    }
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file))>0) {
+      bytes.insert(bytes.end(), chunk, chunk + n);
+    }
+    fclose(file);
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  uint32_t shown = 0;
+  JournalReplay replay;
+  const JournalReplayStats &stats = replay.replay(bytes.data(), bytes.size(), printDivergence, &shown);
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  if (stats.consumed!=bytes.size()) {
+    printf("Ignored %u trailing bytes\n", (unsigned)(bytes.size() - stats.consumed));
+  }
+  printf("records=%u boots=%u checkpoints=%u divergences=%u gaps=%u skipped=%u replayed_seconds=%.0f seconds=%.3f speedup=%.0f\n",
+    stats.records, stats.boots, stats.checkpoints, stats.divergences, stats.gaps, stats.skipped,
+    stats.replayedMillis / 1000.0, seconds, seconds>0 ? stats.replayedMillis / 1000.0 / seconds : 0.0);
+  return stats.divergences>0 ? 1 : 0;
+}
+
+#include "../../src_native/mock_actions.h"